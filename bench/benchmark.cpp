@@ -0,0 +1,205 @@
+// Times loading and querying synthetic cities of growing size and prints the results as JSON, for
+// tracking regressions. Usage:
+//   benchmark [config.json]             runs the benchmark
+//   benchmark --generate [config.json]  prints the input of the first city instead, for main
+// The config may set "stop_counts" ([1000, 10000, 50000]), "city" (CityGenerator::Settings keys;
+// "line_count" defaults to a line per 10 stops), "requests" ({"Route": 100, ...}), "repeats" (3)
+// and "all_pairs_limit" (2000): larger cities are routed on demand, the route table being cubic.
+
+#include "city_generator.h"
+#include "request.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+    using Map = std::map<std::string, Json::Node>;
+
+    struct Config {
+        std::vector<size_t> stop_counts = {1000, 10000, 50000};
+        Json::Node city = Map{};
+        CityGenerator::RequestMix requests;
+        size_t repeats = 3;
+        size_t all_pairs_limit = 2000;
+    };
+
+    Config ReadConfig(const Json::Node &node) {
+        const auto &map = node.AsMap();
+        Config config;
+        if (auto it = map.find("stop_counts"); it != map.end()) {
+            config.stop_counts.clear();
+            for (const auto &count: it->second.AsArray()) {
+                config.stop_counts.push_back(static_cast<size_t>(count.AsDouble()));
+            }
+        }
+        if (auto it = map.find("city"); it != map.end()) {
+            config.city = it->second;
+        }
+        if (auto it = map.find("requests"); it != map.end()) {
+            config.requests = CityGenerator::ReadRequestMix(it->second);
+        }
+        if (auto it = map.find("repeats"); it != map.end()) {
+            config.repeats = std::max<size_t>(1, static_cast<size_t>(it->second.AsDouble()));
+        }
+        if (auto it = map.find("all_pairs_limit"); it != map.end()) {
+            config.all_pairs_limit = static_cast<size_t>(it->second.AsDouble());
+        }
+        return config;
+    }
+
+    Json::Node GenerateInput(const Config &config, size_t stop_count) {
+        const auto settings = CityGenerator::ReadSettings(config.city, {
+                .stop_count = stop_count,
+                .line_count = std::max<size_t>(1, stop_count / 10)
+        });
+        auto input = CityGenerator::Generate(settings, config.requests);
+        auto &routing_settings = std::get<Map>(std::get<Map>(input)["routing_settings"]);
+        routing_settings["routing_mode"] = std::string(stop_count > config.all_pairs_limit ? "on_demand" : "all_pairs");
+        return input;
+    }
+
+    uint64_t Elapsed(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // nanoseconds of each repeat
+    using Samples = std::vector<uint64_t>;
+
+    Json::Node SamplesToJson(Samples samples) {
+        std::sort(samples.begin(), samples.end());
+        return Json::Node{Map{
+                {"min_ns", Json::Int(static_cast<int64_t>(samples.front()))},
+                {"median_ns", Json::Int(static_cast<int64_t>(samples[samples.size() / 2]))}
+        }};
+    }
+
+    Json::Node RunCity(const Config &config, size_t stop_count) {
+        const auto input = GenerateInput(config, stop_count);
+        std::ostringstream input_text;
+        Json::Print(input_text, input);
+
+        // the guide build is broken down by its trace spans, the only code traced
+        std::map<std::string, Samples> phases;
+        std::map<std::string, Samples> spans;
+        std::unique_ptr<TransportGuide> guide;
+        std::optional<Json::Document> document;
+        for (size_t repeat = 0; repeat < config.repeats; ++repeat) {
+            guide.reset();
+            document.reset();
+            std::istringstream in(input_text.str());
+            auto start = std::chrono::steady_clock::now();
+            document.emplace(Json::Load(in));
+            phases["parse"].push_back(Elapsed(start));
+
+            const auto &root = document->GetRoot().AsMap();
+            start = std::chrono::steady_clock::now();
+            auto descriptions = Descriptions::ReadJson(root.at("base_requests"));
+            phases["descriptions"].push_back(Elapsed(start));
+
+            const auto routing_settings = Transport::ReadFrom(root.at("routing_settings"));
+            const auto render_settings = Render::ReadJson(root.at("render_settings"));
+            Trace::Clear();
+            Trace::Enable();
+            start = std::chrono::steady_clock::now();
+            guide = std::make_unique<TransportGuide>(std::move(descriptions), routing_settings, render_settings);
+            phases["build"].push_back(Elapsed(start));
+            Trace::Disable();
+
+            auto totals = Trace::Summarize();
+            for (const auto &[name, total]: totals) {
+                spans[name].push_back(total.nanoseconds);
+            }
+            const uint64_t optimizer = totals["RenderDataOptimizer::Optimize"].nanoseconds;
+            phases["router"].push_back(totals["TransportRouter::BuildMap"].nanoseconds);
+            phases["optimizer"].push_back(optimizer);
+            phases["render"].push_back(totals["TransportGuide::BuildRenderers"].nanoseconds - optimizer);
+        }
+        const size_t memory = guide->EstimateMemory();
+
+        // each type alone, in batches as main answers them, untraced
+        Trace::Clear();
+        VersionedGuide versioned(std::move(guide));
+        std::map<std::string, std::vector<Json::Node>> batches;
+        for (const auto &request: document->GetRoot().AsMap().at("stat_requests").AsArray()) {
+            batches[request.AsMap().at("type").AsString()].push_back(request);
+        }
+        Map requests;
+        for (const auto &[type, batch]: batches) {
+            const Json::Node batch_node(batch);
+            Samples samples;
+            for (size_t repeat = 0; repeat < config.repeats; ++repeat) {
+                const auto start = std::chrono::steady_clock::now();
+                Requests::ProcessAll(versioned, batch_node);
+                samples.push_back(Elapsed(start));
+            }
+            auto node = SamplesToJson(samples);
+            auto &node_map = std::get<Map>(node);
+            node_map["count"] = Json::Int(static_cast<int64_t>(batch.size()));
+            node_map["per_request_ns"] = Json::Int(node_map.at("median_ns").AsInt() / static_cast<int64_t>(batch.size()));
+            requests.emplace(type, std::move(node));
+        }
+
+        Map phase_nodes;
+        for (auto &[name, samples]: phases) {
+            phase_nodes.emplace(name, SamplesToJson(std::move(samples)));
+        }
+        Map span_nodes;
+        for (auto &[name, samples]: spans) {
+            span_nodes.emplace(name, SamplesToJson(std::move(samples)));
+        }
+        const auto &input_map = input.AsMap();
+        return Json::Node{Map{
+                {"stop_count", Json::Int(static_cast<int64_t>(stop_count))},
+                {"line_count", Json::Int(static_cast<int64_t>(
+                        input_map.at("base_requests").AsArray().size() - stop_count))},
+                {"routing_mode", input_map.at("routing_settings").AsMap().at("routing_mode")},
+                {"input_bytes", Json::Int(static_cast<int64_t>(input_text.str().size()))},
+                {"estimated_memory_bytes", Json::Int(static_cast<int64_t>(memory))},
+                {"phases", Json::Node{std::move(phase_nodes)}},
+                {"spans", Json::Node{std::move(span_nodes)}},
+                {"requests", Json::Node{std::move(requests)}}
+        }};
+    }
+
+}
+
+int main(int argc, char **argv) {
+    const bool generate = argc > 1 && std::strcmp(argv[1], "--generate") == 0;
+    Config config;
+    if (const int config_arg = generate ? 2 : 1; argc > config_arg) {
+        std::ifstream in(argv[config_arg]);
+        if (!in) {
+            throw std::runtime_error(std::string("Cannot open config ") + argv[config_arg]);
+        }
+        config = ReadConfig(Json::Load(in).GetRoot());
+    }
+    if (config.stop_counts.empty()) {
+        throw std::invalid_argument("no stop_counts to run");
+    }
+    if (generate) {
+        Json::Print(std::cout, GenerateInput(config, config.stop_counts.front()));
+        return 0;
+    }
+
+    std::vector<Json::Node> cities;
+    for (const size_t stop_count: config.stop_counts) {
+        std::cerr << "benchmarking " << stop_count << " stops" << std::endl;
+        cities.push_back(RunCity(config, stop_count));
+    }
+    Json::Print(std::cout, Json::Node{Map{
+            {"repeats", Json::Int(static_cast<int64_t>(config.repeats))},
+            {"cities", Json::Node{std::move(cities)}}
+    }});
+    return 0;
+}
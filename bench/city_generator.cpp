@@ -0,0 +1,358 @@
+#include "city_generator.h"
+#include "coordinates.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace CityGenerator {
+
+    namespace {
+
+        using Map = std::map<std::string, Json::Node>;
+
+        // a square of about 30 km
+        constexpr double kMinLatitude = 55.61, kMaxLatitude = 55.89;
+        constexpr double kMinLongitude = 37.35, kMaxLongitude = 37.85;
+        // stops per grid cell, on average
+        constexpr double kCellStops = 4;
+
+        // stops bucketed by square cells, to find the ones near a stop
+        class StopGrid {
+        public:
+            explicit StopGrid(const std::vector<Coordinates::Point> &points)
+                    : side_(std::max<size_t>(1, static_cast<size_t>(std::sqrt(points.size() / kCellStops)))),
+                      cells_(side_ * side_) {
+                for (size_t stop = 0; stop < points.size(); ++stop) {
+                    cells_[GetRow(points[stop]) * side_ + GetColumn(points[stop])].push_back(stop);
+                }
+            }
+
+            size_t GetSide() const {
+                return side_;
+            }
+
+            // stops of the cells at most `radius` cells away from the cell of `point`
+            std::vector<size_t> FindNearby(Coordinates::Point point, size_t radius) const {
+                const size_t row = GetRow(point), column = GetColumn(point);
+                std::vector<size_t> stops;
+                for (size_t r = row - std::min(row, radius); r <= std::min(side_ - 1, row + radius); ++r) {
+                    for (size_t c = column - std::min(column, radius); c <= std::min(side_ - 1, column + radius); ++c) {
+                        const auto &cell = cells_[r * side_ + c];
+                        stops.insert(stops.end(), cell.begin(), cell.end());
+                    }
+                }
+                return stops;
+            }
+
+        private:
+            size_t GetRow(Coordinates::Point point) const {
+                return ToCell((point.latitude - kMinLatitude) / (kMaxLatitude - kMinLatitude));
+            }
+
+            size_t GetColumn(Coordinates::Point point) const {
+                return ToCell((point.longitude - kMinLongitude) / (kMaxLongitude - kMinLongitude));
+            }
+
+            size_t ToCell(double share) const {
+                return std::min(side_ - 1, static_cast<size_t>(std::max(share, 0.) * side_));
+            }
+
+            size_t side_;
+            std::vector<std::vector<size_t>> cells_;
+        };
+
+        class Generator {
+        public:
+            explicit Generator(const Settings &settings) : settings_(settings), random_(settings.seed) {}
+
+            Json::Node Generate(const RequestMix &requests) {
+                PlaceStops();
+                const StopGrid grid(points_);
+                for (size_t line = 0; line < settings_.line_count; ++line) {
+                    WalkLine(grid);
+                }
+                AddNearbyDistances(grid);
+                return Json::Node{Map{
+                        {"base_requests", MakeBaseRequests()},
+                        {"routing_settings", Json::Node{Map{
+                                {"bus_wait_time", Json::Int(6)},
+                                {"bus_velocity", Json::Int(40)}
+                        }}},
+                        {"render_settings", MakeRenderSettings()},
+                        {"stat_requests", MakeStatRequests(requests)}
+                }};
+            }
+
+        private:
+            static std::string StopName(size_t stop) {
+                return "Stop " + std::to_string(stop);
+            }
+
+            static std::string BusName(size_t bus) {
+                return "Bus " + std::to_string(bus);
+            }
+
+            size_t RandomIndex(size_t size) {
+                return std::uniform_int_distribution<size_t>(0, size - 1)(random_);
+            }
+
+            double RandomReal(double min, double max) {
+                return std::uniform_real_distribution<double>(min, max)(random_);
+            }
+
+            void PlaceStops() {
+                points_.reserve(settings_.stop_count);
+                for (size_t stop = 0; stop < settings_.stop_count; ++stop) {
+                    points_.push_back({RandomReal(kMinLatitude, kMaxLatitude), RandomReal(kMinLongitude, kMaxLongitude)});
+                }
+                road_distances_.resize(settings_.stop_count);
+            }
+
+            // Lines keep to a heading, turning a little at each stop, and go on to one of the
+            // unvisited stops around, the farther along the heading the likelier; a line with no
+            // such stop left ends there.
+            void WalkLine(const StopGrid &grid) {
+                const size_t length = settings_.min_line_stops
+                                      + RandomIndex(settings_.max_line_stops - settings_.min_line_stops + 1);
+                std::vector<size_t> stops = {RandomIndex(points_.size())};
+                double heading = RandomReal(-M_PI, M_PI);
+                while (stops.size() < length) {
+                    const auto from = points_[stops.back()];
+                    std::vector<size_t> candidates;
+                    for (size_t radius = 1; candidates.empty() && radius <= grid.GetSide(); radius *= 2) {
+                        for (const size_t stop: grid.FindNearby(from, radius)) {
+                            if (std::find(stops.begin(), stops.end(), stop) == stops.end()) {
+                                candidates.push_back(stop);
+                            }
+                        }
+                    }
+                    if (candidates.empty()) {
+                        break;
+                    }
+                    size_t next = candidates.front();
+                    double best_score = -INFINITY;
+                    for (const size_t stop: candidates) {
+                        const double angle = std::atan2(points_[stop].latitude - from.latitude,
+                                                        points_[stop].longitude - from.longitude);
+                        if (const double score = std::cos(angle - heading) + RandomReal(0, 1); score > best_score) {
+                            best_score = score;
+                            next = stop;
+                        }
+                    }
+                    AddDistance(stops.back(), next);
+                    stops.push_back(next);
+                    heading += RandomReal(-0.3, 0.3);
+                }
+                const bool is_roundtrip = stops.size() > 1 && RandomReal(0, 1) < settings_.roundtrip_ratio;
+                if (is_roundtrip) {
+                    AddDistance(stops.back(), stops.front());
+                    stops.push_back(stops.front());
+                }
+                lines_.push_back({std::move(stops), is_roundtrip});
+            }
+
+            // the straight line, lengthened by the bends of the road; given one way, the other
+            // way is taken to be the same
+            void AddDistance(size_t from, size_t to) {
+                const uint64_t key = std::min(from, to) * points_.size() + std::max(from, to);
+                if (!listed_.insert(key).second) {
+                    return;
+                }
+                const double distance = Coordinates::DistanceBetween(points_[from], points_[to]) * RandomReal(1.1, 1.5);
+                road_distances_[from].emplace_back(to, std::max(1, static_cast<int>(std::round(distance))));
+            }
+
+            void AddNearbyDistances(const StopGrid &grid) {
+                const auto target = static_cast<size_t>(settings_.road_distance_density * points_.size());
+                for (size_t attempt = 0; listed_.size() < target && attempt < 4 * target; ++attempt) {
+                    const size_t from = RandomIndex(points_.size());
+                    const auto nearby = grid.FindNearby(points_[from], 1);
+                    if (const size_t to = nearby[RandomIndex(nearby.size())]; to != from) {
+                        AddDistance(from, to);
+                    }
+                }
+            }
+
+            Json::Node MakeBaseRequests() const {
+                std::vector<Json::Node> base_requests;
+                base_requests.reserve(points_.size() + lines_.size());
+                for (size_t stop = 0; stop < points_.size(); ++stop) {
+                    Map road_distances;
+                    for (const auto &[to, distance]: road_distances_[stop]) {
+                        road_distances.emplace(StopName(to), Json::Int(distance));
+                    }
+                    base_requests.emplace_back(Map{
+                            {"type", std::string("Stop")},
+                            {"name", StopName(stop)},
+                            {"latitude", points_[stop].latitude},
+                            {"longitude", points_[stop].longitude},
+                            {"road_distances", Json::Node{std::move(road_distances)}}
+                    });
+                }
+                for (size_t bus = 0; bus < lines_.size(); ++bus) {
+                    std::vector<Json::Node> stops;
+                    stops.reserve(lines_[bus].stops.size());
+                    for (const size_t stop: lines_[bus].stops) {
+                        stops.emplace_back(StopName(stop));
+                    }
+                    base_requests.emplace_back(Map{
+                            {"type", std::string("Bus")},
+                            {"name", BusName(bus)},
+                            {"stops", Json::Node{std::move(stops)}},
+                            {"is_roundtrip", Json::Bool(lines_[bus].is_roundtrip)}
+                    });
+                }
+                return Json::Node{std::move(base_requests)};
+            }
+
+            // those of test/example1.in.json
+            static Json::Node MakeRenderSettings() {
+                auto point = [](int64_t x, int64_t y) {
+                    return Json::Node{std::vector<Json::Node>{Json::Int(x), Json::Int(y)}};
+                };
+                return Json::Node{Map{
+                        {"width", Json::Int(1200)},
+                        {"height", Json::Int(500)},
+                        {"padding", Json::Int(50)},
+                        {"outer_margin", Json::Int(150)},
+                        {"stop_radius", Json::Int(5)},
+                        {"line_width", Json::Int(14)},
+                        {"bus_label_font_size", Json::Int(20)},
+                        {"bus_label_offset", point(7, 15)},
+                        {"stop_label_font_size", Json::Int(18)},
+                        {"stop_label_offset", point(7, -3)},
+                        {"underlayer_color", Json::Node{std::vector<Json::Node>{
+                                Json::Int(255), Json::Int(255), Json::Int(255), 0.85
+                        }}},
+                        {"underlayer_width", Json::Int(3)},
+                        {"color_palette", Json::Node{std::vector<Json::Node>{
+                                std::string("green"),
+                                Json::Node{std::vector<Json::Node>{Json::Int(255), Json::Int(160), Json::Int(0)}},
+                                std::string("red")
+                        }}},
+                        {"layers", Json::Node{std::vector<Json::Node>{
+                                std::string("bus_lines"), std::string("bus_labels"),
+                                std::string("stop_points"), std::string("stop_labels")
+                        }}}
+                }};
+            }
+
+            // routes are asked between stops some line serves, so most of them exist
+            Json::Node MakeStatRequests(const RequestMix &requests) {
+                std::vector<size_t> served;
+                for (const auto &line: lines_) {
+                    served.insert(served.end(), line.stops.begin(), line.stops.end());
+                }
+                std::sort(served.begin(), served.end());
+                served.erase(std::unique(served.begin(), served.end()), served.end());
+
+                std::vector<std::string> types;
+                types.insert(types.end(), requests.route, "Route");
+                types.insert(types.end(), requests.map, "Map");
+                types.insert(types.end(), requests.stop, "Stop");
+                types.insert(types.end(), requests.bus, "Bus");
+                std::shuffle(types.begin(), types.end(), random_);
+
+                std::vector<Json::Node> stat_requests;
+                stat_requests.reserve(types.size());
+                for (const auto &type: types) {
+                    Map request{
+                            {"type", type},
+                            {"id", Json::Int(static_cast<int64_t>(stat_requests.size() + 1))}
+                    };
+                    if (type == "Route") {
+                        request["from"] = StopName(served[RandomIndex(served.size())]);
+                        request["to"] = StopName(served[RandomIndex(served.size())]);
+                        request["map"] = requests.route_map;
+                    } else if (type == "Stop") {
+                        request["name"] = StopName(RandomIndex(points_.size()));
+                    } else if (type == "Bus") {
+                        request["name"] = BusName(RandomIndex(lines_.size()));
+                    }
+                    stat_requests.emplace_back(std::move(request));
+                }
+                return Json::Node{std::move(stat_requests)};
+            }
+
+            struct Line {
+                std::vector<size_t> stops;
+                bool is_roundtrip;
+            };
+
+            const Settings &settings_;
+            std::mt19937_64 random_;
+            std::vector<Coordinates::Point> points_;
+            std::vector<Line> lines_;
+            // listed by the stop they are given at
+            std::vector<std::vector<std::pair<size_t, int>>> road_distances_;
+            // stop pairs with a distance either way
+            std::unordered_set<uint64_t> listed_;
+        };
+
+        void Check(const Settings &settings, const RequestMix &requests) {
+            if (settings.stop_count < 2) {
+                throw std::invalid_argument("a city needs at least 2 stops");
+            }
+            if (settings.min_line_stops < 2 || settings.min_line_stops > settings.max_line_stops) {
+                throw std::invalid_argument("line lengths must be 2 or more, the minimum first");
+            }
+            if (settings.roundtrip_ratio < 0 || settings.roundtrip_ratio > 1) {
+                throw std::invalid_argument("roundtrip_ratio must be from 0 to 1");
+            }
+            if (settings.line_count == 0 && (requests.route > 0 || requests.bus > 0)) {
+                throw std::invalid_argument("Route and Bus requests need lines");
+            }
+        }
+
+        size_t ReadCount(const Map &map, const std::string &key, size_t value) {
+            if (auto it = map.find(key); it != map.end()) {
+                return static_cast<size_t>(it->second.AsDouble());
+            }
+            return value;
+        }
+
+        double ReadReal(const Map &map, const std::string &key, double value) {
+            if (auto it = map.find(key); it != map.end()) {
+                return it->second.AsDouble();
+            }
+            return value;
+        }
+
+    }
+
+    Settings ReadSettings(const Json::Node &node, Settings defaults) {
+        const auto &map = node.AsMap();
+        return Settings{
+                .stop_count = ReadCount(map, "stop_count", defaults.stop_count),
+                .line_count = ReadCount(map, "line_count", defaults.line_count),
+                .min_line_stops = ReadCount(map, "min_line_stops", defaults.min_line_stops),
+                .max_line_stops = ReadCount(map, "max_line_stops", defaults.max_line_stops),
+                .roundtrip_ratio = ReadReal(map, "roundtrip_ratio", defaults.roundtrip_ratio),
+                .road_distance_density = ReadReal(map, "road_distance_density", defaults.road_distance_density),
+                .seed = ReadCount(map, "seed", defaults.seed)
+        };
+    }
+
+    RequestMix ReadRequestMix(const Json::Node &node) {
+        const auto &map = node.AsMap();
+        const RequestMix defaults;
+        return RequestMix{
+                .route = ReadCount(map, "Route", defaults.route),
+                .map = ReadCount(map, "Map", defaults.map),
+                .stop = ReadCount(map, "Stop", defaults.stop),
+                .bus = ReadCount(map, "Bus", defaults.bus),
+                .route_map = map.count("route_map") ? map.at("route_map").AsString() : defaults.route_map
+        };
+    }
+
+    Json::Node Generate(const Settings &settings, const RequestMix &requests) {
+        Check(settings, requests);
+        return Generator(settings).Generate(requests);
+    }
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "json.h"
+
+#include <cstdint>
+#include <string>
+
+// Synthetic networks to benchmark on: stops scattered over a city-sized square and bus lines
+// walking between nearby stops, with a mix of stat requests over them. The same settings give
+// the same city.
+namespace CityGenerator {
+
+    struct Settings {
+        size_t stop_count = 1000;
+        size_t line_count = 100;
+        // stops a line passes before it turns back or closes its loop, drawn uniformly;
+        // lines stuck among visited stops end earlier
+        size_t min_line_stops = 5;
+        size_t max_line_stops = 25;
+        // share of the lines that are roundtrips
+        double roundtrip_ratio = 0.3;
+        // road distances listed per stop on average: those the lines need, then more to nearby stops
+        double road_distance_density = 3;
+        uint64_t seed = 1;
+    };
+
+    // stat requests of each type, shuffled together
+    struct RequestMix {
+        size_t route = 100;
+        size_t map = 1;
+        size_t stop = 100;
+        size_t bus = 100;
+        // the "map" of the Route requests; full maps of large cities take a lot of memory
+        std::string route_map = "overlay";
+    };
+
+    // the keys of the fields, those missing keep `defaults`
+    Settings ReadSettings(const Json::Node &node, Settings defaults = {});
+
+    // "Route", "Map", "Stop" and "Bus" counts and "route_map", those missing keep the defaults
+    RequestMix ReadRequestMix(const Json::Node &node);
+
+    // An input of main: "base_requests", "routing_settings", "render_settings" and
+    // "stat_requests". Numbers that are integers are Json::Int, so it is meant to be printed
+    // and parsed back. Throws std::invalid_argument on settings that make no city.
+    Json::Node Generate(const Settings &settings, const RequestMix &requests);
+
+}
@@ -1,13 +1,46 @@
+#include "metrics.h"
 #include "request.h"
+#include "server.h"
+#include "trace.h"
+
+#include <cstdlib>
+#include <fstream>
 
 int main() {
-    const auto input = Json::Load(std::cin);
+    // read from the environment, so that reading the input is traced too
+    const char *trace_file = std::getenv("TRANSPORT_TRACE_FILE");
+    if (trace_file) {
+        Trace::Enable();
+    }
+    const auto input = [] {
+        Trace::Span span("Json::Load");
+        return Json::Load(std::cin);
+    }();
     const auto &input_map = input.GetRoot().AsMap();
-    const TransportGuide tg(
-            Descriptions::ReadJson(input_map.at("base_requests")),
-            Transport::ReadFrom(input_map.at("routing_settings")),
-            Render::ReadJson(input_map.at("render_settings")));
-    auto responses = Requests::ProcessAll(tg, input_map.at("stat_requests"));
-    Json::Print(std::cout, responses);
+    auto host = ReadGuideHost(input.GetRoot());
+    if (auto it = input_map.find("server"); it != input_map.end()) {
+        Server::Run(*host, Server::ReadSettings(it->second), std::cerr);
+    } else {
+        bool tag_versions = false;
+        if (auto it = input_map.find("tag_versions"); it != input_map.end()) {
+            tag_versions = it->second.AsBool();
+        }
+        auto responses = Requests::ProcessAll(*host, input_map.at("stat_requests"), {.tag_versions = tag_versions});
+        {
+            Trace::Span span("Json::Print");
+            Metrics::PhaseTimer timer(Metrics::Phase::JsonEncoding);
+            Json::Print(std::cout, responses);
+        }
+        if (auto it = input_map.find("metrics_file"); it != input_map.end()) {
+            std::ofstream out(it->second.AsString());
+            Json::Print(out, Metrics::ToJson());
+            if (!out) {
+                throw std::runtime_error("Cannot write metrics to " + it->second.AsString());
+            }
+        }
+    }
+    if (trace_file) {
+        Trace::WriteFile(trace_file);
+    }
     return 0;
 }
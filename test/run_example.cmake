@@ -0,0 +1,22 @@
+# Runs main on INPUT in WORKING_DIRECTORY, emptied first so files of a previous run are not read,
+# and compares its output with EXPECTED. Latencies are not reproducible, so every "..._ns" value is
+# compared as 0.
+
+file(REMOVE_RECURSE ${WORKING_DIRECTORY})
+file(MAKE_DIRECTORY ${WORKING_DIRECTORY})
+
+execute_process(COMMAND ${MAIN}
+        INPUT_FILE ${INPUT}
+        OUTPUT_VARIABLE output
+        RESULT_VARIABLE result
+        WORKING_DIRECTORY ${WORKING_DIRECTORY})
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "main exited with ${result}")
+endif ()
+
+string(REGEX REPLACE "(_ns\": )[0-9]+" "\\10" output "${output}")
+file(READ ${EXPECTED} expected)
+if (NOT output STREQUAL expected)
+    file(WRITE ${WORKING_DIRECTORY}/actual.json "${output}")
+    message(FATAL_ERROR "output differs from ${EXPECTED}, see ${WORKING_DIRECTORY}/actual.json")
+endif ()
@@ -0,0 +1,145 @@
+#include "guide_host.h"
+#include "server.h"
+#include "test_runner.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+    using Map = std::map<std::string, Json::Node>;
+
+    const std::string kSocketPath = "server_test.sock";
+    const std::vector<std::string> kNetworks = {"a", "b"};
+
+    std::string example_path;
+
+    // the example as two networks sharing its settings
+    Json::Node MakeInput() {
+        std::ifstream in(example_path);
+        auto input = Json::Load(in).GetRoot().AsMap();
+        Map networks;
+        for (const auto &name: kNetworks) {
+            networks.emplace(name, Map{{"base_requests", input.at("base_requests")}});
+        }
+        input.erase("base_requests");
+        input.erase("stat_requests");
+        input.emplace("networks", std::move(networks));
+        return input;
+    }
+
+    std::string Ask(const std::string &request) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, kSocketPath.c_str(), kSocketPath.size() + 1);
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+            close(fd);
+            throw std::runtime_error("cannot connect to the server");
+        }
+        send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+        shutdown(fd, SHUT_WR);
+        std::string answer;
+        char buffer[1 << 16];
+        for (ssize_t count; (count = read(fd, buffer, sizeof(buffer))) > 0;) {
+            answer.append(buffer, count);
+        }
+        close(fd);
+        return answer;
+    }
+
+    // a server forked from the test, stopped however the test ends
+    class ServerProcess {
+    public:
+        explicit ServerProcess(GuideHost &host) : pid_(fork()) {
+            if (pid_ == 0) {
+                std::ostringstream log;
+                Server::Run(host, {.socket_path = kSocketPath, .worker_count = 2}, log);
+                _exit(0);
+            }
+        }
+
+        ServerProcess(const ServerProcess &) = delete;
+
+        ServerProcess &operator=(const ServerProcess &) = delete;
+
+        // the wait status of the server
+        int Stop() {
+            int status = 0;
+            kill(pid_, SIGTERM);
+            waitpid(pid_, &status, 0);
+            pid_ = -1;
+            return status;
+        }
+
+        ~ServerProcess() {
+            if (pid_ > 0) {
+                Stop();
+            }
+        }
+
+    private:
+        pid_t pid_;
+    };
+
+    void TestWorkersDoNotLoad() {
+        auto host = ReadGuideHost(MakeInput());
+        ServerProcess server(*host);
+        for (int attempt = 0; attempt < 100 && access(kSocketPath.c_str(), F_OK) != 0; ++attempt) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        // Metrics requests are answered after the rest of their batch, so the loads are counted
+        // alone as well; all of them by the server, before it forked the worker
+        std::ostringstream request;
+        request << "[";
+        for (const auto &name: kNetworks) {
+            request << R"({"id": 1, "type": "Stop", "name": "Морской вокзал", "network": ")" << name << R"("}, )";
+        }
+        request << R"({"id": 2, "type": "Metrics"}])";
+        auto network_loads = [](const Json::Node &response) {
+            return response.AsMap().at("metrics").AsMap().at("counters").AsMap().at("network_loads").AsDouble();
+        };
+        // enough connections to reach both workers
+        for (int i = 0; i < 8; ++i) {
+            std::istringstream metrics_answer(Ask(R"([{"id": 3, "type": "Metrics"}])"));
+            ASSERT_EQUAL(network_loads(Json::Load(metrics_answer).GetRoot().AsArray().front()),
+                         static_cast<double>(kNetworks.size()));
+
+            std::istringstream answer(Ask(request.str()));
+            const auto responses = Json::Load(answer).GetRoot().AsArray();
+            ASSERT_EQUAL(responses.size(), kNetworks.size() + 1);
+            for (size_t network = 0; network < kNetworks.size(); ++network) {
+                ASSERT(!responses[network].AsMap().count("error_message"));
+            }
+            ASSERT_EQUAL(network_loads(responses.back()), static_cast<double>(kNetworks.size()));
+        }
+
+        const int status = server.Stop();
+        ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        std::cerr << "Usage: server_test <example input>" << std::endl;
+        return 1;
+    }
+    example_path = argv[1];
+    TestRunner tr;
+    RUN_TEST(tr, TestWorkersDoNotLoad);
+    return 0;
+}
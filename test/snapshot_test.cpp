@@ -0,0 +1,176 @@
+#include "guide_host.h"
+#include "request.h"
+#include "snapshot.h"
+#include "test_runner.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    const std::string kPath = "snapshot_test.routes";
+    const std::string kDirectoryPath = "snapshot_test.directory";
+    constexpr uint64_t kGraphHash = 0x0123456789abcdefull;
+    constexpr uint64_t kVertexCount = 3;
+
+    std::string example_path;
+
+    // offsets in the header written by Snapshot::WriteTable
+    constexpr size_t kFormatVersionOffset = 8;
+    constexpr size_t kTableOffset = 4096;
+
+    std::vector<uint64_t> MakeEntries() {
+        std::vector<uint64_t> entries(kVertexCount * kVertexCount);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            entries[i] = i * i + 1;
+        }
+        return entries;
+    }
+
+    void WriteEntries() {
+        const auto entries = MakeEntries();
+        Snapshot::WriteTable(kPath, kGraphHash, kVertexCount, sizeof(uint64_t), entries.data());
+    }
+
+    std::string ReadFile() {
+        std::ifstream in(kPath, std::ios::binary);
+        return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    }
+
+    void WriteFile(const std::string &bytes) {
+        std::ofstream out(kPath, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    bool Loads(uint64_t graph_hash = kGraphHash, size_t entry_size = sizeof(uint64_t)) {
+        return Snapshot::LoadTable(kPath, graph_hash, kVertexCount, entry_size).has_value();
+    }
+
+    void TestRoundTrip() {
+        WriteEntries();
+        const auto table = Snapshot::LoadTable(kPath, kGraphHash, kVertexCount, sizeof(uint64_t));
+        ASSERT(table.has_value());
+        const auto *entries = static_cast<const uint64_t *>(table->entries);
+        ASSERT_EQUAL(std::vector<uint64_t>(entries, entries + kVertexCount * kVertexCount), MakeEntries());
+    }
+
+    void TestMissingFile() {
+        std::remove(kPath.c_str());
+        ASSERT(!Loads());
+    }
+
+    void TestBadMagic() {
+        WriteEntries();
+        auto bytes = ReadFile();
+        bytes[0] = 'X';
+        WriteFile(bytes);
+        ASSERT(!Loads());
+    }
+
+    void TestBadFormatVersion() {
+        WriteEntries();
+        auto bytes = ReadFile();
+        ++bytes[kFormatVersionOffset];
+        WriteFile(bytes);
+        ASSERT(!Loads());
+    }
+
+    void TestOtherGraph() {
+        WriteEntries();
+        ASSERT(!Loads(kGraphHash + 1));
+    }
+
+    void TestOtherEntrySize() {
+        WriteEntries();
+        ASSERT(!Loads(kGraphHash, sizeof(uint32_t)));
+    }
+
+    void TestTruncated() {
+        WriteEntries();
+        auto bytes = ReadFile();
+        bytes.pop_back();
+        WriteFile(bytes);
+        ASSERT(!Loads());
+    }
+
+    void TestCorruptedEntry() {
+        WriteEntries();
+        auto bytes = ReadFile();
+        bytes[kTableOffset + 10] ^= 1;
+        WriteFile(bytes);
+        ASSERT(!Loads());
+    }
+
+    void TestWriteFailure() {
+        const auto entries = MakeEntries();
+        bool thrown = false;
+        try {
+            Snapshot::WriteTable("no_such_directory/" + kPath, kGraphHash, kVertexCount, sizeof(uint64_t),
+                                 entries.data());
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+    }
+
+    // the answers to the example, its route table read from and written to `snapshot_file` if set
+    std::string AnswerExample(const std::string &snapshot_file) {
+        std::ifstream in(example_path);
+        auto input = Json::Load(in).GetRoot().AsMap();
+        if (!snapshot_file.empty()) {
+            auto routing_settings = input.at("routing_settings").AsMap();
+            routing_settings["snapshot_file"] = snapshot_file;
+            input["routing_settings"] = std::move(routing_settings);
+        }
+        auto host = ReadGuideHost(input);
+        std::ostringstream out;
+        Json::Print(out, Requests::ProcessAll(*host, input.at("stat_requests")));
+        return out.str();
+    }
+
+    void TestUnreadableFile() {
+        mkdir(kDirectoryPath.c_str(), 0755);
+        bool thrown = false;
+        try {
+            Snapshot::LoadTable(kDirectoryPath, kGraphHash, kVertexCount, sizeof(uint64_t));
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+        // the guide computes the table instead
+        ASSERT_EQUAL(AnswerExample(kDirectoryPath), AnswerExample({}));
+        rmdir(kDirectoryPath.c_str());
+    }
+
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        std::cerr << "Usage: snapshot_test <example input>" << std::endl;
+        return 1;
+    }
+    example_path = argv[1];
+    TestRunner tr;
+    RUN_TEST(tr, TestRoundTrip);
+    RUN_TEST(tr, TestMissingFile);
+    RUN_TEST(tr, TestBadMagic);
+    RUN_TEST(tr, TestBadFormatVersion);
+    RUN_TEST(tr, TestOtherGraph);
+    RUN_TEST(tr, TestOtherEntrySize);
+    RUN_TEST(tr, TestTruncated);
+    RUN_TEST(tr, TestCorruptedEntry);
+    RUN_TEST(tr, TestWriteFailure);
+    RUN_TEST(tr, TestUnreadableFile);
+    std::remove(kPath.c_str());
+    return 0;
+}
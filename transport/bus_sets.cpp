@@ -0,0 +1,24 @@
+#include "bus_sets.h"
+
+namespace Transport {
+
+    StopBusSets::StopBusSets(size_t stop_count, size_t bus_count)
+            : words_per_stop_((bus_count + kWordBits - 1) / kWordBits),
+              words_(stop_count * words_per_stop_) {}
+
+    void StopBusSets::Add(size_t stop_id, size_t bus_id) {
+        words_[stop_id * words_per_stop_ + bus_id / kWordBits] |= uint64_t(1) << (bus_id % kWordBits);
+    }
+
+    std::vector<size_t> StopBusSets::FindCommon(size_t lhs_stop_id, size_t rhs_stop_id) const {
+        const uint64_t *lhs = GetRow(lhs_stop_id), *rhs = GetRow(rhs_stop_id);
+        std::vector<size_t> bus_ids;
+        for (size_t word = 0; word < words_per_stop_; ++word) {
+            for (uint64_t common = lhs[word] & rhs[word]; common != 0; common &= common - 1) {
+                bus_ids.push_back(word * kWordBits + __builtin_ctzll(common));
+            }
+        }
+        return bus_ids;
+    }
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Transport {
+
+    // Buses through each stop as a bitset over bus ids, all rows in one flat array:
+    // buses common to two stops are a word-wise AND of two rows.
+    class StopBusSets {
+    public:
+        StopBusSets() = default;
+
+        StopBusSets(size_t stop_count, size_t bus_count);
+
+        void Add(size_t stop_id, size_t bus_id);
+
+        // ids of the buses through both stops, ascending
+        std::vector<size_t> FindCommon(size_t lhs_stop_id, size_t rhs_stop_id) const;
+
+    private:
+        static constexpr size_t kWordBits = 64;
+
+        size_t words_per_stop_ = 0;
+        std::vector<uint64_t> words_;
+
+        const uint64_t *GetRow(size_t stop_id) const {
+            return words_.data() + stop_id * words_per_stop_;
+        }
+    };
+
+}
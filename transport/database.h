@@ -1,7 +1,6 @@
 #pragma once
 
 #include "descriptions.h"
-#include "svg.h"
 
 #include <memory>
 
@@ -11,7 +10,6 @@ namespace Data {
         Descriptions::DictBus bus_descriptions;
         Descriptions::DictStop stop_descriptions;
         Descriptions::AdjacentStops adjacent_stops;
-        std::unordered_map<std::string, Svg::Color> bus_colors;
     };
 
     using DataPtr = std::shared_ptr<Database>;
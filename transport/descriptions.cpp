@@ -1,4 +1,8 @@
 #include "descriptions.h"
+#include "trace.h"
+
+#include <stdexcept>
+#include <variant>
 
 namespace Descriptions {
 
@@ -48,6 +52,7 @@ namespace Descriptions {
     }
 
     Data ReadJson(const Json::Node &base_node) {
+        Trace::Span span("Descriptions::ReadJson");
         Data result;
         for (const auto &node: base_node.AsArray()) {
             const auto &map = node.AsMap();
@@ -62,4 +67,47 @@ namespace Descriptions {
         return result;
     }
 
+    namespace {
+
+        Change ReadChange(const Json::Node &node) {
+            const auto &map = node.AsMap();
+            if (const auto &type = map.at("type").AsString(); type == "Stop") {
+                return Stop::ParseFrom(node);
+            } else if (type == "Bus") {
+                if (map.at("stops").AsArray().empty()) {
+                    throw std::invalid_argument("bus " + map.at("name").AsString() + " has no stops");
+                }
+                return Bus::ParseFrom(node);
+            } else if (type == "RemoveStop") {
+                return RemoveStop{map.at("name").AsString()};
+            } else if (type == "RemoveBus") {
+                return RemoveBus{map.at("name").AsString()};
+            } else if (type == "Distance") {
+                return Distance{
+                        .from = map.at("from").AsString(),
+                        .to = map.at("to").AsString(),
+                        .distance = static_cast<int>(map.at("distance").AsDouble())
+                };
+            } else {
+                throw std::invalid_argument("unknown change type " + type);
+            }
+        }
+
+    }
+
+    Changes ReadChanges(const Json::Node &base_node) {
+        // malformed changes are rejected as invalid_argument, like the ones that do not fit the network
+        Changes result;
+        try {
+            for (const auto &node: base_node.AsArray()) {
+                result.push_back(ReadChange(node));
+            }
+        } catch (const std::out_of_range &) {
+            throw std::invalid_argument("change misses a field");
+        } catch (const std::bad_variant_access &) {
+            throw std::invalid_argument("change has a field of the wrong type");
+        }
+        return result;
+    }
+
 }
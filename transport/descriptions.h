@@ -53,4 +53,25 @@ namespace Descriptions {
 
     Data ReadJson(const Json::Node &);
 
+    // changes to a loaded network; Stop and Bus add a new one or replace the one of that name
+    struct RemoveStop {
+        std::string name;
+    };
+
+    struct RemoveBus {
+        std::string name;
+    };
+
+    // sets the road distance from one stop to another, as in its "road_distances"
+    struct Distance {
+        std::string from;
+        std::string to;
+        int distance;
+    };
+
+    using Change = std::variant<Stop, Bus, RemoveStop, RemoveBus, Distance>;
+    using Changes = std::vector<Change>;
+
+    Changes ReadChanges(const Json::Node &);
+
 }
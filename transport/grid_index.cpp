@@ -0,0 +1,127 @@
+#include "grid_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace Render {
+
+    Box Box::Around(Svg::Point lhs, Svg::Point rhs) {
+        return {
+                std::min(lhs.x, rhs.x), std::min(lhs.y, rhs.y),
+                std::max(lhs.x, rhs.x), std::max(lhs.y, rhs.y)
+        };
+    }
+
+    std::optional<std::pair<Svg::Point, Svg::Point>> ClipSegment(Svg::Point from, Svg::Point to, const Box &box) {
+        const double dx = to.x - from.x;
+        const double dy = to.y - from.y;
+        double t_enter = 0., t_leave = 1.;
+        const double p[] = {-dx, dx, -dy, dy};
+        const double q[] = {from.x - box.min_x, box.max_x - from.x, from.y - box.min_y, box.max_y - from.y};
+        for (int i = 0; i < 4; ++i) {
+            if (p[i] == 0) {
+                if (q[i] < 0) {
+                    return std::nullopt;
+                }
+                continue;
+            }
+            const double t = q[i] / p[i];
+            if (p[i] < 0) {
+                t_enter = std::max(t_enter, t);
+            } else {
+                t_leave = std::min(t_leave, t);
+            }
+            if (t_enter > t_leave) {
+                return std::nullopt;
+            }
+        }
+        auto at = [&](double t) {
+            return t == 0. ? from : t == 1. ? to : Svg::Point{from.x + dx * t, from.y + dy * t};
+        };
+        return std::make_pair(at(t_enter), at(t_leave));
+    }
+
+    GridIndex::GridIndex(const Box &bounds, size_t expected_items) : bounds_(bounds) {
+        const auto side = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(expected_items))));
+        columns_ = rows_ = std::clamp<size_t>(side, 1, 1024);
+        cell_width_ = std::max((bounds_.max_x - bounds_.min_x) / columns_, 1e-9);
+        cell_height_ = std::max((bounds_.max_y - bounds_.min_y) / rows_, 1e-9);
+        cells_.assign(columns_ * rows_, {});
+    }
+
+    std::pair<size_t, size_t> GridIndex::CellOf(double x, double y) const {
+        auto clamp_cell = [](double offset, double cell_size, size_t count) {
+            const double cell = std::floor(offset / cell_size);
+            return static_cast<size_t>(std::clamp(cell, 0., static_cast<double>(count - 1)));
+        };
+        return {clamp_cell(x - bounds_.min_x, cell_width_, columns_),
+                clamp_cell(y - bounds_.min_y, cell_height_, rows_)};
+    }
+
+    void GridIndex::Insert(size_t item, const Box &box) {
+        const auto [min_column, min_row] = CellOf(box.min_x, box.min_y);
+        const auto [max_column, max_row] = CellOf(box.max_x, box.max_y);
+        for (size_t row = min_row; row <= max_row; ++row) {
+            for (size_t column = min_column; column <= max_column; ++column) {
+                cells_[row * columns_ + column].push_back(item);
+            }
+        }
+    }
+
+    void GridIndex::InsertSegment(size_t item, Svg::Point from, Svg::Point to) {
+        // row by row, the columns the part of the segment within the row spans; the rows overlap a
+        // little, so points that CellOf rounds to either side of a cell edge are covered
+        const double infinity = std::numeric_limits<double>::infinity();
+        const double margin_x = cell_width_ * 1e-6;
+        const double margin_y = cell_height_ * 1e-6;
+        const size_t min_row = CellOf(from.x, std::min(from.y, to.y) - margin_y).second;
+        const size_t max_row = CellOf(from.x, std::max(from.y, to.y) + margin_y).second;
+        for (size_t row = min_row; row <= max_row; ++row) {
+            // the outer rows reach past the bounds, as CellOf clamps to them
+            const Box band{
+                    -infinity,
+                    row == 0 ? -infinity : bounds_.min_y + row * cell_height_ - margin_y,
+                    infinity,
+                    row + 1 == rows_ ? infinity : bounds_.min_y + (row + 1) * cell_height_ + margin_y
+            };
+            const auto part = ClipSegment(from, to, band);
+            if (!part) {
+                continue;
+            }
+            const size_t min_column = CellOf(std::min(part->first.x, part->second.x) - margin_x, from.y).first;
+            const size_t max_column = CellOf(std::max(part->first.x, part->second.x) + margin_x, from.y).first;
+            for (size_t column = min_column; column <= max_column; ++column) {
+                cells_[row * columns_ + column].push_back(item);
+            }
+        }
+    }
+
+    std::vector<size_t> GridIndex::Query(const Box &box) const {
+        std::vector<size_t> result;
+        if (box.max_x < bounds_.min_x || box.min_x > bounds_.max_x
+            || box.max_y < bounds_.min_y || box.min_y > bounds_.max_y) {
+            return result;
+        }
+        const auto [min_column, min_row] = CellOf(box.min_x, box.min_y);
+        const auto [max_column, max_row] = CellOf(box.max_x, box.max_y);
+        for (size_t row = min_row; row <= max_row; ++row) {
+            for (size_t column = min_column; column <= max_column; ++column) {
+                const auto &cell = cells_[row * columns_ + column];
+                result.insert(result.end(), cell.begin(), cell.end());
+            }
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+
+    size_t GridIndex::EstimateMemory() const {
+        size_t memory = cells_.capacity() * sizeof(cells_[0]);
+        for (const auto &cell: cells_) {
+            memory += cell.capacity() * sizeof(size_t);
+        }
+        return memory;
+    }
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "svg.h"
+
+#include <vector>
+
+namespace Render {
+
+    struct Box {
+        double min_x;
+        double min_y;
+        double max_x;
+        double max_y;
+
+        static Box Around(Svg::Point point) {
+            return {point.x, point.y, point.x, point.y};
+        }
+
+        static Box Around(Svg::Point lhs, Svg::Point rhs);
+
+        Box Expanded(double margin) const {
+            return {min_x - margin, min_y - margin, max_x + margin, max_y + margin};
+        }
+
+        bool Contains(Svg::Point point) const {
+            return min_x <= point.x && point.x <= max_x && min_y <= point.y && point.y <= max_y;
+        }
+    };
+
+    // Liang–Barsky: the part of segment [from, to] inside the box, if any
+    std::optional<std::pair<Svg::Point, Svg::Point>> ClipSegment(Svg::Point from, Svg::Point to, const Box &box);
+
+    // Uniform grid over the plane; items are registered by box or as segments, found by box queries.
+    class GridIndex {
+    public:
+        GridIndex() = default;
+
+        // `bounds` should cover all items, `expected_items` picks the cell size
+        GridIndex(const Box &bounds, size_t expected_items);
+
+        void Insert(size_t item, const Box &box);
+
+        // registers the item in the cells the segment [from, to] crosses only
+        void InsertSegment(size_t item, Svg::Point from, Svg::Point to);
+
+        // ids of items whose cells intersect the box, sorted and unique; may include items
+        // that merely share a cell with the box, callers refine the result
+        std::vector<size_t> Query(const Box &box) const;
+
+        // approximate bytes of the cells and the ids in them
+        size_t EstimateMemory() const;
+
+    private:
+        std::pair<size_t, size_t> CellOf(double x, double y) const;
+
+    private:
+        Box bounds_{0, 0, 0, 0};
+        size_t columns_ = 1;
+        size_t rows_ = 1;
+        double cell_width_ = 1;
+        double cell_height_ = 1;
+        std::vector<std::vector<size_t>> cells_ = std::vector<std::vector<size_t>>(1);
+    };
+
+}
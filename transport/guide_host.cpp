@@ -0,0 +1,197 @@
+#include "guide_host.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+    // the "base_requests" array, alone or in an input object
+    Descriptions::Data ReadDescriptionsFile(const std::string &path) {
+        std::ifstream in(path);
+        if (!in) {
+            throw std::runtime_error("Cannot open descriptions file " + path);
+        }
+        const auto document = Json::Load(in);
+        const auto &root = document.GetRoot();
+        if (std::holds_alternative<std::vector<Json::Node>>(root)) {
+            return Descriptions::ReadJson(root);
+        }
+        return Descriptions::ReadJson(root.AsMap().at("base_requests"));
+    }
+
+}
+
+GuideHost::GuideHost(Settings settings) : settings_(std::move(settings)) {}
+
+void GuideHost::AddNetwork(const std::string &name, Network network) {
+    if (!settings_.spill_directory.empty() && network.routing_settings.mode == Transport::RoutingMode::AllPairs
+        && network.routing_settings.snapshot_file.empty()) {
+        if (name.find('/') != std::string::npos) {
+            throw std::invalid_argument("Network name cannot name a spill file: \"" + name + "\"");
+        }
+        network.routing_settings.snapshot_file =
+                settings_.spill_directory + "/" + (name.empty() ? "default" : name) + ".routes";
+    }
+    std::lock_guard lock(mutex_);
+    if (!networks_.emplace(name, Entry{.network = std::move(network), .guide = nullptr}).second) {
+        throw std::invalid_argument("Duplicate network: \"" + name + "\"");
+    }
+}
+
+void GuideHost::LoadAll() {
+    std::vector<std::string> names;
+    {
+        std::lock_guard lock(mutex_);
+        for (const auto &[name, entry]: networks_) {
+            names.push_back(name);
+        }
+    }
+    for (const auto &name: names) {
+        Acquire(name);
+    }
+}
+
+GuideHost::GuidePtr GuideHost::Acquire(const std::string &name) {
+    std::lock_guard lock(mutex_);
+    auto it = networks_.find(name);
+    if (it == networks_.end()) {
+        return nullptr;
+    }
+    auto &entry = it->second;
+    entry.last_use = ++use_clock_;
+    if (!entry.guide) {
+        // room for the size the network had at its last load
+        EvictIdle(entry.memory, entry);
+        Load(entry);
+    }
+    // networks held over the budget are evicted once they are let go
+    EvictIdle(0, entry);
+    return entry.guide;
+}
+
+void GuideHost::Load(Entry &entry) {
+    Trace::Span span("GuideHost::Load");
+    const auto &network = entry.network;
+    auto guide = std::make_unique<TransportGuide>(
+            network.descriptions_file.empty() ? network.descriptions : ReadDescriptionsFile(network.descriptions_file),
+            network.routing_settings, network.render_settings, network.render_profiles);
+    entry.memory = guide->EstimateMemory();
+    entry.guide = std::make_shared<VersionedGuide>(std::move(guide), entry.loaded_version);
+    memory_used_ += entry.memory;
+    Metrics::Add(Metrics::Counter::NetworkLoads);
+}
+
+void GuideHost::Evict(Entry &entry) {
+    // the version is let go before the guide it was pinned from
+    if (const auto version = entry.guide->Pin(); version->id != entry.loaded_version) {
+        // the next load starts from the updated network
+        entry.network.descriptions = version->guide->GetDescriptions();
+        entry.network.descriptions_file.clear();
+        entry.loaded_version = version->id;
+    }
+    entry.guide.reset();
+    memory_used_ -= entry.memory;
+    Metrics::Add(Metrics::Counter::NetworkEvictions);
+}
+
+void GuideHost::EvictIdle(size_t reserve, const Entry &keep) {
+    while (memory_used_ + reserve > settings_.memory_budget) {
+        Entry *victim = nullptr;
+        for (auto &[name, entry]: networks_) {
+            // held only here: no request reads it, and none can acquire it without the lock
+            if (&entry != &keep && entry.guide && entry.guide.use_count() == 1
+                && (!victim || entry.last_use < victim->last_use)) {
+                victim = &entry;
+            }
+        }
+        if (!victim) {
+            return;
+        }
+        Evict(*victim);
+    }
+}
+
+std::unique_ptr<GuideHost> ReadGuideHost(const Json::Node &input) {
+    const auto &input_map = input.AsMap();
+    GuideHost::Settings settings;
+    if (auto it = input_map.find("memory_budget_mb"); it != input_map.end()) {
+        settings.memory_budget = static_cast<size_t>(it->second.AsDouble() * 1024 * 1024);
+    }
+    if (auto it = input_map.find("spill_directory"); it != input_map.end()) {
+        settings.spill_directory = it->second.AsString();
+    }
+    auto host = std::make_unique<GuideHost>(std::move(settings));
+
+    // the top-level settings are read once and shared by the networks that use them
+    Render::SettingsPtr render_settings;
+    Render::Profiles render_profiles;
+    const auto render_settings_it = input_map.find("render_settings");
+    const auto render_profiles_it = input_map.find("render_profiles");
+    if (render_settings_it != input_map.end()) {
+        render_settings = Render::ReadJson(render_settings_it->second);
+        if (render_profiles_it != input_map.end()) {
+            render_profiles = Render::ReadProfiles(render_settings_it->second, render_profiles_it->second);
+        }
+    }
+    std::optional<Transport::RoutingSettings> routing_settings;
+    if (auto it = input_map.find("routing_settings"); it != input_map.end()) {
+        routing_settings = Transport::ReadFrom(it->second);
+    }
+
+    const auto networks_it = input_map.find("networks");
+    if (networks_it == input_map.end()) {
+        if (!routing_settings || !render_settings) {
+            throw std::runtime_error("No routing or render settings");
+        }
+        host->AddNetwork("", GuideHost::Network{
+                .descriptions = Descriptions::ReadJson(input_map.at("base_requests")),
+                .descriptions_file = {},
+                .routing_settings = std::move(*routing_settings),
+                .render_settings = std::move(render_settings),
+                .render_profiles = std::move(render_profiles)
+        });
+        host->Acquire("");
+        return host;
+    }
+
+    for (const auto &[name, node]: networks_it->second.AsMap()) {
+        const auto &network_map = node.AsMap();
+        GuideHost::Network network;
+        if (auto it = network_map.find("base_requests_file"); it != network_map.end()) {
+            network.descriptions_file = it->second.AsString();
+        } else {
+            network.descriptions = Descriptions::ReadJson(network_map.at("base_requests"));
+        }
+        if (auto it = network_map.find("routing_settings"); it != network_map.end()) {
+            network.routing_settings = Transport::ReadFrom(it->second);
+        } else if (routing_settings) {
+            network.routing_settings = *routing_settings;
+        } else {
+            throw std::runtime_error("No routing settings for network \"" + name + "\"");
+        }
+        if (auto it = network_map.find("render_settings"); it != network_map.end()) {
+            network.render_settings = Render::ReadJson(it->second);
+            // the top-level profiles override the settings of the network
+            if (auto profiles_it = network_map.find("render_profiles"); profiles_it != network_map.end()) {
+                network.render_profiles = Render::ReadProfiles(it->second, profiles_it->second);
+            } else if (render_profiles_it != input_map.end()) {
+                network.render_profiles = Render::ReadProfiles(it->second, render_profiles_it->second);
+            }
+        } else if (render_settings) {
+            network.render_settings = render_settings;
+            if (auto profiles_it = network_map.find("render_profiles"); profiles_it != network_map.end()) {
+                network.render_profiles = Render::ReadProfiles(render_settings_it->second, profiles_it->second);
+            } else {
+                network.render_profiles = render_profiles;
+            }
+        } else {
+            throw std::runtime_error("No render settings for network \"" + name + "\"");
+        }
+        host->AddNetwork(name, std::move(network));
+    }
+    return host;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "versioned_guide.h"
+#include "json.h"
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Hosts named networks in one process. A network is built on its first request and charged its
+// estimated size against the memory budget; when a load goes over the budget, networks nobody
+// holds are evicted, least recently used first. An evicted network is built again from its
+// descriptions, updates included, and maps its route table back from its snapshot file, if it
+// has one, so reloading skips the precomputation.
+class GuideHost {
+public:
+    struct Network {
+        Descriptions::Data descriptions;
+        // if set, the descriptions are read from this file on every load instead
+        std::string descriptions_file;
+        Transport::RoutingSettings routing_settings;
+        // shared with the other networks reading the same settings
+        Render::SettingsPtr render_settings;
+        Render::Profiles render_profiles;
+    };
+
+    struct Settings {
+        size_t memory_budget = std::numeric_limits<size_t>::max();
+        // all-pairs networks without a snapshot file keep their route table here, named after them
+        // ("default" for the unnamed network)
+        std::string spill_directory;
+    };
+
+    using GuidePtr = std::shared_ptr<VersionedGuide>;
+
+    explicit GuideHost(Settings settings);
+
+    // throws std::invalid_argument if the name is taken, or cannot name a spill file
+    void AddNetwork(const std::string &name, Network network);
+
+    // The named network, loaded if it is not; nullptr if there is no such network. It is not
+    // evicted while the pointer is held. Loads are serialized; errors of a load are thrown.
+    GuidePtr Acquire(const std::string &name);
+
+    // Loads every network as Acquire does, e.g. before forking processes to share them. Over the
+    // memory budget, networks loaded earlier may be evicted again; with a spill directory, their
+    // route tables stay in it for the next load.
+    void LoadAll();
+
+private:
+    struct Entry {
+        Network network;
+        GuidePtr guide;
+        // estimated at the last load
+        size_t memory = 0;
+        // the version the guide was loaded at, the one to go on from at the next load
+        uint64_t loaded_version = 1;
+        uint64_t last_use = 0;
+    };
+
+    void Load(Entry &entry);
+
+    void Evict(Entry &entry);
+
+    // evicts idle networks other than `keep` until `reserve` more bytes fit in the budget
+    void EvictIdle(size_t reserve, const Entry &keep);
+
+    Settings settings_;
+    std::mutex mutex_;
+    std::map<std::string, Entry> networks_;
+    size_t memory_used_ = 0;
+    uint64_t use_clock_ = 0;
+};
+
+// The networks of the input: "networks" maps names to their "base_requests", or to the
+// "base_requests_file" holding them, with "routing_settings", "render_settings" and
+// "render_profiles" of their own where the top-level ones do not fit. "memory_budget_mb" and
+// "spill_directory" set up the host. An input without "networks" is hosted as a single network
+// named "", loaded at once.
+std::unique_ptr<GuideHost> ReadGuideHost(const Json::Node &input);
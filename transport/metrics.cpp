@@ -0,0 +1,242 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <string>
+
+namespace Metrics {
+
+    namespace {
+
+        constexpr std::array<std::string_view, static_cast<size_t>(Phase::Count)> kPhaseNames = {
+                "route_search", "item_assembly", "rendering", "json_encoding"
+        };
+
+        constexpr std::array<std::string_view, static_cast<size_t>(Counter::Count)> kCounterNames = {
+                "route_repeats", "route_searches", "lod_map_hits", "lod_map_builds", "snapshot_loads",
+                "snapshot_writes", "network_loads", "network_evictions", "allocations", "allocated_bytes"
+        };
+
+        struct Registry {
+            std::array<Histogram, static_cast<size_t>(Request::Count)> requests;
+            std::array<std::atomic<uint64_t>, static_cast<size_t>(Request::Count)> request_allocations{};
+            std::array<Histogram, static_cast<size_t>(Phase::Count)> phases;
+        };
+
+        Registry &GetRegistry() {
+            static Registry registry;
+            return registry;
+        }
+
+        // kept apart from the registry: operator new counts into them before any static is constructed
+        std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::Count)> counters{};
+        thread_local uint64_t thread_allocations = 0;
+
+        uint64_t ToNanoseconds(std::chrono::steady_clock::duration duration) {
+            return std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), 0);
+        }
+
+        Json::Node SummaryToJson(const Histogram::Summary &summary) {
+            std::map<std::string, Json::Node> summary_map;
+            summary_map["count"] = Json::Int(static_cast<int64_t>(summary.count));
+            summary_map["mean_ns"] = Json::Int(static_cast<int64_t>(summary.sum / summary.count));
+            summary_map["max_ns"] = Json::Int(static_cast<int64_t>(summary.max));
+            summary_map["p50_ns"] = Json::Int(static_cast<int64_t>(summary.p50));
+            summary_map["p99_ns"] = Json::Int(static_cast<int64_t>(summary.p99));
+            summary_map["p999_ns"] = Json::Int(static_cast<int64_t>(summary.p999));
+            return Json::Node{std::move(summary_map)};
+        }
+
+    }
+
+    size_t Histogram::GetBucket(uint64_t value) {
+        if (value < kSubBucketCount) {
+            return value;
+        }
+        const size_t exponent = 63 - __builtin_clzll(value);
+        const size_t sub_bucket = (value >> (exponent - kSubBucketBits)) - kSubBucketCount;
+        return (exponent - kSubBucketBits + 1) * kSubBucketCount + sub_bucket;
+    }
+
+    uint64_t Histogram::GetBucketMax(size_t bucket) {
+        if (bucket < kSubBucketCount) {
+            return bucket;
+        }
+        const size_t shift = bucket / kSubBucketCount - 1;
+        const uint64_t lowest = (kSubBucketCount + bucket % kSubBucketCount) << shift;
+        return lowest + ((uint64_t(1) << shift) - 1);
+    }
+
+    void Histogram::Record(uint64_t value) {
+        counts_[GetBucket(value)].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    Histogram::Summary Histogram::Summarize() const {
+        // counted from the buckets, so the quantiles agree with the count even under concurrent records
+        Summary summary{
+                .sum = sum_.load(std::memory_order_relaxed),
+                .max = max_.load(std::memory_order_relaxed)
+        };
+        std::array<uint64_t, kBucketCount> counts;
+        for (size_t bucket = 0; bucket < kBucketCount; ++bucket) {
+            counts[bucket] = counts_[bucket].load(std::memory_order_relaxed);
+            summary.count += counts[bucket];
+        }
+        const std::array<std::pair<double, uint64_t *>, 3> quantiles = {{
+                {0.5, &summary.p50}, {0.99, &summary.p99}, {0.999, &summary.p999}
+        }};
+        uint64_t seen = 0;
+        size_t quantile = 0;
+        for (size_t bucket = 0; bucket < kBucketCount && quantile < quantiles.size(); ++bucket) {
+            seen += counts[bucket];
+            while (quantile < quantiles.size()
+                   && seen > 0 && seen >= std::ceil(quantiles[quantile].first * summary.count)) {
+                *quantiles[quantile].second = std::min(GetBucketMax(bucket), summary.max);
+                ++quantile;
+            }
+        }
+        return summary;
+    }
+
+    Request FindRequest(std::string_view type) {
+        const auto it = std::find(kRequestNames.begin(), kRequestNames.end(), type);
+        return static_cast<Request>(it - kRequestNames.begin());
+    }
+
+    void RecordRequest(Request request, std::chrono::steady_clock::duration duration, uint64_t allocations) {
+        auto &registry = GetRegistry();
+        registry.requests.at(static_cast<size_t>(request)).Record(ToNanoseconds(duration));
+        registry.request_allocations.at(static_cast<size_t>(request)).fetch_add(allocations,
+                                                                                std::memory_order_relaxed);
+    }
+
+    void RecordPhase(Phase phase, std::chrono::steady_clock::duration duration) {
+        GetRegistry().phases.at(static_cast<size_t>(phase)).Record(ToNanoseconds(duration));
+    }
+
+    void Add(Counter counter, uint64_t value) {
+        counters[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    uint64_t GetThreadAllocations() {
+        return thread_allocations;
+    }
+
+    Json::Node ToJson() {
+        const auto &registry = GetRegistry();
+        std::map<std::string, Json::Node> requests;
+        for (size_t request = 0; request < registry.requests.size(); ++request) {
+            const auto summary = registry.requests[request].Summarize();
+            if (summary.count == 0) {
+                continue;
+            }
+            auto node = SummaryToJson(summary);
+            if (const uint64_t allocations = registry.request_allocations[request].load(std::memory_order_relaxed)) {
+                std::get<std::map<std::string, Json::Node>>(node)["mean_allocations"] = Json::Int(
+                        static_cast<int64_t>(allocations / summary.count));
+            }
+            requests.emplace(kRequestNames[request], std::move(node));
+        }
+        std::map<std::string, Json::Node> phases;
+        for (size_t phase = 0; phase < registry.phases.size(); ++phase) {
+            if (const auto summary = registry.phases[phase].Summarize(); summary.count > 0) {
+                phases.emplace(kPhaseNames[phase], SummaryToJson(summary));
+            }
+        }
+        std::map<std::string, Json::Node> counter_values;
+        for (size_t counter = 0; counter < counters.size(); ++counter) {
+            counter_values.emplace(kCounterNames[counter],
+                                   Json::Int(static_cast<int64_t>(counters[counter].load(std::memory_order_relaxed))));
+        }
+        return Json::Node{std::map<std::string, Json::Node>{
+                {"requests", Json::Node{std::move(requests)}},
+                {"phases", Json::Node{std::move(phases)}},
+                {"counters", Json::Node{std::move(counter_values)}}
+        }};
+    }
+
+}
+
+#ifdef TRANSPORT_COUNT_ALLOCATIONS
+
+// The global allocation functions, counting. Every unaligned form is replaced, since a runtime may
+// define them apart (as ASan does); aligned allocations are not counted.
+
+namespace {
+
+    void *Allocate(std::size_t size, bool nothrow) {
+        Metrics::Add(Metrics::Counter::Allocations);
+        Metrics::Add(Metrics::Counter::AllocatedBytes, size);
+        ++Metrics::thread_allocations;
+        for (;;) {
+            if (void *pointer = std::malloc(size ? size : 1)) {
+                return pointer;
+            }
+            if (const auto handler = std::get_new_handler()) {
+                handler();
+            } else if (nothrow) {
+                return nullptr;
+            } else {
+                throw std::bad_alloc();
+            }
+        }
+    }
+
+}
+
+void *operator new(std::size_t size) {
+    return Allocate(size, false);
+}
+
+void *operator new[](std::size_t size) {
+    return Allocate(size, false);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    try {
+        return Allocate(size, true);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    try {
+        return Allocate(size, true);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept {
+    std::free(pointer);
+}
+
+#endif
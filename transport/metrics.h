@@ -0,0 +1,137 @@
+#pragma once
+
+#include "json.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+// Latency histograms and counters of the running process, recorded with relaxed atomics from any
+// thread. Always on: a timed scope costs two clock reads and a few uncontended increments.
+namespace Metrics {
+
+    // HDR-style log-linear histogram: values below 2^kSubBucketBits are kept exactly, larger ones
+    // in buckets 1/2^kSubBucketBits of their power of two wide, so quantiles are within 1.6%
+    class Histogram {
+    public:
+        void Record(uint64_t value);
+
+        struct Summary {
+            uint64_t count = 0;
+            uint64_t sum = 0;
+            uint64_t max = 0;
+            // the highest value of the bucket each quantile falls in
+            uint64_t p50 = 0;
+            uint64_t p99 = 0;
+            uint64_t p999 = 0;
+        };
+
+        // counts recorded meanwhile may or may not be included
+        Summary Summarize() const;
+
+    private:
+        static constexpr size_t kSubBucketBits = 6;
+        static constexpr size_t kSubBucketCount = size_t(1) << kSubBucketBits;
+        static constexpr size_t kBucketCount = (64 - kSubBucketBits + 1) * kSubBucketCount;
+
+        static size_t GetBucket(uint64_t value);
+
+        static uint64_t GetBucketMax(size_t bucket);
+
+        std::array<std::atomic<uint64_t>, kBucketCount> counts_{};
+        std::atomic<uint64_t> sum_ = 0;
+        std::atomic<uint64_t> max_ = 0;
+    };
+
+    // stat request types, in the order of kRequestNames
+    enum class Request : size_t {
+        Stop,
+        Bus,
+        CommonBuses,
+        Route,
+        Isochrone,
+        Matrix,
+        Map,
+        NearbyStops,
+        Viewport,
+        Tile,
+        Update,
+        Metrics,
+        Count
+    };
+
+    constexpr std::array<std::string_view, static_cast<size_t>(Request::Count)> kRequestNames = {
+            "Stop", "Bus", "CommonBuses", "Route", "Isochrone", "Matrix", "Map", "NearbyStops", "Viewport", "Tile",
+            "Update", "Metrics"
+    };
+
+    // Request::Count for an unknown type
+    Request FindRequest(std::string_view type);
+
+    enum class Phase : size_t {
+        // route searches and table lookups, with the expansion of the edges
+        RouteSearch,
+        // route items made from the edges
+        ItemAssembly,
+        // maps of Map, Route, Viewport and Tile answers
+        Rendering,
+        // responses printed as JSON
+        JsonEncoding,
+        Count
+    };
+
+    enum class Counter : size_t {
+        // Route requests answered from an equal one of the batch
+        RouteRepeats,
+        // searches (or table rows) answering the Route requests of a batch, one per origin
+        RouteSearches,
+        // overview maps served as built, and built on request
+        LodMapHits,
+        LodMapBuilds,
+        // route tables mapped from a snapshot file, and computed with one written
+        SnapshotLoads,
+        SnapshotWrites,
+        // hosted networks built, and evicted over the memory budget
+        NetworkLoads,
+        NetworkEvictions,
+        // operator new calls and bytes; counted only when built with TRANSPORT_COUNT_ALLOCATIONS
+        Allocations,
+        AllocatedBytes,
+        Count
+    };
+
+    void RecordRequest(Request request, std::chrono::steady_clock::duration duration, uint64_t allocations = 0);
+
+    void RecordPhase(Phase phase, std::chrono::steady_clock::duration duration);
+
+    void Add(Counter counter, uint64_t value = 1);
+
+    // operator new calls made by this thread so far; 0 unless allocations are counted
+    uint64_t GetThreadAllocations();
+
+    // times the scope into the phase histogram
+    class PhaseTimer {
+    public:
+        explicit PhaseTimer(Phase phase) : phase_(phase), start_(std::chrono::steady_clock::now()) {}
+
+        PhaseTimer(const PhaseTimer &) = delete;
+
+        PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+        ~PhaseTimer() {
+            RecordPhase(phase_, std::chrono::steady_clock::now() - start_);
+        }
+
+    private:
+        Phase phase_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // {"requests": {type: summary}, "phases": {phase: summary}, "counters": {name: value}}, with
+    // summaries of "count", "mean_ns", "max_ns", "p50_ns", "p99_ns" and "p999_ns" of the
+    // histograms that have recorded anything
+    Json::Node ToJson();
+
+}
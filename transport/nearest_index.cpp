@@ -0,0 +1,136 @@
+#include "nearest_index.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace Coordinates {
+
+    NearestIndex::Vector NearestIndex::ToVector(Point point) {
+        const double lat = ToRadiance(point.latitude);
+        const double lon = ToRadiance(point.longitude);
+        return {cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat)};
+    }
+
+    double NearestIndex::ChordToDistance(double chord_squared) {
+        const double half_chord = std::min(sqrt(chord_squared) / 2, 1.);
+        return EARTH_DIAMETER * 2 * asin(half_chord);
+    }
+
+    NearestIndex::NearestIndex(const std::vector<Point> &points) {
+        nodes_.reserve(points.size());
+        for (size_t id = 0; id < points.size(); ++id) {
+            nodes_.push_back(Node{ToVector(points[id]), id, 0});
+        }
+        Build(0, nodes_.size());
+    }
+
+    void NearestIndex::Build(size_t begin, size_t end) {
+        if (end - begin <= 1) {
+            return;
+        }
+        // split across the widest extent
+        Vector low = nodes_[begin].position, high = low;
+        for (size_t i = begin; i < end; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                low[axis] = std::min(low[axis], nodes_[i].position[axis]);
+                high[axis] = std::max(high[axis], nodes_[i].position[axis]);
+            }
+        }
+        int axis = 0;
+        for (int candidate = 1; candidate < 3; ++candidate) {
+            if (high[candidate] - low[candidate] > high[axis] - low[axis]) {
+                axis = candidate;
+            }
+        }
+        const size_t middle = begin + (end - begin) / 2;
+        std::nth_element(nodes_.begin() + begin, nodes_.begin() + middle, nodes_.begin() + end,
+                         [axis](const Node &lhs, const Node &rhs) {
+                             return lhs.position[axis] < rhs.position[axis];
+                         });
+        nodes_[middle].axis = axis;
+        Build(begin, middle);
+        Build(middle + 1, end);
+    }
+
+    template<class Visitor>
+    void NearestIndex::Search(size_t begin, size_t end, const Vector &center, Visitor &visitor) const {
+        if (begin >= end) {
+            return;
+        }
+        const size_t middle = begin + (end - begin) / 2;
+        const Node &node = nodes_[middle];
+        double chord_squared = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            const double delta = node.position[axis] - center[axis];
+            chord_squared += delta * delta;
+        }
+        visitor.Visit(node.id, chord_squared);
+        if (end - begin == 1) {
+            return;
+        }
+        const double split_delta = center[node.axis] - node.position[node.axis];
+        const bool left_first = split_delta < 0;
+        if (left_first) {
+            Search(begin, middle, center, visitor);
+        } else {
+            Search(middle + 1, end, center, visitor);
+        }
+        if (split_delta * split_delta <= visitor.Bound()) {
+            if (left_first) {
+                Search(middle + 1, end, center, visitor);
+            } else {
+                Search(begin, middle, center, visitor);
+            }
+        }
+    }
+
+    std::vector<Neighbour> NearestIndex::Find(Point center, std::optional<size_t> count,
+                                              std::optional<double> radius) const {
+        std::vector<Neighbour> result;
+        if (count && *count == 0) {
+            return result;
+        }
+
+        double bound = std::numeric_limits<double>::infinity();
+        if (radius) {
+            const double half_angle = std::min(*radius / EARTH_DIAMETER, M_PI) / 2;
+            bound = 4 * sin(half_angle) * sin(half_angle);
+        }
+
+        // keeps the best candidates in a max-heap by chord length
+        struct Collector {
+            std::optional<size_t> count;
+            double radius_bound;
+            std::vector<std::pair<double, size_t>> heap;
+
+            void Visit(size_t id, double chord_squared) {
+                if (chord_squared > Bound()) {
+                    return;
+                }
+                heap.emplace_back(chord_squared, id);
+                std::push_heap(heap.begin(), heap.end());
+                if (count && heap.size() > *count) {
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.pop_back();
+                }
+            }
+
+            double Bound() const {
+                if (count && heap.size() == *count) {
+                    return std::min(radius_bound, heap.front().first);
+                }
+                return radius_bound;
+            }
+        } collector{count, bound, {}};
+
+        Search(0, nodes_.size(), ToVector(center), collector);
+
+        std::sort_heap(collector.heap.begin(), collector.heap.end());
+        result.reserve(collector.heap.size());
+        for (const auto &[chord_squared, id]: collector.heap) {
+            result.push_back(Neighbour{id, ChordToDistance(chord_squared)});
+        }
+        return result;
+    }
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "coordinates.h"
+
+#include <array>
+#include <optional>
+#include <vector>
+
+namespace Coordinates {
+
+    struct Neighbour {
+        size_t id;
+        double distance;
+    };
+
+    // k-d tree over points of the sphere, built once. Points are kept as unit vectors, where
+    // the straight chord between two points grows with the great-circle distance, so plain
+    // euclidean pruning stays exact.
+    class NearestIndex {
+    public:
+        NearestIndex() = default;
+
+        // ids are positions in `points`
+        explicit NearestIndex(const std::vector<Point> &points);
+
+        // up to `count` closest points, no farther than `radius` metres, nearest first
+        std::vector<Neighbour> Find(Point center, std::optional<size_t> count,
+                                    std::optional<double> radius) const;
+
+    private:
+        using Vector = std::array<double, 3>;
+
+        struct Node {
+            Vector position;
+            size_t id;
+            int axis;
+        };
+
+        static Vector ToVector(Point point);
+
+        static double ChordToDistance(double chord_squared);
+
+        void Build(size_t begin, size_t end);
+
+        template<class Visitor>
+        void Search(size_t begin, size_t end, const Vector &center, Visitor &visitor) const;
+
+    private:
+        // implicit tree: the node of range [begin, end) sits at its middle
+        std::vector<Node> nodes_;
+    };
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Calls fn(task) for every task in [0, task_count) on up to hardware_concurrency threads.
+// The first exception thrown by a task is rethrown after all threads have joined.
+template<class Fn>
+void ParallelFor(size_t task_count, Fn fn) {
+    const size_t thread_count = std::min<size_t>(
+            std::max(1u, std::thread::hardware_concurrency()), task_count);
+    if (thread_count <= 1) {
+        for (size_t task = 0; task < task_count; ++task) {
+            fn(task);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next_task = 0;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto work = [&] {
+        for (size_t task; (task = next_task++) < task_count;) {
+            try {
+                fn(task);
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next_task = task_count;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (size_t i = 1; i < thread_count; ++i) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,288 @@
+#include "png.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <stdexcept>
+#include <string_view>
+
+namespace Png {
+
+    namespace {
+
+        // deflate bit stream: values go least significant bit first, Huffman codes most significant first
+        class BitWriter {
+        public:
+            explicit BitWriter(std::string &out) : out_(out) {}
+
+            void Write(uint32_t bits, int count) {
+                buffer_ |= static_cast<uint64_t>(bits) << count_;
+                count_ += count;
+                while (count_ >= 8) {
+                    out_.push_back(static_cast<char>(buffer_ & 0xFF));
+                    buffer_ >>= 8;
+                    count_ -= 8;
+                }
+            }
+
+            void WriteCode(uint32_t code, int length) {
+                uint32_t reversed = 0;
+                for (int i = 0; i < length; ++i) {
+                    reversed = (reversed << 1) | ((code >> i) & 1);
+                }
+                Write(reversed, length);
+            }
+
+            void Flush() {
+                if (count_ > 0) {
+                    out_.push_back(static_cast<char>(buffer_ & 0xFF));
+                    buffer_ = 0;
+                    count_ = 0;
+                }
+            }
+
+        private:
+            std::string &out_;
+            uint64_t buffer_ = 0;
+            int count_ = 0;
+        };
+
+        constexpr std::array<uint16_t, 29> kLengthBase = {
+                3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+        };
+        constexpr std::array<uint8_t, 29> kLengthExtra = {
+                0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+        };
+        constexpr std::array<uint16_t, 30> kDistanceBase = {
+                1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+        };
+        constexpr std::array<uint8_t, 30> kDistanceExtra = {
+                0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+        };
+
+        constexpr size_t kWindow = 32768;
+        constexpr size_t kMinMatch = 3;
+        constexpr size_t kMaxMatch = 258;
+        constexpr int kHashBits = 15;
+        // candidates tried per position; raster rows repeat a lot, so short chains are enough
+        constexpr int kMaxChain = 32;
+
+        void WriteSymbol(BitWriter &out, uint32_t symbol) {
+            if (symbol < 144) {
+                out.WriteCode(0x30 + symbol, 8);
+            } else if (symbol < 256) {
+                out.WriteCode(0x190 + symbol - 144, 9);
+            } else if (symbol < 280) {
+                out.WriteCode(symbol - 256, 7);
+            } else {
+                out.WriteCode(0xC0 + symbol - 280, 8);
+            }
+        }
+
+        void WriteMatch(BitWriter &out, size_t length, size_t distance) {
+            size_t code = kLengthBase.size() - 1;
+            while (kLengthBase[code] > length) {
+                --code;
+            }
+            WriteSymbol(out, 257 + code);
+            out.Write(length - kLengthBase[code], kLengthExtra[code]);
+
+            code = kDistanceBase.size() - 1;
+            while (kDistanceBase[code] > distance) {
+                --code;
+            }
+            out.WriteCode(code, 5);
+            out.Write(distance - kDistanceBase[code], kDistanceExtra[code]);
+        }
+
+        uint32_t Adler32(const std::string &data) {
+            uint32_t a = 1, b = 0;
+            for (size_t begin = 0; begin < data.size(); begin += 5552) {
+                const size_t end = std::min(data.size(), begin + 5552);
+                for (size_t i = begin; i < end; ++i) {
+                    a += static_cast<uint8_t>(data[i]);
+                    b += a;
+                }
+                a %= 65521;
+                b %= 65521;
+            }
+            return (b << 16) | a;
+        }
+
+        uint32_t Crc32(const std::string &data, size_t begin) {
+            static const auto kTable = [] {
+                std::array<uint32_t, 256> table{};
+                for (uint32_t n = 0; n < 256; ++n) {
+                    uint32_t c = n;
+                    for (int k = 0; k < 8; ++k) {
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    }
+                    table[n] = c;
+                }
+                return table;
+            }();
+            uint32_t crc = 0xFFFFFFFFu;
+            for (size_t i = begin; i < data.size(); ++i) {
+                crc = kTable[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+            }
+            return crc ^ 0xFFFFFFFFu;
+        }
+
+        void WriteBigEndian(std::string &out, uint32_t value) {
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                out.push_back(static_cast<char>((value >> shift) & 0xFF));
+            }
+        }
+
+        void WriteChunk(std::string &out, std::string_view type, const std::string &data) {
+            WriteBigEndian(out, data.size());
+            const size_t crc_begin = out.size();
+            out.append(type).append(data);
+            WriteBigEndian(out, Crc32(out, crc_begin));
+        }
+
+        uint8_t Paeth(int left, int up, int up_left) {
+            const int p = left + up - up_left;
+            const int pa = std::abs(p - left), pb = std::abs(p - up), pc = std::abs(p - up_left);
+            if (pa <= pb && pa <= pc) {
+                return left;
+            }
+            return pb <= pc ? up : up_left;
+        }
+
+        // every row gets the filter with the smallest sum of absolute residuals
+        std::string FilterRows(uint32_t width, uint32_t height, const std::vector<uint8_t> &rgba) {
+            constexpr size_t kBytesPerPixel = 4;
+            const size_t stride = static_cast<size_t>(width) * kBytesPerPixel;
+            std::string filtered;
+            filtered.reserve((stride + 1) * height);
+            std::string candidate(stride, '\0'), best;
+            const std::vector<uint8_t> zero_row(stride);
+            for (size_t y = 0; y < height; ++y) {
+                const uint8_t *row = rgba.data() + y * stride;
+                const uint8_t *up = y > 0 ? row - stride : zero_row.data();
+                uint64_t best_cost = UINT64_MAX;
+                uint8_t best_filter = 0;
+                for (uint8_t filter = 0; filter < 5; ++filter) {
+                    uint64_t cost = 0;
+                    for (size_t i = 0; i < stride; ++i) {
+                        const int left = i >= kBytesPerPixel ? row[i - kBytesPerPixel] : 0;
+                        const int up_left = i >= kBytesPerPixel ? up[i - kBytesPerPixel] : 0;
+                        int predicted = 0;
+                        switch (filter) {
+                            case 1:
+                                predicted = left;
+                                break;
+                            case 2:
+                                predicted = up[i];
+                                break;
+                            case 3:
+                                predicted = (left + up[i]) / 2;
+                                break;
+                            case 4:
+                                predicted = Paeth(left, up[i], up_left);
+                                break;
+                            default:
+                                break;
+                        }
+                        const auto residual = static_cast<uint8_t>(row[i] - predicted);
+                        candidate[i] = static_cast<char>(residual);
+                        cost += std::abs(static_cast<int8_t>(residual));
+                    }
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_filter = filter;
+                        best.swap(candidate);
+                        candidate.resize(stride);
+                    }
+                }
+                filtered.push_back(static_cast<char>(best_filter));
+                filtered += best;
+            }
+            return filtered;
+        }
+
+    }
+
+    std::string Compress(const std::string &data) {
+        std::string out = "\x78\x01";
+        BitWriter bits(out);
+        bits.Write(1, 1);  // final block
+        bits.Write(1, 2);  // fixed Huffman codes
+
+        const size_t size = data.size();
+        auto byte = [&](size_t pos) { return static_cast<uint8_t>(data[pos]); };
+        auto hash = [&](size_t pos) {
+            return ((byte(pos) << 10) ^ (byte(pos + 1) << 5) ^ byte(pos + 2)) & ((1u << kHashBits) - 1);
+        };
+        std::vector<int64_t> head(1u << kHashBits, -1);
+        std::vector<int64_t> prev(kWindow, -1);
+        auto insert = [&](size_t pos) {
+            if (pos + kMinMatch <= size) {
+                const auto h = hash(pos);
+                prev[pos % kWindow] = head[h];
+                head[h] = static_cast<int64_t>(pos);
+            }
+        };
+
+        for (size_t pos = 0; pos < size;) {
+            size_t best_length = 0, best_distance = 0;
+            if (pos + kMinMatch <= size) {
+                const size_t max_length = std::min(kMaxMatch, size - pos);
+                int64_t candidate = head[hash(pos)];
+                for (int chain = kMaxChain; candidate >= 0 && chain > 0; --chain) {
+                    const size_t distance = pos - candidate;
+                    if (distance > kWindow) {
+                        break;
+                    }
+                    size_t length = 0;
+                    while (length < max_length && data[candidate + length] == data[pos + length]) {
+                        ++length;
+                    }
+                    if (length > best_length) {
+                        best_length = length;
+                        best_distance = distance;
+                        if (length == max_length) {
+                            break;
+                        }
+                    }
+                    candidate = prev[candidate % kWindow];
+                }
+            }
+            if (best_length >= kMinMatch) {
+                WriteMatch(bits, best_length, best_distance);
+                for (size_t end = pos + best_length; pos < end; ++pos) {
+                    insert(pos);
+                }
+            } else {
+                WriteSymbol(bits, byte(pos));
+                insert(pos++);
+            }
+        }
+        WriteSymbol(bits, 256);
+        bits.Flush();
+        WriteBigEndian(out, Adler32(data));
+        return out;
+    }
+
+    std::string Encode(uint32_t width, uint32_t height, const std::vector<uint8_t> &rgba) {
+        if (rgba.size() != static_cast<size_t>(width) * height * 4) {
+            throw std::runtime_error("pixel buffer does not match the image size");
+        }
+        std::string png = "\x89PNG\r\n\x1a\n";
+
+        std::string header;
+        WriteBigEndian(header, width);
+        WriteBigEndian(header, height);
+        header += std::string("\x08\x06\x00\x00\x00", 5);  // 8-bit RGBA, no interlace
+        WriteChunk(png, "IHDR", header);
+        WriteChunk(png, "IDAT", Compress(FilterRows(width, height, rgba)));
+        WriteChunk(png, "IEND", {});
+        return png;
+    }
+
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Png {
+
+    // PNG file of 8-bit RGBA rows, top to bottom, compressed with the built-in deflate
+    std::string Encode(uint32_t width, uint32_t height, const std::vector<uint8_t> &rgba);
+
+    // zlib stream of a single fixed-Huffman deflate block
+    std::string Compress(const std::string &data);
+
+}
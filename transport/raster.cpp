@@ -0,0 +1,502 @@
+#include "raster.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+
+namespace Raster {
+
+    namespace {
+
+        struct Bounds {
+            double min_x;
+            double min_y;
+            double max_x;
+            double max_y;
+
+            Bounds Expanded(double margin) const {
+                return {min_x - margin, min_y - margin, max_x + margin, max_y + margin};
+            }
+
+            void Extend(const Bounds &other) {
+                min_x = std::min(min_x, other.min_x);
+                min_y = std::min(min_y, other.min_y);
+                max_x = std::max(max_x, other.max_x);
+                max_y = std::max(max_y, other.max_y);
+            }
+        };
+
+        Bounds PointBounds(Svg::Point point, double radius) {
+            return {point.x - radius, point.y - radius, point.x + radius, point.y + radius};
+        }
+
+        // Signed distances in map units, negative inside the shape.
+
+        double BoxDistance(Svg::Point p, const Bounds &box) {
+            const double dx = std::max(box.min_x - p.x, p.x - box.max_x);
+            const double dy = std::max(box.min_y - p.y, p.y - box.max_y);
+            const double outside_x = std::max(dx, 0.), outside_y = std::max(dy, 0.);
+            return std::sqrt(outside_x * outside_x + outside_y * outside_y) + std::min(std::max(dx, dy), 0.);
+        }
+
+        double PointDistance(Svg::Point p, Svg::Point center) {
+            const double dx = p.x - center.x, dy = p.y - center.y;
+            return std::sqrt(dx * dx + dy * dy);
+        }
+
+        // a stroke of `half_width` along a-b, running `before` and `after` past the ends
+        double SegmentDistance(Svg::Point p, Svg::Point a, Svg::Point b,
+                               double half_width, double before, double after) {
+            const double length = PointDistance(a, b);
+            const double dx = (b.x - a.x) / length, dy = (b.y - a.y) / length;
+            const Svg::Point local((p.x - a.x) * dx + (p.y - a.y) * dy, (p.y - a.y) * dx - (p.x - a.x) * dy);
+            return BoxDistance(local, {-before, -half_width, length + after, half_width});
+        }
+
+        double Cross(Svg::Point a, Svg::Point b, Svg::Point p) {
+            return (b.x - a.x) * (p.y - a.y) - (p.x - a.x) * (b.y - a.y);
+        }
+
+        // closed polygon under the nonzero winding rule
+        double PolygonDistance(Svg::Point p, const Svg::Point *points, size_t count) {
+            double distance = std::numeric_limits<double>::infinity();
+            int winding = 0;
+            for (size_t i = 0; i < count; ++i) {
+                const Svg::Point a = points[i], b = points[(i + 1) % count];
+                if (a.x == b.x && a.y == b.y) {
+                    distance = std::min(distance, PointDistance(p, a));
+                    continue;
+                }
+                distance = std::min(distance, SegmentDistance(p, a, b, 0, 0, 0));
+                if (a.y <= p.y) {
+                    winding += b.y > p.y && Cross(a, b, p) > 0;
+                } else {
+                    winding -= b.y <= p.y && Cross(a, b, p) < 0;
+                }
+            }
+            return winding != 0 ? -distance : distance;
+        }
+
+        // 5x7 glyphs for ' ' to '~' and a box for anything else, one byte per column, top row in bit 0
+        constexpr std::array<std::array<uint8_t, 5>, 96> kGlyphs = {{
+                {0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5F, 0x00, 0x00},
+                {0x00, 0x07, 0x00, 0x07, 0x00}, {0x14, 0x7F, 0x14, 0x7F, 0x14},
+                {0x24, 0x2A, 0x7F, 0x2A, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62},
+                {0x36, 0x49, 0x56, 0x20, 0x50}, {0x00, 0x08, 0x07, 0x03, 0x00},
+                {0x00, 0x1C, 0x22, 0x41, 0x00}, {0x00, 0x41, 0x22, 0x1C, 0x00},
+                {0x2A, 0x1C, 0x7F, 0x1C, 0x2A}, {0x08, 0x08, 0x3E, 0x08, 0x08},
+                {0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08},
+                {0x00, 0x60, 0x60, 0x00, 0x00}, {0x20, 0x10, 0x08, 0x04, 0x02},
+                {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00},
+                {0x42, 0x61, 0x51, 0x49, 0x46}, {0x21, 0x41, 0x45, 0x4B, 0x31},
+                {0x18, 0x14, 0x12, 0x7F, 0x10}, {0x27, 0x45, 0x45, 0x45, 0x39},
+                {0x3C, 0x4A, 0x49, 0x49, 0x30}, {0x01, 0x71, 0x09, 0x05, 0x03},
+                {0x36, 0x49, 0x49, 0x49, 0x36}, {0x06, 0x49, 0x49, 0x29, 0x1E},
+                {0x00, 0x36, 0x36, 0x00, 0x00}, {0x00, 0x56, 0x36, 0x00, 0x00},
+                {0x08, 0x14, 0x22, 0x41, 0x00}, {0x14, 0x14, 0x14, 0x14, 0x14},
+                {0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x51, 0x09, 0x06},
+                {0x32, 0x49, 0x79, 0x41, 0x3E}, {0x7E, 0x11, 0x11, 0x11, 0x7E},
+                {0x7F, 0x49, 0x49, 0x49, 0x36}, {0x3E, 0x41, 0x41, 0x41, 0x22},
+                {0x7F, 0x41, 0x41, 0x22, 0x1C}, {0x7F, 0x49, 0x49, 0x49, 0x41},
+                {0x7F, 0x09, 0x09, 0x09, 0x01}, {0x3E, 0x41, 0x49, 0x49, 0x7A},
+                {0x7F, 0x08, 0x08, 0x08, 0x7F}, {0x00, 0x41, 0x7F, 0x41, 0x00},
+                {0x20, 0x40, 0x41, 0x3F, 0x01}, {0x7F, 0x08, 0x14, 0x22, 0x41},
+                {0x7F, 0x40, 0x40, 0x40, 0x40}, {0x7F, 0x02, 0x0C, 0x02, 0x7F},
+                {0x7F, 0x04, 0x08, 0x10, 0x7F}, {0x3E, 0x41, 0x41, 0x41, 0x3E},
+                {0x7F, 0x09, 0x09, 0x09, 0x06}, {0x3E, 0x41, 0x51, 0x21, 0x5E},
+                {0x7F, 0x09, 0x19, 0x29, 0x46}, {0x46, 0x49, 0x49, 0x49, 0x31},
+                {0x01, 0x01, 0x7F, 0x01, 0x01}, {0x3F, 0x40, 0x40, 0x40, 0x3F},
+                {0x1F, 0x20, 0x40, 0x20, 0x1F}, {0x3F, 0x40, 0x38, 0x40, 0x3F},
+                {0x63, 0x14, 0x08, 0x14, 0x63}, {0x07, 0x08, 0x70, 0x08, 0x07},
+                {0x61, 0x51, 0x49, 0x45, 0x43}, {0x00, 0x7F, 0x41, 0x41, 0x00},
+                {0x02, 0x04, 0x08, 0x10, 0x20}, {0x00, 0x41, 0x41, 0x7F, 0x00},
+                {0x04, 0x02, 0x01, 0x02, 0x04}, {0x40, 0x40, 0x40, 0x40, 0x40},
+                {0x00, 0x01, 0x02, 0x04, 0x00}, {0x20, 0x54, 0x54, 0x54, 0x78},
+                {0x7F, 0x48, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x20},
+                {0x38, 0x44, 0x44, 0x48, 0x7F}, {0x38, 0x54, 0x54, 0x54, 0x18},
+                {0x08, 0x7E, 0x09, 0x01, 0x02}, {0x0C, 0x52, 0x52, 0x52, 0x3E},
+                {0x7F, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7D, 0x40, 0x00},
+                {0x20, 0x40, 0x44, 0x3D, 0x00}, {0x7F, 0x10, 0x28, 0x44, 0x00},
+                {0x00, 0x41, 0x7F, 0x40, 0x00}, {0x7C, 0x04, 0x18, 0x04, 0x78},
+                {0x7C, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38},
+                {0x7C, 0x14, 0x14, 0x14, 0x08}, {0x08, 0x14, 0x14, 0x18, 0x7C},
+                {0x7C, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x20},
+                {0x04, 0x3F, 0x44, 0x40, 0x20}, {0x3C, 0x40, 0x40, 0x20, 0x7C},
+                {0x1C, 0x20, 0x40, 0x20, 0x1C}, {0x3C, 0x40, 0x30, 0x40, 0x3C},
+                {0x44, 0x28, 0x10, 0x28, 0x44}, {0x0C, 0x50, 0x50, 0x50, 0x3C},
+                {0x44, 0x64, 0x54, 0x4C, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00},
+                {0x00, 0x00, 0x7F, 0x00, 0x00}, {0x00, 0x41, 0x36, 0x08, 0x00},
+                {0x08, 0x04, 0x08, 0x10, 0x08}, {0x7F, 0x41, 0x41, 0x41, 0x7F}
+        }};
+        constexpr char kFirstGlyph = ' ';
+        constexpr char kMissingGlyph = '\x7F';
+
+        // the font has no Cyrillic, so А (U+0410) to я (U+044F) are transliterated
+        constexpr std::array<std::string_view, 64> kCyrillic = {
+                "A", "B", "V", "G", "D", "E", "Zh", "Z", "I", "Y", "K", "L", "M", "N", "O", "P",
+                "R", "S", "T", "U", "F", "Kh", "Ts", "Ch", "Sh", "Shch", "\"", "Y", "'", "E", "Yu", "Ya",
+                "a", "b", "v", "g", "d", "e", "zh", "z", "i", "y", "k", "l", "m", "n", "o", "p",
+                "r", "s", "t", "u", "f", "kh", "ts", "ch", "sh", "shch", "\"", "y", "'", "e", "yu", "ya"
+        };
+
+        // UTF-8 text as a string of glyph indices from kFirstGlyph
+        std::string ToGlyphs(std::string_view text) {
+            std::string glyphs;
+            glyphs.reserve(text.size());
+            for (size_t pos = 0; pos < text.size();) {
+                const auto lead = static_cast<uint8_t>(text[pos]);
+                const size_t length = lead < 0x80 ? 1 : lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+                uint32_t code = length == 1 ? lead : lead & (0x3F >> (length - 1));
+                for (size_t i = 1; i < length && pos + i < text.size(); ++i) {
+                    code = (code << 6) | (static_cast<uint8_t>(text[pos + i]) & 0x3F);
+                }
+                pos += length;
+
+                if (code == 0x401 || code == 0x451) {
+                    glyphs += code == 0x401 ? 'E' : 'e';
+                } else if (code >= 0x410 && code < 0x450) {
+                    glyphs += kCyrillic[code - 0x410];
+                } else if (code >= static_cast<uint32_t>(kFirstGlyph) && code < static_cast<uint32_t>(kMissingGlyph)) {
+                    glyphs += static_cast<char>(code);
+                } else {
+                    glyphs += kMissingGlyph;
+                }
+            }
+            return glyphs;
+        }
+
+        // Glyph dots merged into vertical runs. A dot is a tenth of the font size, so capitals
+        // stand 0.7 em above the baseline and the advance is 0.6 em (0.7 em in bold).
+        std::vector<Bounds> LayoutText(std::string_view text, Svg::Point origin, double font_size, bool bold) {
+            const double dot = font_size / 10;
+            const double dot_width = bold ? dot * 1.5 : dot;
+            std::vector<Bounds> runs;
+            double pen = origin.x;
+            for (char glyph: ToGlyphs(text)) {
+                const auto &columns = kGlyphs[glyph - kFirstGlyph];
+                for (size_t column = 0; column < columns.size(); ++column) {
+                    const double x = pen + column * dot;
+                    for (int row = 0; row < 7;) {
+                        if (!(columns[column] >> row & 1)) {
+                            ++row;
+                            continue;
+                        }
+                        const int run_begin = row;
+                        while (row < 7 && (columns[column] >> row & 1)) {
+                            ++row;
+                        }
+                        runs.push_back({x, origin.y - (7 - run_begin) * dot, x + dot_width, origin.y - (7 - row) * dot});
+                    }
+                }
+                pen += (bold ? 7 : 6) * dot;
+            }
+            return runs;
+        }
+
+        std::optional<uint32_t> FindNamedColor(const std::string &name) {
+            static const std::unordered_map<std::string_view, uint32_t> kNamedColors = {
+                    {"aliceblue", 0xF0F8FF}, {"antiquewhite", 0xFAEBD7}, {"aqua", 0x00FFFF},
+                    {"aquamarine", 0x7FFFD4}, {"azure", 0xF0FFFF}, {"beige", 0xF5F5DC},
+                    {"bisque", 0xFFE4C4}, {"black", 0x000000}, {"blanchedalmond", 0xFFEBCD},
+                    {"blue", 0x0000FF}, {"blueviolet", 0x8A2BE2}, {"brown", 0xA52A2A},
+                    {"burlywood", 0xDEB887}, {"cadetblue", 0x5F9EA0}, {"chartreuse", 0x7FFF00},
+                    {"chocolate", 0xD2691E}, {"coral", 0xFF7F50}, {"cornflowerblue", 0x6495ED},
+                    {"cornsilk", 0xFFF8DC}, {"crimson", 0xDC143C}, {"cyan", 0x00FFFF},
+                    {"darkblue", 0x00008B}, {"darkcyan", 0x008B8B}, {"darkgoldenrod", 0xB8860B},
+                    {"darkgray", 0xA9A9A9}, {"darkgreen", 0x006400}, {"darkgrey", 0xA9A9A9},
+                    {"darkkhaki", 0xBDB76B}, {"darkmagenta", 0x8B008B}, {"darkolivegreen", 0x556B2F},
+                    {"darkorange", 0xFF8C00}, {"darkorchid", 0x9932CC}, {"darkred", 0x8B0000},
+                    {"darksalmon", 0xE9967A}, {"darkseagreen", 0x8FBC8F}, {"darkslateblue", 0x483D8B},
+                    {"darkslategray", 0x2F4F4F}, {"darkslategrey", 0x2F4F4F}, {"darkturquoise", 0x00CED1},
+                    {"darkviolet", 0x9400D3}, {"deeppink", 0xFF1493}, {"deepskyblue", 0x00BFFF},
+                    {"dimgray", 0x696969}, {"dimgrey", 0x696969}, {"dodgerblue", 0x1E90FF},
+                    {"firebrick", 0xB22222}, {"floralwhite", 0xFFFAF0}, {"forestgreen", 0x228B22},
+                    {"fuchsia", 0xFF00FF}, {"gainsboro", 0xDCDCDC}, {"ghostwhite", 0xF8F8FF},
+                    {"gold", 0xFFD700}, {"goldenrod", 0xDAA520}, {"gray", 0x808080},
+                    {"green", 0x008000}, {"greenyellow", 0xADFF2F}, {"grey", 0x808080},
+                    {"honeydew", 0xF0FFF0}, {"hotpink", 0xFF69B4}, {"indianred", 0xCD5C5C},
+                    {"indigo", 0x4B0082}, {"ivory", 0xFFFFF0}, {"khaki", 0xF0E68C},
+                    {"lavender", 0xE6E6FA}, {"lavenderblush", 0xFFF0F5}, {"lawngreen", 0x7CFC00},
+                    {"lemonchiffon", 0xFFFACD}, {"lightblue", 0xADD8E6}, {"lightcoral", 0xF08080},
+                    {"lightcyan", 0xE0FFFF}, {"lightgoldenrodyellow", 0xFAFAD2}, {"lightgray", 0xD3D3D3},
+                    {"lightgreen", 0x90EE90}, {"lightgrey", 0xD3D3D3}, {"lightpink", 0xFFB6C1},
+                    {"lightsalmon", 0xFFA07A}, {"lightseagreen", 0x20B2AA}, {"lightskyblue", 0x87CEFA},
+                    {"lightslategray", 0x778899}, {"lightslategrey", 0x778899}, {"lightsteelblue", 0xB0C4DE},
+                    {"lightyellow", 0xFFFFE0}, {"lime", 0x00FF00}, {"limegreen", 0x32CD32},
+                    {"linen", 0xFAF0E6}, {"magenta", 0xFF00FF}, {"maroon", 0x800000},
+                    {"mediumaquamarine", 0x66CDAA}, {"mediumblue", 0x0000CD}, {"mediumorchid", 0xBA55D3},
+                    {"mediumpurple", 0x9370DB}, {"mediumseagreen", 0x3CB371}, {"mediumslateblue", 0x7B68EE},
+                    {"mediumspringgreen", 0x00FA9A}, {"mediumturquoise", 0x48D1CC},
+                    {"mediumvioletred", 0xC71585}, {"midnightblue", 0x191970}, {"mintcream", 0xF5FFFA},
+                    {"mistyrose", 0xFFE4E1}, {"moccasin", 0xFFE4B5}, {"navajowhite", 0xFFDEAD},
+                    {"navy", 0x000080}, {"oldlace", 0xFDF5E6}, {"olive", 0x808000},
+                    {"olivedrab", 0x6B8E23}, {"orange", 0xFFA500}, {"orangered", 0xFF4500},
+                    {"orchid", 0xDA70D6}, {"palegoldenrod", 0xEEE8AA}, {"palegreen", 0x98FB98},
+                    {"paleturquoise", 0xAFEEEE}, {"palevioletred", 0xDB7093}, {"papayawhip", 0xFFEFD5},
+                    {"peachpuff", 0xFFDAB9}, {"peru", 0xCD853F}, {"pink", 0xFFC0CB},
+                    {"plum", 0xDDA0DD}, {"powderblue", 0xB0E0E6}, {"purple", 0x800080},
+                    {"rebeccapurple", 0x663399}, {"red", 0xFF0000}, {"rosybrown", 0xBC8F8F},
+                    {"royalblue", 0x4169E1}, {"saddlebrown", 0x8B4513}, {"salmon", 0xFA8072},
+                    {"sandybrown", 0xF4A460}, {"seagreen", 0x2E8B57}, {"seashell", 0xFFF5EE},
+                    {"sienna", 0xA0522D}, {"silver", 0xC0C0C0}, {"skyblue", 0x87CEEB},
+                    {"slateblue", 0x6A5ACD}, {"slategray", 0x708090}, {"slategrey", 0x708090},
+                    {"snow", 0xFFFAFA}, {"springgreen", 0x00FF7F}, {"steelblue", 0x4682B4},
+                    {"tan", 0xD2B48C}, {"teal", 0x008080}, {"thistle", 0xD8BFD8},
+                    {"tomato", 0xFF6347}, {"turquoise", 0x40E0D0}, {"violet", 0xEE82EE},
+                    {"wheat", 0xF5DEB3}, {"white", 0xFFFFFF}, {"whitesmoke", 0xF5F5F5},
+                    {"yellow", 0xFFFF00}, {"yellowgreen", 0x9ACD32}
+            };
+            if (auto it = kNamedColors.find(name); it != kNamedColors.end()) {
+                return it->second;
+            }
+            // #rgb and #rrggbb
+            if (name.size() == 4 || name.size() == 7) {
+                if (name[0] == '#' && std::all_of(name.begin() + 1, name.end(), ::isxdigit)) {
+                    uint32_t value = std::stoul(name.substr(1), nullptr, 16);
+                    if (name.size() == 4) {
+                        value = (value & 0xF00) * 0x1100 + (value & 0x0F0) * 0x110 + (value & 0x00F) * 0x11;
+                    }
+                    return value;
+                }
+            }
+            return std::nullopt;
+        }
+
+    }
+
+    // coverage of the pixels around one object, combined with max so that overlapping
+    // parts of a shape (joins, glyph runs) are painted once
+    class Canvas::Mask {
+    public:
+        Mask(const Canvas &canvas, const Bounds &bounds) : scale_(canvas.scale_) {
+            std::tie(x_begin_, x_end_) = ToPixels(bounds.min_x, bounds.max_x, canvas.width_);
+            std::tie(y_begin_, y_end_) = ToPixels(bounds.min_y, bounds.max_y, canvas.height_);
+            coverage_.assign(static_cast<size_t>(x_end_ - x_begin_) * (y_end_ - y_begin_), 0.f);
+        }
+
+        // `distance` maps a point to its signed distance from the shape inside `bounds`
+        template<class Distance>
+        void Add(const Bounds &bounds, Distance distance) {
+            auto [x_begin, x_end] = ToPixels(bounds.min_x, bounds.max_x, x_end_);
+            auto [y_begin, y_end] = ToPixels(bounds.min_y, bounds.max_y, y_end_);
+            x_begin = std::max(x_begin, x_begin_);
+            y_begin = std::max(y_begin, y_begin_);
+            for (uint32_t y = y_begin; y < y_end; ++y) {
+                for (uint32_t x = x_begin; x < x_end; ++x) {
+                    const double value = distance(Svg::Point((x + 0.5) / scale_, (y + 0.5) / scale_));
+                    const auto coverage = static_cast<float>(std::clamp(0.5 - value * scale_, 0., 1.));
+                    auto &current = coverage_[(y - y_begin_) * (x_end_ - x_begin_) + (x - x_begin_)];
+                    current = std::max(current, coverage);
+                }
+            }
+        }
+
+        template<class Callback>
+        void ForEachPixel(Callback callback) const {
+            for (uint32_t y = y_begin_; y < y_end_; ++y) {
+                for (uint32_t x = x_begin_; x < x_end_; ++x) {
+                    if (const float coverage = coverage_[(y - y_begin_) * (x_end_ - x_begin_) + (x - x_begin_)];
+                            coverage > 0) {
+                        callback(x, y, coverage);
+                    }
+                }
+            }
+        }
+
+    private:
+        double scale_;
+        uint32_t x_begin_, x_end_, y_begin_, y_end_;
+        std::vector<float> coverage_;
+
+        // pixels whose centers can be within a pixel of [min, max], clipped to [0, limit)
+        std::pair<uint32_t, uint32_t> ToPixels(double min, double max, uint32_t limit) const {
+            const double begin = std::clamp(std::floor(min * scale_) - 1, 0., static_cast<double>(limit));
+            const double end = std::clamp(std::ceil(max * scale_) + 1, begin, static_cast<double>(limit));
+            return {static_cast<uint32_t>(begin), static_cast<uint32_t>(end)};
+        }
+    };
+
+    Canvas::Canvas(double width, double height, double scale) : scale_(scale) {
+        if (!(scale > 0) || !(width * scale >= 1) || !(height * scale >= 1)
+            || std::ceil(width * scale) * std::ceil(height * scale) > kMaxPixels) {
+            throw std::runtime_error("canvas size is out of range");
+        }
+        width_ = static_cast<uint32_t>(std::ceil(width * scale));
+        height_ = static_cast<uint32_t>(std::ceil(height * scale));
+        pixels_.assign(static_cast<size_t>(width_) * height_ * 4, 0);
+    }
+
+    std::optional<Canvas::Paint> Canvas::ResolveColor(const Svg::Color &color) {
+        if (const auto *rgba = std::get_if<Svg::Rgba>(&color.data_)) {
+            return Paint{rgba->red / 255., rgba->green / 255., rgba->blue / 255., std::clamp(rgba->alpha, 0., 1.)};
+        }
+        if (const auto *rgb = std::get_if<Svg::Rgb>(&color.data_)) {
+            return Paint{rgb->red / 255., rgb->green / 255., rgb->blue / 255., 1.};
+        }
+        std::string name = std::get<std::string>(color.data_);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (name == "none" || name == "transparent") {
+            return std::nullopt;
+        }
+        if (const auto value = FindNamedColor(name)) {
+            return Paint{(*value >> 16) / 255., (*value >> 8 & 0xFF) / 255., (*value & 0xFF) / 255., 1.};
+        }
+        throw std::runtime_error("unknown color: " + name);
+    }
+
+    void Canvas::Fill(const Mask &mask, const Paint &paint) {
+        mask.ForEachPixel([&](uint32_t x, uint32_t y, float coverage) {
+            uint8_t *pixel = &pixels_[(static_cast<size_t>(y) * width_ + x) * 4];
+            const double source_alpha = paint.alpha * coverage;
+            const double target_alpha = pixel[3] / 255.;
+            const double alpha = source_alpha + target_alpha * (1 - source_alpha);
+            if (alpha <= 0) {
+                return;
+            }
+            const double channels[] = {paint.red, paint.green, paint.blue};
+            for (int channel = 0; channel < 3; ++channel) {
+                const double value = (channels[channel] * source_alpha
+                                      + pixel[channel] / 255. * target_alpha * (1 - source_alpha)) / alpha;
+                pixel[channel] = static_cast<uint8_t>(std::lround(value * 255));
+            }
+            pixel[3] = static_cast<uint8_t>(std::lround(alpha * 255));
+        });
+    }
+
+    void Canvas::Draw(const Svg::Document &document) {
+        for (const auto &entry: document.objects_) {
+            std::visit([&](const auto &object) { DrawEntry(document, object); }, entry);
+        }
+    }
+
+    void Canvas::DrawEntry(const Svg::Document &document, const Svg::Document::CircleEntry &circle) {
+        const auto &style = document.styles_[circle.style];
+        const double half_width = style.stroke_width / 2;
+        const Bounds bounds = PointBounds(circle.center, circle.radius + std::max(half_width, 0.));
+        if (const auto paint = ResolveColor(document.colors_[style.fill_color])) {
+            Mask mask(*this, bounds);
+            mask.Add(bounds, [&](Svg::Point p) { return PointDistance(p, circle.center) - circle.radius; });
+            Fill(mask, *paint);
+        }
+        if (const auto paint = ResolveColor(document.colors_[style.stroke_color]); paint && half_width > 0) {
+            Mask mask(*this, bounds);
+            mask.Add(bounds, [&](Svg::Point p) {
+                return std::abs(PointDistance(p, circle.center) - circle.radius) - half_width;
+            });
+            Fill(mask, *paint);
+        }
+    }
+
+    void Canvas::DrawEntry(const Svg::Document &document, const Svg::Document::PolylineEntry &polyline) {
+        if (polyline.point_count == 0) {
+            return;
+        }
+        const auto &style = document.styles_[polyline.style];
+        const Svg::Point *points = &document.points_[polyline.first_point];
+        const size_t count = polyline.point_count;
+        Bounds bounds = PointBounds(points[0], 0);
+        for (size_t i = 1; i < count; ++i) {
+            bounds.Extend(PointBounds(points[i], 0));
+        }
+
+        if (const auto paint = ResolveColor(document.colors_[style.fill_color]); paint && count >= 3) {
+            Mask mask(*this, bounds);
+            mask.Add(bounds, [&](Svg::Point p) { return PolygonDistance(p, points, count); });
+            Fill(mask, *paint);
+        }
+
+        const double half_width = style.stroke_width / 2;
+        const auto paint = ResolveColor(document.colors_[style.stroke_color]);
+        if (!paint || half_width <= 0) {
+            return;
+        }
+        const std::string_view line_cap = style.stroke_line_cap == Svg::Document::kNoId
+                                          ? std::string_view("butt")
+                                          : std::string_view(document.strings_[style.stroke_line_cap]);
+        const double cap_extension = line_cap == "square" ? half_width : 0;
+        // every join is drawn round; the map only asks for round joins
+        Mask mask(*this, bounds.Expanded(half_width * std::sqrt(2.)));
+        for (size_t i = 1; i < count; ++i) {
+            const Svg::Point a = points[i - 1], b = points[i];
+            if (a.x == b.x && a.y == b.y) {
+                continue;
+            }
+            const double before = i == 1 ? cap_extension : 0;
+            const double after = i + 1 == count ? cap_extension : 0;
+            Bounds segment = PointBounds(a, 0);
+            segment.Extend(PointBounds(b, 0));
+            mask.Add(segment.Expanded(half_width + cap_extension), [&](Svg::Point p) {
+                return SegmentDistance(p, a, b, half_width, before, after);
+            });
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if ((i == 0 || i + 1 == count) && line_cap != "round") {
+                continue;
+            }
+            mask.Add(PointBounds(points[i], half_width), [&](Svg::Point p) {
+                return PointDistance(p, points[i]) - half_width;
+            });
+        }
+        Fill(mask, *paint);
+    }
+
+    void Canvas::DrawEntry(const Svg::Document &document, const Svg::Document::TextEntry &text) {
+        const auto &style = document.styles_[text.style];
+        const bool bold = text.font_weight != Svg::Document::kNoId && document.strings_[text.font_weight] == "bold";
+        const auto runs = LayoutText(
+                std::string_view(document.text_arena_).substr(text.data_begin, text.data_size),
+                Svg::Point(text.position.x + text.offset.x, text.position.y + text.offset.y),
+                text.font_size, bold);
+        if (runs.empty()) {
+            return;
+        }
+        const double half_width = std::max(style.stroke_width / 2, 0.);
+        Bounds bounds = runs.front();
+        for (const auto &run: runs) {
+            bounds.Extend(run);
+        }
+        bounds = bounds.Expanded(half_width);
+
+        if (const auto paint = ResolveColor(document.colors_[style.fill_color])) {
+            Mask mask(*this, bounds);
+            for (const auto &run: runs) {
+                mask.Add(run, [&](Svg::Point p) { return BoxDistance(p, run); });
+            }
+            Fill(mask, *paint);
+        }
+        if (const auto paint = ResolveColor(document.colors_[style.stroke_color]); paint && half_width > 0) {
+            Mask mask(*this, bounds);
+            for (const auto &run: runs) {
+                mask.Add(run.Expanded(half_width), [&](Svg::Point p) {
+                    return std::abs(BoxDistance(p, run)) - half_width;
+                });
+            }
+            Fill(mask, *paint);
+        }
+    }
+
+    void Canvas::DrawEntry(const Svg::Document &document, const Svg::Document::RectangleEntry &rectangle) {
+        const auto &style = document.styles_[rectangle.style];
+        const double half_width = std::max(style.stroke_width / 2, 0.);
+        const Bounds box{rectangle.edge.x, rectangle.edge.y,
+                         rectangle.edge.x + rectangle.width, rectangle.edge.y + rectangle.height};
+        const Bounds bounds = box.Expanded(half_width);
+        if (const auto paint = ResolveColor(document.colors_[style.fill_color])) {
+            Mask mask(*this, bounds);
+            mask.Add(bounds, [&](Svg::Point p) { return BoxDistance(p, box); });
+            Fill(mask, *paint);
+        }
+        if (const auto paint = ResolveColor(document.colors_[style.stroke_color]); paint && half_width > 0) {
+            Mask mask(*this, bounds);
+            mask.Add(bounds, [&](Svg::Point p) { return std::abs(BoxDistance(p, box)) - half_width; });
+            Fill(mask, *paint);
+        }
+    }
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "svg.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace Raster {
+
+    // Anti-aliased RGBA image that Svg::Document records are drawn onto, `scale` pixels per map unit.
+    // Polylines get round joins (and the caps they ask for), texts are set in a built-in 5x7 font.
+    class Canvas {
+    public:
+        Canvas(double width, double height, double scale);
+
+        // draws the objects over what is already on the canvas, in document order
+        void Draw(const Svg::Document &document);
+
+        uint32_t GetWidth() const {
+            return width_;
+        }
+
+        uint32_t GetHeight() const {
+            return height_;
+        }
+
+        // non-premultiplied RGBA rows, top to bottom
+        const std::vector<uint8_t> &GetPixels() const {
+            return pixels_;
+        }
+
+        static constexpr uint64_t kMaxPixels = 1u << 24;
+
+    private:
+        struct Paint {
+            double red;
+            double green;
+            double blue;
+            double alpha;
+        };
+
+        class Mask;
+
+        uint32_t width_;
+        uint32_t height_;
+        double scale_;
+        std::vector<uint8_t> pixels_;
+
+        // nullopt for "none"
+        static std::optional<Paint> ResolveColor(const Svg::Color &color);
+
+        void Fill(const Mask &mask, const Paint &paint);
+
+        void DrawEntry(const Svg::Document &document, const Svg::Document::CircleEntry &circle);
+
+        void DrawEntry(const Svg::Document &document, const Svg::Document::PolylineEntry &polyline);
+
+        void DrawEntry(const Svg::Document &document, const Svg::Document::TextEntry &text);
+
+        void DrawEntry(const Svg::Document &document, const Svg::Document::RectangleEntry &rectangle);
+    };
+
+}
@@ -1,13 +1,61 @@
 #include "request.h"
+#include "metrics.h"
+#include "trace.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
 
 namespace Requests {
 
+    Render::MapFormat ReadMapFormat(const std::map<std::string, Json::Node> &base_map) {
+        Render::MapFormat format;
+        if (auto it = base_map.find("format"); it != base_map.end()) {
+            if (const auto &type = it->second.AsString(); type == "png") {
+                format.type = Render::MapFormat::Type::Png;
+            } else if (type != "svg") {
+                throw std::runtime_error("Unknown map format: " + type);
+            }
+        }
+        if (auto it = base_map.find("scale"); it != base_map.end()) {
+            format.scale = it->second.AsDouble();
+        }
+        return format;
+    }
+
+    std::string ReadProfile(const std::map<std::string, Json::Node> &base_map) {
+        if (auto it = base_map.find("profile"); it != base_map.end()) {
+            return it->second.AsString();
+        }
+        return {};
+    }
+
+    Render::RouteMap ReadRouteMap(const std::map<std::string, Json::Node> &base_map) {
+        if (auto it = base_map.find("map"); it != base_map.end()) {
+            const auto &route_map = it->second.AsString();
+            if (route_map == "none") {
+                return Render::RouteMap::None;
+            } else if (route_map == "overlay") {
+                return Render::RouteMap::Overlay;
+            } else if (route_map != "full") {
+                throw std::runtime_error("Unknown route map: " + route_map);
+            }
+        }
+        return Render::RouteMap::Full;
+    }
+
     Json::Node ProcessStop(const TransportGuide &tg, const Json::Node &base_node) {
         std::map<std::string, Json::Node> response_map;
-        if (auto response = tg.GetStop(base_node.AsMap().at("name").AsString())) {
+        if (const auto *response = tg.GetStop(base_node.AsMap().at("name").AsString())) {
             std::vector<Json::Node> buses;
-            for (const auto &bus_name: response->busses) {
-                buses.emplace_back(bus_name);
+            buses.reserve(response->busses.size());
+            for (const auto bus_name: response->busses) {
+                buses.emplace_back(std::string(bus_name));
             }
             response_map.emplace("buses", std::move(buses));
         } else {
@@ -20,7 +68,7 @@ namespace Requests {
 
     Json::Node ProcessBus(const TransportGuide &tg, const Json::Node &base_node) {
         std::map<std::string, Json::Node> response_map;
-        if (auto response = tg.GetBus(base_node.AsMap().at("name").AsString())) {
+        if (const auto *response = tg.GetBus(base_node.AsMap().at("name").AsString())) {
             response_map["stop_count"] = Json::Int(
                     static_cast<int64_t>(response->stops_on_route));
             response_map["unique_stop_count"] = Json::Int(
@@ -35,13 +83,45 @@ namespace Requests {
         return Json::Node{std::move(response_map)};
     }
 
-    Json::Node ProcessRoute(const TransportGuide &tg, const Json::Node &base_node) {
+    Json::Node ProcessCommonBuses(const TransportGuide &tg, const Json::Node &base_node) {
+        const auto &base_map = base_node.AsMap();
         std::map<std::string, Json::Node> response_map;
-        if (auto response = tg.GetRoute(base_node.AsMap().at("from").AsString(),
-                                        base_node.AsMap().at("to").AsString())) {
+        if (const auto response = tg.GetCommonBuses(base_map.at("from").AsString(), base_map.at("to").AsString())) {
+            std::vector<Json::Node> buses;
+            buses.reserve(response->buses.size());
+            for (const auto bus_name: response->buses) {
+                buses.emplace_back(std::string(bus_name));
+            }
+            response_map.emplace("buses", std::move(buses));
+        } else {
+            response_map["error_message"] = "not found";
+        }
+        response_map["request_id"] = Json::Int(
+                static_cast<int64_t>(base_map.at("id").AsDouble()));
+        return Json::Node{std::move(response_map)};
+    }
+
+    TransportGuide::RouteQuery ReadRouteQuery(const std::map<std::string, Json::Node> &base_map) {
+        return TransportGuide::RouteQuery{
+                .to = base_map.at("to").AsString(),
+                .format = ReadMapFormat(base_map),
+                .profile = ReadProfile(base_map),
+                .route_map = ReadRouteMap(base_map)
+        };
+    }
+
+    // everything but the request id
+    std::map<std::string, Json::Node> MakeRouteResponse(const std::optional<Response::Route> &response) {
+        std::map<std::string, Json::Node> response_map;
+        if (response) {
             std::vector<Json::Node> items_array;
             response_map["total_time"] = response->total_time;
-            response_map["map"] = response->map.data;
+            if (response->map) {
+                response_map["map"] = response->map->data;
+            }
+            if (response->base_map_hash) {
+                response_map["base_map_hash"] = FormatHex(*response->base_map_hash);
+            }
             for (const auto &item: response->items) {
                 std::map<std::string, Json::Node> item_map;
                 if (std::holds_alternative<Response::Route::Wait>(item)) {
@@ -58,40 +138,419 @@ namespace Requests {
                 } else {
                     throw std::runtime_error("Unknown route response");
                 }
-                items_array.emplace_back(Json::Node{std::move(item_map)});
+                items_array.emplace_back(std::move(item_map));
             }
             response_map["items"] = std::move(items_array);
         } else {
             response_map["error_message"] = "not found";
         }
+        return response_map;
+    }
+
+    Json::Node ProcessRoute(const TransportGuide &tg, const Json::Node &base_node) {
+        const auto &base_map = base_node.AsMap();
+        const auto query = ReadRouteQuery(base_map);
+        auto response_map = MakeRouteResponse(tg.GetRoute(base_map.at("from").AsString(), query.to,
+                                                          query.format, query.profile, query.route_map));
         response_map["request_id"] = Json::Int(
-                static_cast<int64_t>(base_node.AsMap().at("id").AsDouble()));
+                static_cast<int64_t>(base_map.at("id").AsDouble()));
+        return Json::Node{std::move(response_map)};
+    }
+
+    void ProcessRoutes(const TransportGuide &tg, const std::vector<Json::Node> &requests,
+                       size_t begin, size_t end, std::vector<Json::Node> &responses) {
+        struct Group {
+            std::vector<TransportGuide::RouteQuery> queries;
+            // requests asking each query
+            std::vector<std::vector<size_t>> requests;
+        };
+        std::map<std::string, Group> groups;
+        std::map<std::tuple<std::string, std::string, Render::MapFormat::Type, double, std::string, Render::RouteMap>,
+                size_t> query_ids;
+        for (size_t request = begin; request < end; ++request) {
+            const auto &base_map = requests[request].AsMap();
+            if (base_map.at("type").AsString() != "Route") {
+                continue;
+            }
+            const auto &from = base_map.at("from").AsString();
+            auto query = ReadRouteQuery(base_map);
+            auto &group = groups[from];
+            const auto [it, inserted] = query_ids.emplace(
+                    std::tuple{from, query.to, query.format.type, query.format.scale, query.profile, query.route_map},
+                    group.queries.size());
+            if (inserted) {
+                group.queries.push_back(std::move(query));
+                group.requests.emplace_back();
+            } else {
+                Metrics::Add(Metrics::Counter::RouteRepeats);
+            }
+            group.requests[it->second].push_back(request);
+        }
+
+        for (const auto &[from, group]: groups) {
+            Trace::Span span("Route");
+            const auto start = std::chrono::steady_clock::now();
+            const uint64_t allocations = Metrics::GetThreadAllocations();
+            size_t request_count = 0;
+            const auto answers = tg.GetRoutes(from, group.queries);
+            for (size_t query = 0; query < answers.size(); ++query) {
+                const auto response_map = MakeRouteResponse(answers[query]);
+                for (const size_t request: group.requests[query]) {
+                    auto request_map = response_map;
+                    request_map["request_id"] = Json::Int(
+                            static_cast<int64_t>(requests[request].AsMap().at("id").AsDouble()));
+                    responses[request] = Json::Node{std::move(request_map)};
+                    ++request_count;
+                }
+            }
+            // the requests of a group are answered together, each is charged an equal share
+            Metrics::Add(Metrics::Counter::RouteSearches);
+            const auto share = (std::chrono::steady_clock::now() - start) / request_count;
+            const uint64_t allocation_share = (Metrics::GetThreadAllocations() - allocations) / request_count;
+            for (size_t i = 0; i < request_count; ++i) {
+                Metrics::RecordRequest(Metrics::Request::Route, share, allocation_share);
+            }
+        }
+    }
+
+    Json::Node ProcessIsochrone(const TransportGuide &tg, const Json::Node &base_node) {
+        const auto &base_map = base_node.AsMap();
+        std::map<std::string, Json::Node> response_map;
+        if (const auto response = tg.GetReachableStops(base_map.at("from").AsString(),
+                                                       base_map.at("max_time").AsDouble())) {
+            std::vector<Json::Node> stops;
+            stops.reserve(response->items.size());
+            for (const auto &[stop_name, time]: response->items) {
+                std::map<std::string, Json::Node> stop_map;
+                stop_map["stop_name"] = std::string(stop_name);
+                stop_map["time"] = time;
+                stops.emplace_back(std::move(stop_map));
+            }
+            response_map["stops"] = std::move(stops);
+        } else {
+            response_map["error_message"] = "not found";
+        }
+        response_map["request_id"] = Json::Int(
+                static_cast<int64_t>(base_map.at("id").AsDouble()));
+        return Json::Node{std::move(response_map)};
+    }
+
+    std::vector<std::string> ReadStopNames(const Json::Node &node) {
+        std::vector<std::string> names;
+        names.reserve(node.AsArray().size());
+        for (const auto &name: node.AsArray()) {
+            names.push_back(name.AsString());
+        }
+        return names;
+    }
+
+    // little-endian bytes of the values, base64-encoded
+    template<class Value>
+    std::string PackNumbers(const std::vector<Value> &values) {
+        std::string bytes;
+        bytes.reserve(values.size() * sizeof(Value));
+        for (const Value value: values) {
+            uint64_t bits = 0;
+            std::memcpy(&bits, &value, sizeof(Value));
+            for (size_t i = 0; i < sizeof(Value); ++i) {
+                bytes.push_back(static_cast<char>((bits >> (8 * i)) & 0xFF));
+            }
+        }
+        return EncodeBase64(bytes);
+    }
+
+    Json::Node ProcessMatrix(const TransportGuide &tg, const Json::Node &base_node) {
+        const auto &base_map = base_node.AsMap();
+        const auto read_flag = [&](const std::string &key) {
+            auto it = base_map.find(key);
+            return it != base_map.end() && it->second.AsBool();
+        };
+        const bool with_transfers = read_flag("transfers");
+        const bool packed = read_flag("packed");
+
+        std::map<std::string, Json::Node> response_map;
+        if (const auto response = tg.GetMatrix(ReadStopNames(base_map.at("from")),
+                                               ReadStopNames(base_map.at("to")))) {
+            // -1 where there is no route
+            std::vector<double> times;
+            std::vector<int32_t> transfers;
+            times.reserve(response->cells.size());
+            for (const auto &cell: response->cells) {
+                times.push_back(cell ? cell->time : -1);
+                if (with_transfers) {
+                    transfers.push_back(cell ? static_cast<int32_t>(cell->transfers) : -1);
+                }
+            }
+            if (packed) {
+                response_map["times"] = PackNumbers(times);
+                if (with_transfers) {
+                    response_map["transfers"] = PackNumbers(transfers);
+                }
+            } else {
+                response_map["times"] = std::vector<Json::Node>(times.begin(), times.end());
+                if (with_transfers) {
+                    std::vector<Json::Node> transfer_nodes;
+                    transfer_nodes.reserve(transfers.size());
+                    for (const auto count: transfers) {
+                        transfer_nodes.emplace_back(Json::Int(count));
+                    }
+                    response_map["transfers"] = std::move(transfer_nodes);
+                }
+            }
+        } else {
+            response_map["error_message"] = "not found";
+        }
+        response_map["request_id"] = Json::Int(
+                static_cast<int64_t>(base_map.at("id").AsDouble()));
         return Json::Node{std::move(response_map)};
     }
 
+    // nullopt unless the number is an integer that fits uint32_t
+    std::optional<uint32_t> ReadUint32(const Json::Node &node) {
+        const double value = node.AsDouble();
+        if (!(value >= 0 && value < double(1ull << 32) && std::floor(value) == value)) {
+            return std::nullopt;
+        }
+        return static_cast<uint32_t>(value);
+    }
 
     Json::Node ProcessMap(const TransportGuide &tg, const Json::Node &base_node) {
+        const auto &base_map = base_node.AsMap();
+        std::optional<uint32_t> lod = 0;
+        if (auto it = base_map.find("lod"); it != base_map.end()) {
+            lod = ReadUint32(it->second);
+        }
         std::map<std::string, Json::Node> response_map;
-        response_map["map"] = tg.GetMap().data;
+        if (!lod || *lod > Render::Renderer::kMaxLod) {
+            response_map["error_message"] = "Map lod must be an integer from 0 to "
+                                            + std::to_string(Render::Renderer::kMaxLod);
+        } else if (auto response = tg.GetMap(ReadMapFormat(base_map), *lod, ReadProfile(base_map))) {
+            response_map["map"] = std::move(response->data);
+        } else {
+            response_map["error_message"] = "not found";
+        }
         response_map["request_id"] = Json::Int(
                 static_cast<int64_t>(base_node.AsMap().at("id").AsDouble()));
         return Json::Node{std::move(response_map)};
     }
 
-    Json::Node ProcessAll(const TransportGuide &tg, const Json::Node &base_node) {
-        std::vector<Json::Node> responses;
-        for (const auto &node: base_node.AsArray()) {
-            if (const auto &type = node.AsMap().at("type").AsString(); type == "Stop") {
-                responses.emplace_back(ProcessStop(tg, node));
+    Json::Node ProcessNearbyStops(const TransportGuide &tg, const Json::Node &base_node) {
+        const auto &base_map = base_node.AsMap();
+        std::map<std::string, Json::Node> response_map;
+        try {
+            std::optional<size_t> count;
+            if (auto it = base_map.find("count"); it != base_map.end()) {
+                if (it->second.AsDouble() < 0) {
+                    throw std::invalid_argument("NearbyStops count must not be negative");
+                }
+                // capped at more stops than a network has, so that the cast is defined
+                const double max_count = std::numeric_limits<uint32_t>::max();
+                count = static_cast<size_t>(std::min(it->second.AsDouble(), max_count));
+            }
+            std::optional<double> radius;
+            if (auto it = base_map.find("radius"); it != base_map.end()) {
+                if (it->second.AsDouble() < 0) {
+                    throw std::invalid_argument("NearbyStops radius must not be negative");
+                }
+                radius = it->second.AsDouble();
+            }
+            if (!count && !radius) {
+                count = 1;
+            }
+            const auto response = tg.GetNearbyStops(Coordinates::Point{
+                    .latitude = base_map.at("latitude").AsDouble(),
+                    .longitude = base_map.at("longitude").AsDouble()
+            }, count, radius);
+
+            std::vector<Json::Node> stops;
+            stops.reserve(response.items.size());
+            for (const auto &[stop_name, distance]: response.items) {
+                std::map<std::string, Json::Node> stop_map;
+                stop_map["stop_name"] = std::string(stop_name);
+                stop_map["distance"] = distance;
+                stops.emplace_back(std::move(stop_map));
+            }
+            response_map["stops"] = std::move(stops);
+        } catch (const std::invalid_argument &error) {
+            response_map["error_message"] = std::string(error.what());
+        }
+        response_map["request_id"] = Json::Int(
+                static_cast<int64_t>(base_map.at("id").AsDouble()));
+        return Json::Node{std::move(response_map)};
+    }
+
+    Json::Node ProcessViewport(const TransportGuide &tg, const Json::Node &base_node) {
+        const auto &base_map = base_node.AsMap();
+        std::map<std::string, Json::Node> response_map;
+        response_map["map"] = tg.GetViewport(Render::Box{
+                .min_x = base_map.at("min_x").AsDouble(),
+                .min_y = base_map.at("min_y").AsDouble(),
+                .max_x = base_map.at("max_x").AsDouble(),
+                .max_y = base_map.at("max_y").AsDouble()
+        }).data;
+        response_map["request_id"] = Json::Int(
+                static_cast<int64_t>(base_map.at("id").AsDouble()));
+        return Json::Node{std::move(response_map)};
+    }
+
+    Json::Node ProcessTile(const TransportGuide &tg, const Json::Node &base_node) {
+        const auto &base_map = base_node.AsMap();
+        std::map<std::string, Json::Node> response_map;
+        const auto zoom = ReadUint32(base_map.at("zoom"));
+        const auto x = ReadUint32(base_map.at("x"));
+        const auto y = ReadUint32(base_map.at("y"));
+        if (!zoom || !x || !y) {
+            response_map["error_message"] = "Tile zoom, x and y must be non-negative integers below 2^32";
+        } else if (*zoom < 32 && *x < (1ull << *zoom) && *y < (1ull << *zoom)) {
+            response_map["map"] = tg.GetTile(*zoom, *x, *y).data;
+        } else {
+            response_map["error_message"] = "not found";
+        }
+        response_map["request_id"] = Json::Int(
+                static_cast<int64_t>(base_map.at("id").AsDouble()));
+        return Json::Node{std::move(response_map)};
+    }
+
+    Json::Node ProcessUpdate(VersionedGuide &guide, const Json::Node &base_node) {
+        const auto &base_map = base_node.AsMap();
+        std::map<std::string, Json::Node> response_map;
+        try {
+            const auto changes = base_map.find("changes");
+            if (changes == base_map.end()) {
+                throw std::invalid_argument("update has no changes");
+            }
+            guide.ApplyChanges(Descriptions::ReadChanges(changes->second));
+        } catch (const std::invalid_argument &error) {
+            response_map["error_message"] = std::string(error.what());
+        }
+        response_map["request_id"] = Json::Int(
+                static_cast<int64_t>(base_map.at("id").AsDouble()));
+        return Json::Node{std::move(response_map)};
+    }
+
+    Json::Node ProcessMetrics(const Json::Node &base_node) {
+        std::map<std::string, Json::Node> response_map;
+        response_map["metrics"] = Metrics::ToJson();
+        response_map["request_id"] = Json::Int(
+                static_cast<int64_t>(base_node.AsMap().at("id").AsDouble()));
+        return Json::Node{std::move(response_map)};
+    }
+
+    Json::Node ProcessAll(VersionedGuide &guide, const Json::Node &base_node, const Options &options) {
+        const auto &requests = base_node.AsArray();
+        std::vector<Json::Node> responses(requests.size());
+        auto version = guide.Pin();
+        // routes are batched up to the next update
+        size_t routes_end = 0;
+        for (size_t i = 0; i < requests.size(); ++i) {
+            const auto &tg = *version->guide;
+            if (i == routes_end) {
+                while (routes_end < requests.size()
+                       && requests[routes_end].AsMap().at("type").AsString() != "Update") {
+                    ++routes_end;
+                }
+                ProcessRoutes(tg, requests, i, routes_end, responses);
+                ++routes_end;
+            }
+            const auto &node = requests[i];
+            const auto &type = node.AsMap().at("type").AsString();
+            const auto request = Metrics::FindRequest(type);
+            // routes are traced by the group they are answered with
+            std::optional<Trace::Span> span;
+            if (request != Metrics::Request::Route && request != Metrics::Request::Count) {
+                span.emplace(Metrics::kRequestNames[static_cast<size_t>(request)]);
+            }
+            const auto start = std::chrono::steady_clock::now();
+            const uint64_t allocations = Metrics::GetThreadAllocations();
+            if (type == "Stop") {
+                responses[i] = ProcessStop(tg, node);
             } else if (type == "Bus") {
-                responses.emplace_back(ProcessBus(tg, node));
+                responses[i] = ProcessBus(tg, node);
+            } else if (type == "CommonBuses") {
+                responses[i] = ProcessCommonBuses(tg, node);
             } else if (type == "Route") {
-                responses.emplace_back(ProcessRoute(tg, node));
+                // answered by ProcessRoutes
+            } else if (type == "Isochrone") {
+                responses[i] = ProcessIsochrone(tg, node);
+            } else if (type == "Matrix") {
+                responses[i] = ProcessMatrix(tg, node);
             } else if (type == "Map") {
-                responses.emplace_back(ProcessMap(tg, node));
+                responses[i] = ProcessMap(tg, node);
+            } else if (type == "NearbyStops") {
+                responses[i] = ProcessNearbyStops(tg, node);
+            } else if (type == "Viewport") {
+                responses[i] = ProcessViewport(tg, node);
+            } else if (type == "Tile") {
+                responses[i] = ProcessTile(tg, node);
+            } else if (type == "Update" && options.read_only) {
+                responses[i] = Json::Node{std::map<std::string, Json::Node>{
+                        {"error_message", std::string("updates are disabled")},
+                        {"request_id", Json::Int(static_cast<int64_t>(node.AsMap().at("id").AsDouble()))}
+                }};
+            } else if (type == "Update") {
+                responses[i] = ProcessUpdate(guide, node);
+                version = guide.Pin();
+            } else if (type == "Metrics") {
+                responses[i] = ProcessMetrics(node);
             } else {
                 throw std::runtime_error("Unknown request type: " + std::string(type));
             }
+            if (request != Metrics::Request::Route) {
+                Metrics::RecordRequest(request, std::chrono::steady_clock::now() - start,
+                                       Metrics::GetThreadAllocations() - allocations);
+            }
+            if (options.tag_versions) {
+                std::get<std::map<std::string, Json::Node>>(responses[i])["version"] = Json::Int(
+                        static_cast<int64_t>(version->id));
+            }
+        }
+        return Json::Node{std::move(responses)};
+    }
+
+    Json::Node ProcessAll(GuideHost &host, const Json::Node &base_node, const Options &options) {
+        const auto &requests = base_node.AsArray();
+        // indices of the requests of each network
+        std::map<std::string, std::vector<size_t>> network_requests;
+        // Metrics requests, answered after all the rest
+        std::vector<size_t> metrics_requests;
+        for (size_t i = 0; i < requests.size(); ++i) {
+            const auto &request_map = requests[i].AsMap();
+            if (request_map.at("type").AsString() == "Metrics") {
+                metrics_requests.push_back(i);
+                continue;
+            }
+            const auto it = request_map.find("network");
+            network_requests[it != request_map.end() ? it->second.AsString() : std::string()].push_back(i);
+        }
+
+        std::vector<Json::Node> responses(requests.size());
+        for (const auto &[name, indices]: network_requests) {
+            const auto guide = host.Acquire(name);
+            if (!guide) {
+                for (const size_t i: indices) {
+                    responses[i] = Json::Node{std::map<std::string, Json::Node>{
+                            {"error_message", std::string("not found")},
+                            {"request_id", Json::Int(static_cast<int64_t>(requests[i].AsMap().at("id").AsDouble()))}
+                    }};
+                }
+                continue;
+            }
+            if (indices.size() == requests.size()) {
+                return ProcessAll(*guide, base_node, options);
+            }
+            std::vector<Json::Node> network_batch;
+            network_batch.reserve(indices.size());
+            for (const size_t i: indices) {
+                network_batch.push_back(requests[i]);
+            }
+            auto network_responses = ProcessAll(*guide, Json::Node{std::move(network_batch)}, options);
+            auto &network_responses_array = std::get<std::vector<Json::Node>>(network_responses);
+            for (size_t j = 0; j < indices.size(); ++j) {
+                responses[indices[j]] = std::move(network_responses_array[j]);
+            }
+        }
+        for (const size_t i: metrics_requests) {
+            responses[i] = ProcessMetrics(requests[i]);
         }
         return Json::Node{std::move(responses)};
     }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "transport_guide.h"
+#include "versioned_guide.h"
+#include "guide_host.h"
 #include "json.h"
 
 #include <iostream>
@@ -13,10 +15,48 @@ namespace Requests {
 
     Json::Node ProcessBus(const TransportGuide &, const Json::Node &);
 
+    Json::Node ProcessCommonBuses(const TransportGuide &, const Json::Node &);
+
     Json::Node ProcessRoute(const TransportGuide &, const Json::Node &);
 
+    Json::Node ProcessIsochrone(const TransportGuide &, const Json::Node &);
+
+    Json::Node ProcessMatrix(const TransportGuide &, const Json::Node &);
+
     Json::Node ProcessMap(const TransportGuide &, const Json::Node &);
 
-    Json::Node ProcessAll(const TransportGuide &, const Json::Node &);
+    Json::Node ProcessNearbyStops(const TransportGuide &, const Json::Node &);
+
+    Json::Node ProcessViewport(const TransportGuide &, const Json::Node &);
+
+    Json::Node ProcessTile(const TransportGuide &, const Json::Node &);
+
+    // Answers the Route requests among [begin, end) of a batch into their slots of `responses`:
+    // requests are grouped by origin and answered from one search each, and repeated requests
+    // are answered once.
+    void ProcessRoutes(const TransportGuide &, const std::vector<Json::Node> &requests,
+                       size_t begin, size_t end, std::vector<Json::Node> &responses);
+
+    // the metrics of the process so far, see Metrics::ToJson
+    Json::Node ProcessMetrics(const Json::Node &);
+
+    // applies the "changes" of the request as a new version, see Descriptions::ReadChanges
+    Json::Node ProcessUpdate(VersionedGuide &, const Json::Node &);
+
+    struct Options {
+        // every response gets the "version" it was answered from
+        bool tag_versions = false;
+        // Update requests are refused, e.g. in workers that each hold a copy of the network
+        bool read_only = false;
+    };
+
+    // Requests after an Update see the updated network: each run of requests between updates is
+    // answered from one pinned version.
+    Json::Node ProcessAll(VersionedGuide &, const Json::Node &, const Options &options = {});
+
+    // Requests go to the hosted network of their "network" key, "" if there is none, and are
+    // answered in order within each network; those of unknown networks are "not found". Metrics
+    // requests are answered last.
+    Json::Node ProcessAll(GuideHost &, const Json::Node &, const Options &options = {});
 
 }
@@ -1,14 +1,22 @@
 #pragma once
 
-#include <set>
+#include <cstdint>
+#include <variant>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <optional>
 
 namespace Response {
 
     struct Stop {
-        std::set<std::string> busses;
+        // sorted bus names, viewing keys of the database bus dictionary
+        std::vector<std::string_view> busses;
+    };
+
+    struct CommonBuses {
+        // sorted bus names serving both stops, viewing keys of the database bus dictionary
+        std::vector<std::string_view> buses;
     };
 
     struct Bus {
@@ -18,6 +26,37 @@ namespace Response {
         double curvature;
     };
 
+    struct NearbyStops {
+        struct Item {
+            std::string_view stop_name;
+            double distance;
+        };
+
+        // nearest first
+        std::vector<Item> items;
+    };
+
+    struct ReachableStops {
+        struct Item {
+            std::string_view stop_name;
+            double time;
+        };
+
+        // quickest first, the origin included
+        std::vector<Item> items;
+    };
+
+    struct Matrix {
+        struct Cell {
+            double time;
+            // buses changed on the way, 0 for a single ride
+            int64_t transfers;
+        };
+
+        // row-major, origins by destinations; nullopt where there is no route
+        std::vector<std::optional<Cell>> cells;
+    };
+
     struct Map {
         std::string data;
     };
@@ -41,6 +80,9 @@ namespace Response {
         using RouteItems = std::vector<std::variant<Wait, Bus>>;
         RouteItems items;
         double total_time;
-        Map map;
+        // absent when no map was asked for
+        std::optional<Map> map;
+        // with an overlay-only map: hash of the base map the overlay goes over
+        std::optional<uint64_t> base_map_hash;
     };
 }
\ No newline at end of file
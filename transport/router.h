@@ -1,12 +1,18 @@
 #pragma once
 
 #include "graph.h"
+#include "parallel.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <functional>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <queue>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -17,9 +23,50 @@ namespace Graph {
     class Router {
     private:
         using Graph = DirectedWeightedGraph<Weight>;
+        static_assert(std::numeric_limits<Weight>::has_infinity, "missing routes are of infinite weight");
 
     public:
-        Router(const Graph &graph);
+        enum class Mode {
+            // Floyd–Warshall table of every route, built in the constructor
+            AllPairs,
+            // Dijkstra from the source on every query, nothing precomputed
+            OnDemand
+        };
+
+        static constexpr EdgeId kNoEdge = std::numeric_limits<EdgeId>::max();
+
+        // A route as the table keeps it: its weight and its last edge, kNoEdge for the empty route.
+        // Snapshots save the table as an array of these, so the layout is part of their format.
+        struct RouteEntry {
+            Weight weight = std::numeric_limits<Weight>::infinity();
+            EdgeId prev_edge = kNoEdge;
+
+            bool Exists() const {
+                return weight != std::numeric_limits<Weight>::infinity();
+            }
+        };
+
+        // a table kept outside the router, e.g. in a mapped snapshot; `owner` keeps `routes` alive
+        struct TableView {
+            std::shared_ptr<const void> owner;
+            const RouteEntry *routes;
+        };
+
+        Router(const Graph &graph, Mode mode = Mode::AllPairs);
+
+        // Answers from `table`, which must have been built for this very graph, without copying it;
+        // the first Update does.
+        Router(const Graph &graph, TableView table);
+
+        // the table in row-major order, the vertex count squared entries; nullptr in OnDemand mode
+        const RouteEntry *GetTable() const {
+            return table_routes_;
+        }
+
+        // bytes of the table held by the router itself; a mapped table lives in the page cache
+        size_t GetTableMemory() const {
+            return table_.capacity() * sizeof(RouteEntry);
+        }
 
         using RouteId = uint64_t;
 
@@ -33,44 +80,99 @@ namespace Graph {
 
         EdgeId GetRouteEdge(RouteId route_id, size_t edge_idx) const;
 
-        void ReleaseRoute(RouteId route_id);
+        // expanded routes are kept until released; safe to call from several threads
+        void ReleaseRoute(RouteId route_id) const;
+
+        // Keeps the table valid after the graph was rebuilt with more vertices, more edges or lighter
+        // ones: `edge_ids` maps every old edge id to its new one, `lighter_edges` lists the edges that
+        // are new or got lighter. Each of them is relaxed through all pairs, in O(V^2).
+        void Update(const std::vector<EdgeId> &edge_ids, const std::vector<EdgeId> &lighter_edges);
+
+        struct Reachable {
+            VertexId vertex;
+            Weight weight;
+        };
+
+        // vertices reachable from `from` with weight up to `max_weight`, the source included, lightest first
+        std::vector<Reachable> FindReachable(VertexId from, Weight max_weight) const;
+
+        struct RouteSummary {
+            Weight weight;
+            size_t edge_count;
+        };
+
+        // routes from every source to every target, row-major; nullopt where there is none.
+        // Without the table it takes one search per distinct source, run concurrently.
+        std::vector<std::optional<RouteSummary>> BuildMatrix(const std::vector<VertexId> &sources,
+                                                             const std::vector<VertexId> &targets) const;
 
     private:
         const Graph &graph_;
+        Mode mode_;
 
-        struct RouteInternalData {
-            Weight weight;
-            std::optional<EdgeId> prev_edge;
+        using RouteRow = std::vector<RouteEntry>;
+
+    public:
+        // routes from one source, to answer several queries from it with a single search
+        struct SourceRoutes {
+            VertexId from;
+            // the search result; empty with the table, which already holds the row
+            RouteRow searched;
         };
-        using RoutesInternalData = std::vector<std::vector<std::optional<RouteInternalData>>>;
+
+        // the search stops once all `targets` are settled; only routes to them may be built
+        SourceRoutes BuildSourceRoutes(VertexId from, const std::vector<VertexId> &targets) const;
+
+        std::optional<RouteInfo> BuildRoute(const SourceRoutes &routes, VertexId to) const;
+
+    private:
+
+        // Dijkstra from `from`, stopped once all `targets` are settled (if any are given) or the weight
+        // exceeds `max_weight`; settled vertices get the same entries the table row would have
+        RouteRow SearchRoutes(VertexId from, const std::vector<VertexId> &targets,
+                              std::optional<Weight> max_weight) const;
+
+        // the row of the table or of a search to use for routes from `from`
+        const RouteEntry *GetRoutes(VertexId from, const RouteRow &searched) const {
+            return mode_ == Mode::OnDemand ? searched.data() : table_routes_ + from * table_size_;
+        }
+
+        static size_t CountRouteEdges(const Graph &graph, const RouteEntry *routes, VertexId to);
+
+        std::optional<RouteInfo> ExpandRoute(const RouteEntry *routes, VertexId to) const;
 
         using ExpandedRoute = std::vector<EdgeId>;
+        // the cache is shared by concurrent queries
+        mutable std::mutex expanded_routes_mutex_;
         mutable RouteId next_route_id_ = 0;
         mutable std::unordered_map<RouteId, ExpandedRoute> expanded_routes_cache_;
 
+        RouteEntry *GetTableRow(VertexId from) {
+            return table_.data() + from * table_size_;
+        }
+
         void InitializeRoutesInternalData(const Graph &graph) {
             const size_t vertex_count = graph.GetVertexCount();
             for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
-                routes_internal_data_[vertex][vertex] = RouteInternalData{0, std::nullopt};
+                RouteEntry *routes = GetTableRow(vertex);
+                routes[vertex] = RouteEntry{0, kNoEdge};
                 for (const EdgeId edge_id: graph.GetIncidentEdges(vertex)) {
                     const auto &edge = graph.GetEdge(edge_id);
                     assert(edge.weight >= 0);
-                    auto &route_internal_data = routes_internal_data_[vertex][edge.to];
-                    if (!route_internal_data || route_internal_data->weight > edge.weight) {
-                        route_internal_data = RouteInternalData{edge.weight, edge_id};
+                    auto &route_internal_data = routes[edge.to];
+                    if (!route_internal_data.Exists() || route_internal_data.weight > edge.weight) {
+                        route_internal_data = RouteEntry{edge.weight, edge_id};
                     }
                 }
             }
         }
 
-        void RelaxRoute(VertexId vertex_from, VertexId vertex_to,
-                        const RouteInternalData &route_from, const RouteInternalData &route_to) {
-            auto &route_relaxing = routes_internal_data_[vertex_from][vertex_to];
+        static void RelaxRoute(RouteEntry &route_relaxing, const RouteEntry &route_from, const RouteEntry &route_to) {
             const Weight candidate_weight = route_from.weight + route_to.weight;
-            if (!route_relaxing || candidate_weight < route_relaxing->weight) {
+            if (!route_relaxing.Exists() || candidate_weight < route_relaxing.weight) {
                 route_relaxing = {
                         candidate_weight,
-                        route_to.prev_edge
+                        route_to.prev_edge != kNoEdge
                         ? route_to.prev_edge
                         : route_from.prev_edge
                 };
@@ -78,63 +180,286 @@ namespace Graph {
         }
 
         void RelaxRoutesInternalDataThroughVertex(size_t vertex_count, VertexId vertex_through) {
+            const RouteEntry *routes_through = GetTableRow(vertex_through);
             for (VertexId vertex_from = 0; vertex_from < vertex_count; ++vertex_from) {
-                if (const auto &route_from = routes_internal_data_[vertex_from][vertex_through]) {
+                RouteEntry *routes_from = GetTableRow(vertex_from);
+                if (const auto &route_from = routes_from[vertex_through]; route_from.Exists()) {
                     for (VertexId vertex_to = 0; vertex_to < vertex_count; ++vertex_to) {
-                        if (const auto &route_to = routes_internal_data_[vertex_through][vertex_to]) {
-                            RelaxRoute(vertex_from, vertex_to, *route_from, *route_to);
+                        if (const auto &route_to = routes_through[vertex_to]; route_to.Exists()) {
+                            RelaxRoute(routes_from[vertex_to], route_from, route_to);
                         }
                     }
                 }
             }
         }
 
-        RoutesInternalData routes_internal_data_;
+        // table_size_ squared entries, row by row; table_routes_ points either into table_ or into
+        // the memory held by table_owner_
+        size_t table_size_ = 0;
+        std::vector<RouteEntry> table_;
+        std::shared_ptr<const void> table_owner_;
+        const RouteEntry *table_routes_ = nullptr;
     };
 
 
     template<typename Weight>
-    Router<Weight>::Router(const Graph &graph)
-            : graph_(graph),
-              routes_internal_data_(graph.GetVertexCount(),
-                                    std::vector<std::optional<RouteInternalData>>(graph.GetVertexCount())) {
+    Router<Weight>::Router(const Graph &graph, Mode mode)
+            : graph_(graph), mode_(mode) {
+        if (mode_ == Mode::OnDemand) {
+            return;
+        }
+        const size_t vertex_count = graph.GetVertexCount();
+        table_size_ = vertex_count;
+        table_.assign(vertex_count * vertex_count, RouteEntry{});
+        table_routes_ = table_.data();
         InitializeRoutesInternalData(graph);
 
-        const size_t vertex_count = graph.GetVertexCount();
         for (VertexId vertex_through = 0; vertex_through < vertex_count; ++vertex_through) {
             RelaxRoutesInternalDataThroughVertex(vertex_count, vertex_through);
         }
     }
 
+    template<typename Weight>
+    Router<Weight>::Router(const Graph &graph, TableView table)
+            : graph_(graph), mode_(Mode::AllPairs), table_size_(graph.GetVertexCount()),
+              table_owner_(std::move(table.owner)), table_routes_(table.routes) {
+    }
+
+    template<typename Weight>
+    typename Router<Weight>::RouteRow Router<Weight>::SearchRoutes(
+            VertexId from, const std::vector<VertexId> &targets, std::optional<Weight> max_weight) const {
+        RouteRow routes(graph_.GetVertexCount());
+        std::vector<bool> settled(graph_.GetVertexCount());
+        std::vector<bool> is_target(graph_.GetVertexCount());
+        size_t targets_left = 0;
+        for (const VertexId target: targets) {
+            if (!is_target[target]) {
+                is_target[target] = true;
+                ++targets_left;
+            }
+        }
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+        routes[from] = RouteEntry{0, kNoEdge};
+        queue.emplace(0, from);
+        while (!queue.empty()) {
+            const auto [weight, vertex] = queue.top();
+            queue.pop();
+            if (settled[vertex]) {
+                continue;
+            }
+            if (max_weight && weight > *max_weight) {
+                break;
+            }
+            settled[vertex] = true;
+            if (is_target[vertex] && --targets_left == 0) {
+                break;
+            }
+            for (const EdgeId edge_id: graph_.GetIncidentEdges(vertex)) {
+                const auto &edge = graph_.GetEdge(edge_id);
+                assert(edge.weight >= 0);
+                auto &route = routes[edge.to];
+                if (!settled[edge.to] && (!route.Exists() || weight + edge.weight < route.weight)) {
+                    route = RouteEntry{weight + edge.weight, edge_id};
+                    queue.emplace(route.weight, edge.to);
+                }
+            }
+        }
+        // tentative entries past the stop are not final
+        for (VertexId vertex = 0; vertex < routes.size(); ++vertex) {
+            if (!settled[vertex]) {
+                routes[vertex] = RouteEntry{};
+            }
+        }
+        return routes;
+    }
+
     template<typename Weight>
     std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexId from, VertexId to) const {
-        const auto &route_internal_data = routes_internal_data_[from][to];
-        if (!route_internal_data) {
+        if (mode_ == Mode::OnDemand) {
+            return ExpandRoute(SearchRoutes(from, {to}, std::nullopt).data(), to);
+        }
+        return ExpandRoute(GetRoutes(from, {}), to);
+    }
+
+    template<typename Weight>
+    typename Router<Weight>::SourceRoutes Router<Weight>::BuildSourceRoutes(
+            VertexId from, const std::vector<VertexId> &targets) const {
+        if (mode_ == Mode::OnDemand) {
+            return {from, SearchRoutes(from, targets, std::nullopt)};
+        }
+        return {from, {}};
+    }
+
+    template<typename Weight>
+    std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(
+            const SourceRoutes &routes, VertexId to) const {
+        return ExpandRoute(GetRoutes(routes.from, routes.searched), to);
+    }
+
+    template<typename Weight>
+    std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::ExpandRoute(
+            const RouteEntry *routes, VertexId to) const {
+        const auto &route_internal_data = routes[to];
+        if (!route_internal_data.Exists()) {
             return std::nullopt;
         }
-        const Weight weight = route_internal_data->weight;
+        const Weight weight = route_internal_data.weight;
         std::vector<EdgeId> edges;
-        for (std::optional<EdgeId> edge_id = route_internal_data->prev_edge;
-             edge_id;
-             edge_id = routes_internal_data_[from][graph_.GetEdge(*edge_id).from]->prev_edge) {
-            edges.push_back(*edge_id);
+        for (EdgeId edge_id = route_internal_data.prev_edge;
+             edge_id != kNoEdge;
+             edge_id = routes[graph_.GetEdge(edge_id).from].prev_edge) {
+            edges.push_back(edge_id);
         }
         std::reverse(std::begin(edges), std::end(edges));
 
-        const RouteId route_id = next_route_id_++;
         const size_t route_edge_count = edges.size();
+        std::lock_guard lock(expanded_routes_mutex_);
+        const RouteId route_id = next_route_id_++;
         expanded_routes_cache_[route_id] = std::move(edges);
         return RouteInfo{route_id, weight, route_edge_count};
     }
 
+    template<typename Weight>
+    std::vector<typename Router<Weight>::Reachable> Router<Weight>::FindReachable(
+            VertexId from, Weight max_weight) const {
+        const RouteRow search_routes = mode_ == Mode::OnDemand
+                                       ? SearchRoutes(from, {}, max_weight)
+                                       : RouteRow{};
+        const RouteEntry *routes = GetRoutes(from, search_routes);
+        std::vector<Reachable> reachable;
+        for (VertexId vertex = 0; vertex < graph_.GetVertexCount(); ++vertex) {
+            if (routes[vertex].Exists() && routes[vertex].weight <= max_weight) {
+                reachable.push_back({vertex, routes[vertex].weight});
+            }
+        }
+        std::stable_sort(reachable.begin(), reachable.end(), [](const Reachable &lhs, const Reachable &rhs) {
+            return lhs.weight < rhs.weight;
+        });
+        return reachable;
+    }
+
+    template<typename Weight>
+    void Router<Weight>::Update(const std::vector<EdgeId> &edge_ids, const std::vector<EdgeId> &lighter_edges) {
+        expanded_routes_cache_.clear();
+        if (mode_ == Mode::OnDemand) {
+            return;
+        }
+        // the rows are copied into a table of the new size, which also takes over a table held elsewhere
+        const size_t vertex_count = graph_.GetVertexCount();
+        std::vector<RouteEntry> table(vertex_count * vertex_count);
+        for (VertexId vertex_from = 0; vertex_from < table_size_; ++vertex_from) {
+            const RouteEntry *old_routes = table_routes_ + vertex_from * table_size_;
+            RouteEntry *routes = table.data() + vertex_from * vertex_count;
+            for (VertexId vertex_to = 0; vertex_to < table_size_; ++vertex_to) {
+                routes[vertex_to] = old_routes[vertex_to];
+                if (routes[vertex_to].prev_edge != kNoEdge) {
+                    routes[vertex_to].prev_edge = edge_ids[routes[vertex_to].prev_edge];
+                }
+            }
+        }
+        for (VertexId vertex = table_size_; vertex < vertex_count; ++vertex) {
+            table[vertex * vertex_count + vertex] = RouteEntry{0, kNoEdge};
+        }
+        table_size_ = vertex_count;
+        table_ = std::move(table);
+        table_owner_.reset();
+        table_routes_ = table_.data();
+
+        // with non-negative weights, no route to the edge start or from the edge end improves
+        // through the edge itself, so the rows can be updated in place
+        for (const EdgeId edge_id: lighter_edges) {
+            const auto &edge = graph_.GetEdge(edge_id);
+            assert(edge.weight >= 0);
+            const RouteEntry *routes_from_edge = GetTableRow(edge.to);
+            for (VertexId vertex_from = 0; vertex_from < vertex_count; ++vertex_from) {
+                RouteEntry *routes = GetTableRow(vertex_from);
+                const auto &route_to_edge = routes[edge.from];
+                if (!route_to_edge.Exists()) {
+                    continue;
+                }
+                const Weight weight_through_edge = route_to_edge.weight + edge.weight;
+                for (VertexId vertex_to = 0; vertex_to < vertex_count; ++vertex_to) {
+                    const auto &route_from_edge = routes_from_edge[vertex_to];
+                    if (!route_from_edge.Exists()) {
+                        continue;
+                    }
+                    auto &route = routes[vertex_to];
+                    const Weight candidate_weight = weight_through_edge + route_from_edge.weight;
+                    if (!route.Exists() || candidate_weight < route.weight) {
+                        route = RouteEntry{
+                                candidate_weight,
+                                route_from_edge.prev_edge != kNoEdge ? route_from_edge.prev_edge : edge_id
+                        };
+                    }
+                }
+            }
+        }
+    }
+
     template<typename Weight>
     EdgeId Router<Weight>::GetRouteEdge(RouteId route_id, size_t edge_idx) const {
+        std::lock_guard lock(expanded_routes_mutex_);
         return expanded_routes_cache_.at(route_id)[edge_idx];
     }
 
     template<typename Weight>
-    void Router<Weight>::ReleaseRoute(RouteId route_id) {
+    void Router<Weight>::ReleaseRoute(RouteId route_id) const {
+        std::lock_guard lock(expanded_routes_mutex_);
         expanded_routes_cache_.erase(route_id);
     }
 
-}
\ No newline at end of file
+    template<typename Weight>
+    size_t Router<Weight>::CountRouteEdges(const Graph &graph, const RouteEntry *routes, VertexId to) {
+        size_t edge_count = 0;
+        for (EdgeId edge_id = routes[to].prev_edge;
+             edge_id != kNoEdge;
+             edge_id = routes[graph.GetEdge(edge_id).from].prev_edge) {
+            ++edge_count;
+        }
+        return edge_count;
+    }
+
+    template<typename Weight>
+    std::vector<std::optional<typename Router<Weight>::RouteSummary>> Router<Weight>::BuildMatrix(
+            const std::vector<VertexId> &sources, const std::vector<VertexId> &targets) const {
+        std::vector<std::optional<RouteSummary>> matrix(sources.size() * targets.size());
+        if (matrix.empty()) {
+            // a search with no targets would settle every vertex
+            return matrix;
+        }
+        // rows grouped by source, each group filled by one task from one search
+        std::vector<size_t> rows(sources.size());
+        for (size_t row = 0; row < rows.size(); ++row) {
+            rows[row] = row;
+        }
+        std::stable_sort(rows.begin(), rows.end(), [&](size_t lhs, size_t rhs) {
+            return sources[lhs] < sources[rhs];
+        });
+        std::vector<size_t> group_begins;
+        for (size_t i = 0; i < rows.size(); ++i) {
+            if (i == 0 || sources[rows[i]] != sources[rows[i - 1]]) {
+                group_begins.push_back(i);
+            }
+        }
+        group_begins.push_back(rows.size());
+
+        ParallelFor(group_begins.size() - 1, [&](size_t group) {
+            const VertexId source = sources[rows[group_begins[group]]];
+            const RouteRow search_routes = mode_ == Mode::OnDemand
+                                           ? SearchRoutes(source, targets, std::nullopt)
+                                           : RouteRow{};
+            const RouteEntry *routes = GetRoutes(source, search_routes);
+            for (size_t i = group_begins[group]; i < group_begins[group + 1]; ++i) {
+                for (size_t column = 0; column < targets.size(); ++column) {
+                    if (const auto &route = routes[targets[column]]; route.Exists()) {
+                        matrix[rows[i] * targets.size() + column] =
+                                RouteSummary{route.weight, CountRouteEdges(graph_, routes, targets[column])};
+                    }
+                }
+            }
+        });
+        return matrix;
+    }
+
+}
@@ -0,0 +1,410 @@
+#include "server.h"
+#include "metrics.h"
+#include "request.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <iomanip>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace Server {
+
+    Settings ReadSettings(const Json::Node &base_node) {
+        const auto &base_map = base_node.AsMap();
+        Settings settings{.socket_path = base_map.at("socket").AsString()};
+        if (auto it = base_map.find("workers"); it != base_map.end()) {
+            const auto worker_count = static_cast<int64_t>(it->second.AsDouble());
+            if (worker_count < 1) {
+                throw std::runtime_error("Server needs at least one worker");
+            }
+            settings.worker_count = worker_count;
+        }
+        if (auto it = base_map.find("timeout_ms"); it != base_map.end()) {
+            const auto timeout_ms = static_cast<int64_t>(it->second.AsDouble());
+            if (timeout_ms < 1) {
+                throw std::runtime_error("Server timeout must be positive");
+            }
+            settings.timeout_ms = timeout_ms;
+        }
+        if (auto it = base_map.find("max_request_mb"); it != base_map.end()) {
+            const double max_request_mb = it->second.AsDouble();
+            if (max_request_mb <= 0) {
+                throw std::runtime_error("Server request size limit must be positive");
+            }
+            settings.max_request_bytes = static_cast<size_t>(max_request_mb * (1 << 20));
+        }
+        return settings;
+    }
+
+    namespace {
+
+        // a worker's stats, in memory shared with the supervisor; they outlive the worker process
+        struct WorkerSlot {
+            std::atomic<int64_t> pid;
+            std::atomic<uint64_t> restarts;
+            std::atomic<uint64_t> batches;
+            std::atomic<uint64_t> total_ns;
+            std::atomic<uint64_t> max_ns;
+        };
+
+        static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<int64_t>::is_always_lock_free,
+                      "stats are shared between processes");
+
+        // workers that got SIGINT or SIGTERM finish the connection at hand, then exit
+        volatile std::sig_atomic_t stop_requested = 0;
+
+        void RequestStop(int) {
+            stop_requested = 1;
+        }
+
+        std::runtime_error MakeError(const std::string &what) {
+            return std::runtime_error(what + ": " + std::strerror(errno));
+        }
+
+        int Listen(const std::string &socket_path) {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (socket_path.size() >= sizeof(address.sun_path)) {
+                throw std::runtime_error("Socket path is too long: " + socket_path);
+            }
+            std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+            // non-blocking, so a worker woken with the others for a connection that one of them took
+            // goes back to waiting instead of hanging in accept4
+            const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+            if (fd < 0) {
+                throw MakeError("cannot create socket");
+            }
+            // a socket file left by a server that did not stop cleanly
+            unlink(socket_path.c_str());
+            if (bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0
+                || listen(fd, SOMAXCONN) != 0) {
+                const auto error = MakeError("cannot listen on " + socket_path);
+                close(fd);
+                throw error;
+            }
+            return fd;
+        }
+
+        using Clock = std::chrono::steady_clock;
+
+        timespec ToTimespec(Clock::duration duration) {
+            const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+            return {.tv_sec = static_cast<time_t>(nanoseconds / 1000000000),
+                    .tv_nsec = static_cast<long>(nanoseconds % 1000000000)};
+        }
+
+        // a connection the worker gives up on, with the reason sent back if the client still listens
+        struct ConnectionError {
+            std::string reason;
+        };
+
+        // waits until `fd` is ready for `events`; throws ConnectionError past the deadline
+        void WaitFor(int fd, short events, Clock::time_point deadline) {
+            for (;;) {
+                const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+                if (left.count() <= 0) {
+                    throw ConnectionError{"request timed out"};
+                }
+                pollfd poll_fd{.fd = fd, .events = events, .revents = 0};
+                const int ready = poll(&poll_fd, 1, static_cast<int>(std::min<int64_t>(left.count(), INT_MAX)));
+                if (ready > 0) {
+                    return;
+                }
+                if (ready < 0 && errno != EINTR) {
+                    throw ConnectionError{"connection failed"};
+                }
+            }
+        }
+
+        std::string ReadAll(int fd, Clock::time_point deadline, size_t max_size) {
+            std::string data;
+            char buffer[1 << 16];
+            for (;;) {
+                WaitFor(fd, POLLIN, deadline);
+                const ssize_t count = read(fd, buffer, sizeof(buffer));
+                if (count > 0) {
+                    if (data.size() + count > max_size) {
+                        throw ConnectionError{"request too large"};
+                    }
+                    data.append(buffer, count);
+                } else if (count == 0) {
+                    return data;
+                } else if (errno != EINTR && errno != EAGAIN) {
+                    throw ConnectionError{"connection failed"};
+                }
+            }
+        }
+
+        void WriteAll(int fd, std::string_view data, Clock::time_point deadline) {
+            while (!data.empty()) {
+                WaitFor(fd, POLLOUT, deadline);
+                // a client gone early must not kill the worker with SIGPIPE
+                const ssize_t count = send(fd, data.data(), data.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (count > 0) {
+                    data.remove_prefix(count);
+                } else if (count < 0 && errno != EINTR && errno != EAGAIN) {
+                    return;
+                }
+            }
+        }
+
+        std::string ErrorAnswer(const std::string &message) {
+            std::ostringstream out;
+            Json::Print(out, Json::Node{std::map<std::string, Json::Node>{
+                    {"error_message", message}
+            }});
+            return out.str();
+        }
+
+        std::string Answer(GuideHost &host, const std::string &request) {
+            std::ostringstream out;
+            try {
+                std::istringstream in(request);
+                const auto document = Json::Load(in);
+                const auto responses = Requests::ProcessAll(host, document.GetRoot(), {.read_only = true});
+                Metrics::PhaseTimer timer(Metrics::Phase::JsonEncoding);
+                Json::Print(out, responses);
+            } catch (const std::exception &error) {
+                return ErrorAnswer(error.what());
+            }
+            return out.str();
+        }
+
+        void Serve(int fd, GuideHost &host, const Settings &settings) {
+            const auto timeout = std::chrono::milliseconds(settings.timeout_ms);
+            std::string answer;
+            try {
+                answer = Answer(host, ReadAll(fd, Clock::now() + timeout, settings.max_request_bytes));
+            } catch (const ConnectionError &error) {
+                answer = ErrorAnswer(error.reason);
+            }
+            try {
+                WriteAll(fd, answer, Clock::now() + timeout);
+            } catch (const ConnectionError &) {
+                // the client stopped reading, the rest of the answer is dropped with the connection
+            }
+        }
+
+        // SIGINT and SIGTERM are blocked but while waiting for a connection under `wait_mask`, so a stop
+        // requested after the check interrupts the wait, and one during a connection waits for its end
+        [[noreturn]] void ServeConnections(int listen_fd, GuideHost &host, const Settings &settings,
+                                           WorkerSlot &slot, const sigset_t &wait_mask) {
+            while (!stop_requested) {
+                pollfd listen_poll{.fd = listen_fd, .events = POLLIN, .revents = 0};
+                if (ppoll(&listen_poll, 1, nullptr, &wait_mask) < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    _exit(1);
+                }
+                const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED) {
+                        continue;
+                    }
+                    _exit(1);
+                }
+                const auto start = Clock::now();
+                Serve(fd, host, settings);
+                close(fd);
+                const uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        Clock::now() - start).count();
+
+                slot.batches.fetch_add(1, std::memory_order_relaxed);
+                slot.total_ns.fetch_add(elapsed_ns, std::memory_order_relaxed);
+                uint64_t max_ns = slot.max_ns.load(std::memory_order_relaxed);
+                while (elapsed_ns > max_ns && !slot.max_ns.compare_exchange_weak(max_ns, elapsed_ns,
+                                                                                  std::memory_order_relaxed)) {
+                }
+            }
+            // leaves the shared pages of the networks alone instead of destroying them
+            _exit(0);
+        }
+
+        pid_t StartWorker(int listen_fd, GuideHost &host, const Settings &settings, WorkerSlot &slot,
+                          const sigset_t &worker_mask) {
+            const pid_t pid = fork();
+            if (pid < 0) {
+                throw MakeError("cannot fork");
+            }
+            if (pid > 0) {
+                slot.pid.store(pid, std::memory_order_relaxed);
+                return pid;
+            }
+            struct sigaction action{};
+            action.sa_handler = RequestStop;
+            sigaction(SIGINT, &action, nullptr);
+            sigaction(SIGTERM, &action, nullptr);
+            std::signal(SIGUSR1, SIG_IGN);
+            sigset_t serve_mask = worker_mask, wait_mask = worker_mask;
+            for (const int signal: {SIGINT, SIGTERM}) {
+                sigaddset(&serve_mask, signal);
+                sigdelset(&wait_mask, signal);
+            }
+            sigprocmask(SIG_SETMASK, &serve_mask, nullptr);
+            ServeConnections(listen_fd, host, settings, slot, wait_mask);
+        }
+
+        void PrintStats(std::ostream &log, const WorkerSlot *slots, size_t worker_count) {
+            auto print = [&log](uint64_t batches, uint64_t total_ns, uint64_t max_ns) {
+                log << batches << " batches, mean " << std::fixed << std::setprecision(3)
+                    << (batches ? total_ns / 1e6 / batches : 0.0) << " ms, max " << max_ns / 1e6 << " ms";
+            };
+            uint64_t batches = 0, total_ns = 0, max_ns = 0;
+            for (size_t i = 0; i < worker_count; ++i) {
+                const auto &slot = slots[i];
+                log << "worker " << i << " (pid " << slot.pid.load() << ", " << slot.restarts.load()
+                    << " restarts): ";
+                print(slot.batches.load(), slot.total_ns.load(), slot.max_ns.load());
+                log << '\n';
+                batches += slot.batches.load();
+                total_ns += slot.total_ns.load();
+                max_ns = std::max<uint64_t>(max_ns, slot.max_ns.load());
+            }
+            log << "all workers: ";
+            print(batches, total_ns, max_ns);
+            log << std::endl;
+        }
+
+    }
+
+    void Run(GuideHost &host, const Settings &settings, std::ostream &log) {
+        // built, spilled and snapshotted once here, so workers only share the result
+        host.LoadAll();
+        const int listen_fd = Listen(settings.socket_path);
+
+        const size_t slots_size = sizeof(WorkerSlot) * settings.worker_count;
+        void *slots_memory = mmap(nullptr, slots_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (slots_memory == MAP_FAILED) {
+            close(listen_fd);
+            throw MakeError("cannot map worker stats");
+        }
+        auto *slots = static_cast<WorkerSlot *>(slots_memory);
+        for (size_t i = 0; i < settings.worker_count; ++i) {
+            new(slots + i) WorkerSlot{};
+        }
+
+        // signals are taken with sigwaitinfo or sigtimedwait, so none slips in between checks; workers get
+        // the old mask
+        sigset_t signals, worker_mask;
+        sigemptyset(&signals);
+        for (const int signal: {SIGINT, SIGTERM, SIGUSR1, SIGCHLD}) {
+            sigaddset(&signals, signal);
+        }
+        sigprocmask(SIG_BLOCK, &signals, &worker_mask);
+
+        std::vector<Clock::time_point> start_times(settings.worker_count, Clock::now());
+        // workers that keep failing at once are forked again no earlier than this, not in a busy loop
+        std::vector<std::optional<Clock::time_point>> restart_times(settings.worker_count);
+        for (size_t i = 0; i < settings.worker_count; ++i) {
+            StartWorker(listen_fd, host, settings, slots[i], worker_mask);
+        }
+        log << "serving on " << settings.socket_path << " with " << settings.worker_count << " workers" << std::endl;
+
+        for (bool running = true; running;) {
+            std::optional<Clock::time_point> next_restart;
+            for (const auto &restart_time: restart_times) {
+                if (restart_time && (!next_restart || *restart_time < *next_restart)) {
+                    next_restart = restart_time;
+                }
+            }
+            int signal;
+            if (next_restart) {
+                const auto timeout = ToTimespec(std::max(*next_restart - Clock::now(), Clock::duration::zero()));
+                signal = sigtimedwait(&signals, nullptr, &timeout);
+            } else {
+                signal = sigwaitinfo(&signals, nullptr);
+            }
+
+            if (signal == SIGINT || signal == SIGTERM) {
+                running = false;
+            } else if (signal == SIGUSR1) {
+                PrintStats(log, slots, settings.worker_count);
+            } else if (signal == SIGCHLD) {
+                int status;
+                for (pid_t pid; (pid = waitpid(-1, &status, WNOHANG)) > 0;) {
+                    for (size_t i = 0; i < settings.worker_count; ++i) {
+                        if (slots[i].pid.load() != pid) {
+                            continue;
+                        }
+                        log << "worker " << i << " (pid " << pid << ") ";
+                        if (WIFSIGNALED(status)) {
+                            log << "killed by signal " << WTERMSIG(status);
+                        } else {
+                            log << "exited with status " << WEXITSTATUS(status);
+                        }
+                        log << ", restarting" << std::endl;
+                        slots[i].pid.store(0);
+                        restart_times[i] = start_times[i] + std::chrono::seconds(1);
+                    }
+                }
+            }
+
+            for (size_t i = 0; running && i < settings.worker_count; ++i) {
+                if (restart_times[i] && *restart_times[i] <= Clock::now()) {
+                    restart_times[i].reset();
+                    slots[i].restarts.fetch_add(1);
+                    start_times[i] = Clock::now();
+                    StartWorker(listen_fd, host, settings, slots[i], worker_mask);
+                }
+            }
+        }
+
+        // workers waiting to be restarted have no process
+        for (size_t i = 0; i < settings.worker_count; ++i) {
+            if (const auto pid = static_cast<pid_t>(slots[i].pid.load()); pid > 0) {
+                kill(pid, SIGTERM);
+            }
+        }
+        // workers finish the connection in hand; those still running after `timeout_ms` are killed
+        std::vector<pid_t> stopping;
+        for (size_t i = 0; i < settings.worker_count; ++i) {
+            if (const auto pid = static_cast<pid_t>(slots[i].pid.load()); pid > 0) {
+                stopping.push_back(pid);
+            }
+        }
+        sigset_t child_signal;
+        sigemptyset(&child_signal);
+        sigaddset(&child_signal, SIGCHLD);
+        const auto deadline = Clock::now() + std::chrono::milliseconds(settings.timeout_ms);
+        while (true) {
+            stopping.erase(std::remove_if(stopping.begin(), stopping.end(), [](pid_t pid) {
+                return waitpid(pid, nullptr, WNOHANG) != 0;
+            }), stopping.end());
+            const auto left = deadline - Clock::now();
+            if (stopping.empty() || left <= Clock::duration::zero()) {
+                break;
+            }
+            // SIGCHLD stays blocked, so one sent since the check above ends the wait at once
+            const auto timeout = ToTimespec(left);
+            sigtimedwait(&child_signal, nullptr, &timeout);
+        }
+        for (const pid_t pid: stopping) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+        close(listen_fd);
+        unlink(settings.socket_path.c_str());
+        PrintStats(log, slots, settings.worker_count);
+        munmap(slots_memory, slots_size);
+        sigprocmask(SIG_SETMASK, &worker_mask, nullptr);
+    }
+
+}
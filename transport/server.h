@@ -0,0 +1,37 @@
+#pragma once
+
+#include "json.h"
+#include "guide_host.h"
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+namespace Server {
+
+    struct Settings {
+        std::string socket_path;
+        size_t worker_count = 1;
+        // a connection is answered with an error and closed once reading its request or writing
+        // the responses takes longer than this, or the request is over `max_request_bytes`
+        size_t timeout_ms = 10000;
+        size_t max_request_bytes = 64 << 20;
+    };
+
+    Settings ReadSettings(const Json::Node &);
+
+    // Serves the hosted networks on a Unix stream socket until SIGINT or SIGTERM. Every network is
+    // loaded first, and shared copy-on-write by `worker_count` processes forked from this one,
+    // which accept connections on the same socket; those that die are forked again, so no worker
+    // rebuilds the route table or the maps. Networks evicted over the memory budget are loaded
+    // again by each worker that needs them, mapping their spilled route tables if any. A
+    // connection sends an array of stat requests and shuts down its writing side; the array of
+    // responses comes back, as in "stat_requests". Updates are refused, every worker having a copy
+    // of its own. Workers that fail within a second of starting are forked again a second after
+    // they started. On stopping, workers finish the connection in hand and are killed if still
+    // running after `timeout_ms`. Per-worker latency stats go to `log` on SIGUSR1 and when the
+    // server stops.
+    // Throws std::runtime_error if the socket cannot be set up.
+    void Run(GuideHost &host, const Settings &settings, std::ostream &log);
+
+}
@@ -0,0 +1,147 @@
+#include "snapshot.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Snapshot {
+
+    namespace {
+
+        constexpr char kMagic[8] = {'T', 'G', 'R', 'O', 'U', 'T', 'E', 'S'};
+        constexpr uint32_t kFormatVersion = 2;
+        constexpr uint32_t kByteOrderMark = 0x01020304;
+        // the table starts on a page of its own
+        constexpr uint64_t kTableOffset = 4096;
+
+        struct Header {
+            char magic[8];
+            uint32_t format_version;
+            uint32_t byte_order;
+            uint64_t entry_size;
+            uint64_t graph_hash;
+            uint64_t vertex_count;
+            uint64_t table_offset;
+            // of the table bytes, so truncated and corrupted tables are rejected; compared apart
+            uint64_t checksum;
+        };
+
+        // FNV-1a over 64-bit words, the bytes left over one by one
+        uint64_t Checksum(const char *data, size_t size) {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            size_t offset = 0;
+            for (; offset + sizeof(uint64_t) <= size; offset += sizeof(uint64_t)) {
+                uint64_t word;
+                std::memcpy(&word, data + offset, sizeof(word));
+                hash ^= word;
+                hash *= 0x100000001b3ull;
+            }
+            for (; offset < size; ++offset) {
+                hash ^= static_cast<uint8_t>(data[offset]);
+                hash *= 0x100000001b3ull;
+            }
+            return hash;
+        }
+
+        Header MakeHeader(uint64_t graph_hash, uint64_t vertex_count, size_t entry_size) {
+            Header header{};
+            std::memcpy(header.magic, kMagic, sizeof(kMagic));
+            header.format_version = kFormatVersion;
+            header.byte_order = kByteOrderMark;
+            header.entry_size = entry_size;
+            header.graph_hash = graph_hash;
+            header.vertex_count = vertex_count;
+            header.table_offset = kTableOffset;
+            return header;
+        }
+
+        std::runtime_error MakeError(const std::string &what, const std::string &path) {
+            return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+        }
+
+    }
+
+    MappedFile::MappedFile(const std::string &path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw MakeError("cannot open", path);
+        }
+        struct stat status{};
+        if (fstat(fd, &status) != 0) {
+            const auto error = MakeError("cannot stat", path);
+            close(fd);
+            throw error;
+        }
+        size_ = status.st_size;
+        if (size_ > 0) {
+            void *data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                const auto error = MakeError("cannot map", path);
+                close(fd);
+                throw error;
+            }
+            data_ = static_cast<const char *>(data);
+        }
+        // the mapping outlives the descriptor
+        close(fd);
+    }
+
+    MappedFile::~MappedFile() {
+        if (data_) {
+            munmap(const_cast<char *>(data_), size_);
+        }
+    }
+
+    std::optional<Table> LoadTable(const std::string &path, uint64_t graph_hash, uint64_t vertex_count,
+                                   size_t entry_size) {
+        if (access(path.c_str(), R_OK) != 0) {
+            return std::nullopt;
+        }
+        auto file = std::make_shared<const MappedFile>(path);
+        const Header expected = MakeHeader(graph_hash, vertex_count, entry_size);
+        const size_t table_size = vertex_count * vertex_count * entry_size;
+        if (file->GetSize() != kTableOffset + table_size
+            || std::memcmp(file->GetData(), &expected, offsetof(Header, checksum)) != 0) {
+            return std::nullopt;
+        }
+        const char *entries = file->GetData() + kTableOffset;
+        uint64_t checksum;
+        std::memcpy(&checksum, file->GetData() + offsetof(Header, checksum), sizeof(checksum));
+        if (checksum != Checksum(entries, table_size)) {
+            return std::nullopt;
+        }
+        return Table{std::move(file), entries};
+    }
+
+    void WriteTable(const std::string &path, uint64_t graph_hash, uint64_t vertex_count, size_t entry_size,
+                    const void *entries) {
+        const std::string temporary_path = path + ".tmp" + std::to_string(getpid());
+        {
+            std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+            const size_t table_size = vertex_count * vertex_count * entry_size;
+            Header header = MakeHeader(graph_hash, vertex_count, entry_size);
+            header.checksum = Checksum(static_cast<const char *>(entries), table_size);
+            out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+            const std::string padding(kTableOffset - sizeof(Header), '\0');
+            out.write(padding.data(), padding.size());
+            out.write(static_cast<const char *>(entries), static_cast<std::streamsize>(table_size));
+            if (!out.flush()) {
+                std::remove(temporary_path.c_str());
+                throw MakeError("cannot write", temporary_path);
+            }
+        }
+        if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+            std::remove(temporary_path.c_str());
+            throw MakeError("cannot rename to", path);
+        }
+    }
+
+}
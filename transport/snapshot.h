@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace Snapshot {
+
+    // Route table files: a header, then the table entries as they lie in memory, starting at a
+    // page boundary, so a loaded file is used where it is mapped. Files are tied to the byte order
+    // and entry layout of the build that wrote them, and to the graph the table was built for.
+
+    // read-only mapping of a whole file; processes mapping the same file share its pages
+    class MappedFile {
+    public:
+        // throws std::runtime_error if the file cannot be opened or mapped
+        explicit MappedFile(const std::string &path);
+
+        MappedFile(const MappedFile &) = delete;
+
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        ~MappedFile();
+
+        const char *GetData() const {
+            return data_;
+        }
+
+        size_t GetSize() const {
+            return size_;
+        }
+
+    private:
+        const char *data_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    struct Table {
+        // keeps `entries` mapped
+        std::shared_ptr<const MappedFile> file;
+        const void *entries;
+    };
+
+    // The table in the file, if there is one written for the same graph and entry layout;
+    // nullopt if the file is missing, was written for something else or its table does not match
+    // the checksum written with it. The check reads the whole table once.
+    std::optional<Table> LoadTable(const std::string &path, uint64_t graph_hash, uint64_t vertex_count,
+                                   size_t entry_size);
+
+    // writes the table and its checksum to a temporary file renamed over `path`, so readers never
+    // see a partial one; throws std::runtime_error on failure
+    void WriteTable(const std::string &path, uint64_t graph_hash, uint64_t vertex_count, size_t entry_size,
+                    const void *entries);
+
+}
@@ -1,83 +1,546 @@
 #include "svg.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
 namespace Svg {
 
-    std::ostream &operator<<(std::ostream &out, const Color &color) {
-        if (std::holds_alternative<std::string>(color.data_)) {
-            out << std::get<std::string>(color.data_);
-        } else if (std::holds_alternative<Rgb>(color.data_)) {
-            auto rgb = std::get<Rgb>(color.data_);
-            out << "rgb(" << static_cast<int>(rgb.red) << ","
-                << static_cast<int>(rgb.green) << ","
-                << static_cast<int>(rgb.blue) << ")";
-        } else if (std::holds_alternative<Rgba>(color.data_)) {
-            auto rgba = std::get<Rgba>(color.data_);
-            out << "rgba(" << static_cast<int>(rgba.red) << ","
-                << static_cast<int>(rgba.green) << ","
-                << static_cast<int>(rgba.blue) << ","
-                << rgba.alpha << ")";
+    // keeps snapped coordinates of any sane map within int64_t
+    constexpr int kMaxPathPrecision = 9;
+
+    class Writer {
+    public:
+        Writer(std::string &out, const RenderOptions &options, FormatState &state,
+               const std::vector<bool> *class_styles = nullptr)
+                : out_(out), options_(options), state_(state), class_styles_(class_styles) {}
+
+        Writer &operator<<(std::string_view str) {
+            out_.append(str);
+            return *this;
+        }
+
+        Writer &operator<<(const std::string &str) {
+            out_.append(str);
+            return *this;
+        }
+
+        Writer &operator<<(const char *str) {
+            out_.append(str);
+            return *this;
+        }
+
+        Writer &operator<<(char c) {
+            out_.push_back(c);
+            return *this;
+        }
+
+        Writer &operator<<(uint32_t value) {
+            char buffer[16];
+            auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+            out_.append(buffer, result.ptr);
+            return *this;
+        }
+
+        // coordinates and lengths
+        Writer &operator<<(double value) {
+            if (options_.precision) {
+                return WriteTrimmed(value, *options_.precision);
+            }
+            return WriteClassic(value);
+        }
+
+        Writer &operator<<(const Color &color) {
+            if (std::holds_alternative<std::string>(color.data_)) {
+                *this << std::string_view(std::get<std::string>(color.data_));
+            } else if (std::holds_alternative<Rgb>(color.data_)) {
+                auto rgb = std::get<Rgb>(color.data_);
+                *this << "rgb(" << uint32_t{rgb.red} << ','
+                      << uint32_t{rgb.green} << ','
+                      << uint32_t{rgb.blue} << ')';
+            } else if (std::holds_alternative<Rgba>(color.data_)) {
+                auto rgba = std::get<Rgba>(color.data_);
+                *this << "rgba(" << uint32_t{rgba.red} << ','
+                      << uint32_t{rgba.green} << ','
+                      << uint32_t{rgba.blue} << ',';
+                if (options_.precision) {
+                    WriteGeneral(rgba.alpha);
+                } else {
+                    WriteClassic(rgba.alpha);
+                }
+                *this << ')';
+            } else {
+                throw std::runtime_error("unknown color variant");
+            }
+            return *this;
+        }
+
+        // `value` given in units of 10^-precision, written exactly with trailing zeros dropped
+        void WriteScaled(int64_t value, int precision) {
+            if (value < 0) {
+                out_.push_back('-');
+            }
+            const uint64_t magnitude = value < 0 ? -static_cast<uint64_t>(value) : value;
+            uint64_t divisor = 1;
+            for (int i = 0; i < precision; ++i) {
+                divisor *= 10;
+            }
+            char buffer[24];
+            auto result = std::to_chars(buffer, buffer + sizeof(buffer), magnitude / divisor);
+            out_.append(buffer, result.ptr - buffer);
+            uint64_t fraction = magnitude % divisor;
+            if (fraction == 0) {
+                return;
+            }
+            out_.push_back('.');
+            while (fraction != 0) {
+                divisor /= 10;
+                out_.push_back(static_cast<char>('0' + fraction / divisor));
+                fraction %= divisor;
+            }
+        }
+
+        // the classic serializer switched the stream to fixed precision 10 on polylines
+        void SetClassicPrecision(int precision) {
+            state_.precision = precision;
+        }
+
+        void SetClassicFixed() {
+            state_.fixed = true;
+        }
+
+        const RenderOptions &GetOptions() const {
+            return options_;
+        }
+
+        bool IsClassStyle(size_t style_id) const {
+            return class_styles_ && style_id < class_styles_->size() && (*class_styles_)[style_id];
+        }
+
+    private:
+        Writer &WriteClassic(double value) {
+            char buffer[kBufferSize];
+            auto result = std::to_chars(buffer, buffer + sizeof(buffer), value,
+                                        state_.fixed ? std::chars_format::fixed : std::chars_format::general,
+                                        state_.precision);
+            return Append(buffer, result);
+        }
+
+        Writer &WriteTrimmed(double value, int precision) {
+            char buffer[kBufferSize];
+            auto result = std::to_chars(buffer, buffer + sizeof(buffer), value,
+                                        std::chars_format::fixed, precision);
+            if (result.ec != std::errc()) {
+                return WriteShortest(value);
+            }
+            char *end = result.ptr;
+            if (std::find(buffer, end, '.') != end) {
+                while (end[-1] == '0') {
+                    --end;
+                }
+                if (end[-1] == '.') {
+                    --end;
+                }
+            }
+            if (end - buffer == 2 && buffer[0] == '-' && buffer[1] == '0') {
+                out_.push_back('0');
+                return *this;
+            }
+            out_.append(buffer, end);
+            return *this;
+        }
+
+        // six significant digits, enough for opacities
+        Writer &WriteGeneral(double value) {
+            char buffer[kBufferSize];
+            return Append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value,
+                                                std::chars_format::general, 6));
+        }
+
+        Writer &WriteShortest(double value) {
+            char buffer[kBufferSize];
+            return Append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value));
+        }
+
+        Writer &Append(const char *buffer, std::to_chars_result result) {
+            if (result.ec != std::errc()) {
+                throw std::runtime_error("cannot format number");
+            }
+            out_.append(buffer, result.ptr - buffer);
+            return *this;
+        }
+
+        static constexpr size_t kBufferSize = 512;
+
+        std::string &out_;
+        const RenderOptions &options_;
+        FormatState &state_;
+        // styles written as CSS classes rather than attributes
+        const std::vector<bool> *class_styles_;
+    };
+
+    bool Color::operator==(const Color &other) const {
+        if (data_.index() != other.data_.index()) {
+            return false;
+        }
+        if (std::holds_alternative<std::string>(data_)) {
+            return std::get<std::string>(data_) == std::get<std::string>(other.data_);
+        } else if (std::holds_alternative<Rgb>(data_)) {
+            const auto &lhs = std::get<Rgb>(data_), &rhs = std::get<Rgb>(other.data_);
+            return lhs.red == rhs.red && lhs.green == rhs.green && lhs.blue == rhs.blue;
         } else {
-            throw std::runtime_error("unknown color variant");
+            const auto &lhs = std::get<Rgba>(data_), &rhs = std::get<Rgba>(other.data_);
+            return lhs.red == rhs.red && lhs.green == rhs.green && lhs.blue == rhs.blue
+                   && lhs.alpha == rhs.alpha;
+        }
+    }
+
+    size_t Document::StyleHash::operator()(const Style &style) const {
+        size_t hash = std::hash<double>{}(style.stroke_width);
+        for (Id id: {style.fill_color, style.stroke_color, style.stroke_line_cap, style.stroke_line_join}) {
+            hash = hash * 37 + id;
+        }
+        return hash;
+    }
+
+    Document::Id Document::InternColor(const Color &color) {
+        for (Id id = 0; id < colors_.size(); ++id) {
+            if (colors_[id] == color) {
+                return id;
+            }
+        }
+        colors_.push_back(color);
+        return colors_.size() - 1;
+    }
+
+    Document::Id Document::InternString(const std::optional<std::string> &str) {
+        if (!str) {
+            return kNoId;
         }
-        return out;
+        if (auto it = string_ids_.find(*str); it != string_ids_.end()) {
+            return it->second;
+        }
+        Id id = strings_.size();
+        string_ids_.emplace(*str, id);
+        strings_.push_back(*str);
+        return id;
     }
 
     template<class Derived>
-    void ObjectProps<Derived>::ListCommon(std::ostream &out) const {
-        out << "fill=\"" << fill_color_ << "\" stroke=\""
-            << stroke_color_ << "\" stroke-width=\""
-            << stroke_width_ << "\" ";
-        if (stroke_line_cap_) {
-            out << "stroke-linecap=\"" << *stroke_line_cap_ << "\" ";
+    Document::Id Document::InternStyle(const ObjectProps<Derived> &props) {
+        return InternStyle(Style{
+                .fill_color = InternColor(props.fill_color_),
+                .stroke_color = InternColor(props.stroke_color_),
+                .stroke_width = props.stroke_width_,
+                .stroke_line_cap = InternString(props.stroke_line_cap_),
+                .stroke_line_join = InternString(props.stroke_line_join_)
+        });
+    }
+
+    Document::Id Document::InternStyle(const Style &style) {
+        auto [it, inserted] = style_ids_.emplace(style, styles_.size());
+        if (inserted) {
+            styles_.push_back(style);
+        }
+        return it->second;
+    }
+
+    Document &Document::Add(const Circle &circle) {
+        objects_.emplace_back(CircleEntry{
+                .center = circle.center_,
+                .radius = circle.radius_,
+                .style = InternStyle(circle)
+        });
+        return *this;
+    }
+
+    Document &Document::Add(const Polyline &polyline) {
+        objects_.emplace_back(PolylineEntry{
+                .first_point = static_cast<Id>(points_.size()),
+                .point_count = static_cast<Id>(polyline.points_.size()),
+                .style = InternStyle(polyline)
+        });
+        points_.insert(points_.end(), polyline.points_.begin(), polyline.points_.end());
+        return *this;
+    }
+
+    Document &Document::Add(const Text &text) {
+        objects_.emplace_back(TextEntry{
+                .position = text.position_,
+                .offset = text.offset_,
+                .font_size = text.font_size_,
+                .font_family = InternString(text.font_family_),
+                .font_weight = InternString(text.font_weight_),
+                .data_begin = static_cast<Id>(text_arena_.size()),
+                .data_size = static_cast<Id>(text.text_.size()),
+                .style = InternStyle(text)
+        });
+        text_arena_ += text.text_;
+        return *this;
+    }
+
+    Document &Document::Add(const Rectangle &rectangle) {
+        objects_.emplace_back(RectangleEntry{
+                .edge = rectangle.edge_,
+                .width = rectangle.width_,
+                .height = rectangle.height_,
+                .style = InternStyle(rectangle)
+        });
+        return *this;
+    }
+
+    void Document::Clear() {
+        objects_.clear();
+        points_.clear();
+        text_arena_.clear();
+        strings_.clear();
+        string_ids_.clear();
+        colors_.clear();
+        styles_.clear();
+        style_ids_.clear();
+    }
+
+    void Document::RenderHeader(std::string &out, const ViewBox &view_box) {
+        RenderOptions options;
+        FormatState state{.precision = 10, .fixed = false};
+        Writer writer(out, options, state);
+        writer << R"(<?xml version="1.0" encoding="UTF-8" ?>)"
+               << R"(<svg xmlns="http://www.w3.org/2000/svg" version="1.1" viewBox=")"
+               << view_box.x << ' ' << view_box.y << ' ' << view_box.width << ' ' << view_box.height << "\">";
+    }
+
+    std::vector<bool> Document::RenderStyles(std::string &out, const RenderOptions &options,
+                                             FormatState &state) const {
+        std::vector<bool> class_styles;
+        if (options.style_classes) {
+            Writer writer(out, options, state);
+            RenderStyleBlock(writer, class_styles);
+        }
+        return class_styles;
+    }
+
+    void Document::RenderObjects(std::string &out, const RenderOptions &options, FormatState &state,
+                                 const std::vector<bool> &class_styles, size_t begin, size_t end) const {
+        Writer writer(out, options, state, &class_styles);
+        for (size_t i = begin; i < end; ++i) {
+            std::visit([&](const auto &object) { RenderEntry(writer, object); }, objects_[i]);
+        }
+    }
+
+    void Document::SkipObjects(const RenderOptions &options, FormatState &state, size_t begin, size_t end) const {
+        if (options.polyline_paths) {
+            return;
+        }
+        for (size_t i = begin; i < end; ++i) {
+            if (const auto *polyline = std::get_if<PolylineEntry>(&objects_[i])) {
+                state.precision = 10;
+                state.fixed |= polyline->point_count > 0;
+            }
+        }
+    }
+
+    Document &Document::Append(const Document &other) {
+        std::vector<Id> string_ids(other.strings_.size());
+        for (Id id = 0; id < other.strings_.size(); ++id) {
+            string_ids[id] = InternString(other.strings_[id]);
+        }
+        auto map_string = [&](Id id) {
+            return id == kNoId ? kNoId : string_ids[id];
+        };
+        std::vector<Id> style_ids(other.styles_.size());
+        for (Id id = 0; id < other.styles_.size(); ++id) {
+            const auto &style = other.styles_[id];
+            style_ids[id] = InternStyle(Style{
+                    .fill_color = InternColor(other.colors_[style.fill_color]),
+                    .stroke_color = InternColor(other.colors_[style.stroke_color]),
+                    .stroke_width = style.stroke_width,
+                    .stroke_line_cap = map_string(style.stroke_line_cap),
+                    .stroke_line_join = map_string(style.stroke_line_join)
+            });
         }
-        if (stroke_line_join_) {
-            out << "stroke-linejoin=\"" << *stroke_line_join_ << "\" ";
+
+        const auto points_shift = static_cast<Id>(points_.size());
+        const auto text_shift = static_cast<Id>(text_arena_.size());
+        objects_.reserve(objects_.size() + other.objects_.size());
+        for (auto entry: other.objects_) {
+            std::visit([&](auto &object) { object.style = style_ids[object.style]; }, entry);
+            if (auto *polyline = std::get_if<PolylineEntry>(&entry)) {
+                polyline->first_point += points_shift;
+            } else if (auto *text = std::get_if<TextEntry>(&entry)) {
+                text->data_begin += text_shift;
+                text->font_family = map_string(text->font_family);
+                text->font_weight = map_string(text->font_weight);
+            }
+            objects_.push_back(entry);
+        }
+        points_.insert(points_.end(), other.points_.begin(), other.points_.end());
+        text_arena_ += other.text_arena_;
+        return *this;
+    }
+
+    void Document::RenderStyleBlock(Writer &out, std::vector<bool> &class_styles) const {
+        std::vector<size_t> uses(styles_.size());
+        for (const auto &entry: objects_) {
+            std::visit([&](const auto &object) { ++uses[object.style]; }, entry);
+        }
+        class_styles.assign(styles_.size(), false);
+        bool any = false;
+        for (Id id = 0; id < styles_.size(); ++id) {
+            if (uses[id] < 2) {
+                continue;
+            }
+            if (!any) {
+                out << "<style>";
+                any = true;
+            }
+            class_styles[id] = true;
+            const auto &style = styles_[id];
+            out << '.' << out.GetOptions().class_prefix << id
+                << "{fill:" << colors_[style.fill_color]
+                << ";stroke:" << colors_[style.stroke_color]
+                << ";stroke-width:" << style.stroke_width;
+            if (style.stroke_line_cap != kNoId) {
+                out << ";stroke-linecap:" << strings_[style.stroke_line_cap];
+            }
+            if (style.stroke_line_join != kNoId) {
+                out << ";stroke-linejoin:" << strings_[style.stroke_line_join];
+            }
+            out << '}';
+        }
+        if (any) {
+            out << "</style>";
+        }
+    }
+
+    void Document::RenderStyle(Writer &out, Id style_id) const {
+        if (out.IsClassStyle(style_id)) {
+            out << "class=\"" << out.GetOptions().class_prefix << style_id << "\" ";
+            return;
+        }
+        const auto &style = styles_[style_id];
+        out << "fill=\"" << colors_[style.fill_color] << "\" stroke=\""
+            << colors_[style.stroke_color] << "\" stroke-width=\""
+            << style.stroke_width << "\" ";
+        if (style.stroke_line_cap != kNoId) {
+            out << "stroke-linecap=\"" << strings_[style.stroke_line_cap] << "\" ";
+        }
+        if (style.stroke_line_join != kNoId) {
+            out << "stroke-linejoin=\"" << strings_[style.stroke_line_join] << "\" ";
         }
     }
 
-    void Circle::Render(std::ostream &out) const {
-        out << "<circle cx=\"" << center_.x << "\" cy=\""
-            << center_.y << "\" r=\"" << radius_ << "\" ";
-        ListCommon(out);
+    void Document::RenderEntry(Writer &out, const CircleEntry &circle) const {
+        out << "<circle cx=\"" << circle.center.x << "\" cy=\""
+            << circle.center.y << "\" r=\"" << circle.radius << "\" ";
+        RenderStyle(out, circle.style);
         out << "/>";
     }
 
-    void Polyline::Render(std::ostream &out) const {
-        out.precision(10);
+    void Document::RenderEntry(Writer &out, const PolylineEntry &polyline) const {
+        if (out.GetOptions().polyline_paths) {
+            RenderPath(out, polyline);
+            return;
+        }
+        out.SetClassicPrecision(10);
         out << "<polyline ";
-        ListCommon(out);
+        RenderStyle(out, polyline.style);
         out << "points=\"";
-        bool first = true;
-        for (auto point: points_) {
-            if (first) {
-                first = false;
-                out << std::fixed << point.x << "," << point.y;
+        for (Id i = 0; i < polyline.point_count; ++i) {
+            const auto &point = points_[polyline.first_point + i];
+            if (i == 0) {
+                out.SetClassicFixed();
+            } else {
+                out << ' ';
+            }
+            out << point.x << ',' << point.y;
+        }
+        out << "\" />";
+    }
+
+    void Document::RenderPath(Writer &out, const PolylineEntry &polyline) const {
+        const int precision = std::clamp(
+                out.GetOptions().precision.value_or(RenderOptions::kPathPrecision), 0, kMaxPathPrecision);
+        const double scale = std::pow(10., precision);
+
+        // vertices are snapped to the output grid first, so relative moves never accumulate
+        // rounding error; a vertex is dropped when the line without it passes within one grid
+        // step of it and of every vertex dropped before it on the same stretch
+        using Vertex = std::pair<int64_t, int64_t>;
+        auto deviates = [](Vertex from, Vertex to, Vertex point) {
+            const double dx = to.first - from.first, dy = to.second - from.second;
+            const double px = point.first - from.first, py = point.second - from.second;
+            const double length2 = dx * dx + dy * dy;
+            const double projection = dx * px + dy * py;
+            const double cross = dx * py - dy * px;
+            return projection <= 0 || projection >= length2 || cross * cross > length2;
+        };
+        std::vector<Vertex> vertices;
+        vertices.reserve(polyline.point_count);
+        std::vector<Vertex> dropped;
+        for (Id i = 0; i < polyline.point_count; ++i) {
+            const auto &point = points_[polyline.first_point + i];
+            const Vertex vertex{std::llround(point.x * scale), std::llround(point.y * scale)};
+            if (!vertices.empty() && vertices.back() == vertex) {
                 continue;
             }
-            out << " " << std::fixed << point.x << "," << point.y;
+            if (vertices.size() >= 2) {
+                const auto anchor = vertices[vertices.size() - 2];
+                bool redundant = !deviates(anchor, vertex, vertices.back());
+                for (size_t j = 0; redundant && j < dropped.size(); ++j) {
+                    redundant = !deviates(anchor, vertex, dropped[j]);
+                }
+                if (redundant) {
+                    dropped.push_back(vertices.back());
+                    vertices.back() = vertex;
+                    continue;
+                }
+                dropped.clear();
+            }
+            vertices.push_back(vertex);
+        }
+
+        out << "<path ";
+        RenderStyle(out, polyline.style);
+        out << "d=\"";
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            if (i == 0) {
+                out << 'M';
+                out.WriteScaled(vertices[i].first, precision);
+                out << ',';
+                out.WriteScaled(vertices[i].second, precision);
+                continue;
+            }
+            out << (i == 1 ? 'l' : ' ');
+            out.WriteScaled(vertices[i].first - vertices[i - 1].first, precision);
+            out << ',';
+            out.WriteScaled(vertices[i].second - vertices[i - 1].second, precision);
+        }
+        // a line folded into one point still draws its round cap as a dot
+        if (vertices.size() == 1 && polyline.point_count > 1) {
+            out << "l0,0";
         }
         out << "\" />";
     }
 
-    void Text::Render(std::ostream &out) const {
-        out << "<text x=\"" << position_.x << "\" y=\"" << position_.y
-            << "\" dx=\"" << offset_.x << "\" dy=\"" << offset_.y
-            << "\" font-size=\"" << font_size_ << "\" ";
-        if (font_family_) {
-            out << "font-family=\"" << *font_family_ << "\" ";
+    void Document::RenderEntry(Writer &out, const TextEntry &text) const {
+        out << "<text x=\"" << text.position.x << "\" y=\"" << text.position.y
+            << "\" dx=\"" << text.offset.x << "\" dy=\"" << text.offset.y
+            << "\" font-size=\"" << text.font_size << "\" ";
+        if (text.font_family != kNoId) {
+            out << "font-family=\"" << strings_[text.font_family] << "\" ";
         }
-        if (font_weight_) {
-            out << "font-weight=\"" << *font_weight_ << "\" ";
+        if (text.font_weight != kNoId) {
+            out << "font-weight=\"" << strings_[text.font_weight] << "\" ";
         }
-        ListCommon(out);
-        out << ">" << text_ << "</text>";
+        RenderStyle(out, text.style);
+        out << '>' << std::string_view(text_arena_).substr(text.data_begin, text.data_size) << "</text>";
     }
 
-    void Rectangle::Render(std::ostream & out) const {
-        out << "<rect x=\"" << edge_.x << "\" y=\"" << edge_.y
-            << "\" width=\"" << width_ << "\" height=\"" << height_ << "\" ";
-        ListCommon(out);
+    void Document::RenderEntry(Writer &out, const RectangleEntry &rectangle) const {
+        out << "<rect x=\"" << rectangle.edge.x << "\" y=\"" << rectangle.edge.y
+            << "\" width=\"" << rectangle.width << "\" height=\"" << rectangle.height << "\" ";
+        RenderStyle(out, rectangle.style);
         out << "/>";
     }
 
-}
\ No newline at end of file
+}
@@ -5,9 +5,15 @@
 #include <vector>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <optional>
 #include <variant>
+#include <unordered_map>
+
+namespace Raster {
+    class Canvas;
+}
 
 namespace Svg {
 
@@ -54,26 +60,54 @@ namespace Svg {
 
         Color(Rgba rgba) : data_(rgba) {}
 
+        bool operator==(const Color &other) const;
+
     private:
-        friend std::ostream &operator<<(std::ostream &, const Color &);
+        friend class Writer;
+        friend class Raster::Canvas;
 
         std::variant<std::string, Rgb, Rgba> data_;
     };
 
     const Color NoneColor = "none";
 
-    struct ObjectBase {
-        virtual void Render(std::ostream &) const = 0;
-        virtual ~ObjectBase() = default;
+    struct RenderOptions {
+        // digits after the decimal point for coordinates and lengths, trailing zeros dropped;
+        // unset reproduces the classic stream formatting byte for byte
+        std::optional<int> precision;
+        // style tuples shared by several objects go to a <style> block as CSS classes
+        bool style_classes = false;
+        // distinguishes classes of fragments that end up in one document
+        std::string class_prefix = "s";
+        // polylines become <path> data of relative moves, with duplicate and collinear
+        // vertices dropped; coordinates are rounded to `precision` or kPathPrecision digits
+        bool polyline_paths = false;
+
+        static constexpr int kPathPrecision = 2;
+    };
+
+    // Number format carried from one serialized fragment to the next. The classic serializer
+    // wrote through one std::ostream, and polylines switched it to precision 10 and std::fixed
+    // for everything that followed; the default output keeps reproducing that.
+    struct FormatState {
+        int precision = 6;
+        bool fixed = false;
+    };
+
+    struct ViewBox {
+        double x;
+        double y;
+        double width;
+        double height;
     };
 
+    class Writer;
+
     template<class Derived>
     class ObjectProps {
     public:
         ObjectProps() : stroke_width_(1.) {}
 
-        void ListCommon(std::ostream &) const;
-
         Derived &SetFillColor(const Color &color) {
             fill_color_ = color;
             return cthis();
@@ -99,8 +133,6 @@ namespace Svg {
             return cthis();
         }
 
-        virtual ~ObjectProps() = default;
-
     private:
         Color fill_color_;
         Color stroke_color_;
@@ -109,17 +141,16 @@ namespace Svg {
         std::optional<std::string> stroke_line_join_;
 
         friend Derived;
+        friend class Document;
 
         Derived &cthis() { return static_cast<Derived &>(*this); }
 
     };
 
-    class Circle : public ObjectBase, public ObjectProps<Circle> {
+    class Circle : public ObjectProps<Circle> {
     public:
         Circle() : radius_(1.) {};
 
-        void Render(std::ostream &) const override;
-
         Circle &SetCenter(Point point) {
             center_ = point;
             return *this;
@@ -131,31 +162,31 @@ namespace Svg {
         }
 
     private:
+        friend class Document;
+
         Point center_;
         double radius_;
     };
 
-    class Polyline : public ObjectBase, public ObjectProps<Polyline> {
+    class Polyline : public ObjectProps<Polyline> {
     public:
         Polyline() = default;
 
-        void Render(std::ostream &) const override;
-
         Polyline &AddPoint(Point point) {
             points_.push_back(point);
             return *this;
         }
 
     private:
+        friend class Document;
+
         std::vector<Point> points_;
     };
 
-    class Text : public ObjectBase, public ObjectProps<Text> {
+    class Text : public ObjectProps<Text> {
     public:
         Text() : font_size_(1) {}
 
-        void Render(std::ostream &) const override;
-
         Text &SetPoint(Point point) {
             position_ = point;
             return *this;
@@ -181,14 +212,14 @@ namespace Svg {
             return *this;
         }
 
-        Text &SetData(const std::string &text) {
+        Text &SetData(std::string_view text) {
             text_ = text;
             return *this;
         }
 
-        ~Text() override = default;
-
     private:
+        friend class Document;
+
         Point position_;
         Point offset_;
         uint32_t font_size_;
@@ -197,13 +228,11 @@ namespace Svg {
         std::string text_;
     };
 
-    class Rectangle : public ObjectBase, public ObjectProps<Rectangle> {
+    class Rectangle : public ObjectProps<Rectangle> {
     public:
         Rectangle(double x, double y, double width, double height)
             : edge_(x, y), width_(width), height_(height) {}
 
-        void Render(std::ostream &) const override;
-
         Rectangle &SetEdge(Point point) {
             edge_ = point;
             return *this;
@@ -216,40 +245,167 @@ namespace Svg {
         }
 
     private:
+        friend class Document;
+
         Point edge_;
         double width_;
         double height_;
     };
 
+    // Circle, Polyline, Text and Rectangle are builders; the document flattens them on Add
+    // into plain records kept by value. Polyline points share one array, text payloads share
+    // one arena, and colors, style strings and whole style tuples are interned, so building
+    // or copying a large document amounts to a handful of bulk allocations.
     class Document {
     public:
         Document() = default;
 
-        // no deep copy needed;
-        Document(const Document& other)
-            : objects_(other.objects_) {}
+        Document &Add(const Circle &circle);
 
-        template<class DerivedObject>
-        Document &Add(DerivedObject obj) {
-            objects_.push_back(std::make_shared<DerivedObject>(std::move(obj)));
-            return *this;
+        Document &Add(const Polyline &polyline);
+
+        Document &Add(const Text &text);
+
+        Document &Add(const Rectangle &rectangle);
+
+        void Render(std::string &out, const RenderOptions &options = {}) const {
+            FormatState state;
+            RenderHeader(out);
+            RenderObjects(out, options, state);
+            RenderFooter(out);
         }
 
-        void Render(std::ostream &out) const {
-            out << R"(<?xml version="1.0" encoding="UTF-8" ?>)"
-                << R"(<svg xmlns="http://www.w3.org/2000/svg" version="1.1">)";
-            for (const auto &obj: objects_) {
-                obj->Render(out);
-            }
-            out << "</svg>";
+        static void RenderHeader(std::string &out) {
+            out += R"(<?xml version="1.0" encoding="UTF-8" ?>)"
+                   R"(<svg xmlns="http://www.w3.org/2000/svg" version="1.1">)";
         }
 
-        void Clear() {
-            objects_.clear();
+        static void RenderHeader(std::string &out, const ViewBox &view_box);
+
+        // objects only (preceded by their <style> block in class mode), so that documents
+        // can be serialized piecewise and concatenated; `state` is continued and updated
+        void RenderObjects(std::string &out, const RenderOptions &options, FormatState &state) const {
+            const auto class_styles = RenderStyles(out, options, state);
+            RenderObjects(out, options, state, class_styles, 0, GetObjectCount());
         }
 
+        // Pieces of one document may be written concurrently: RenderStyles writes the <style>
+        // block (class mode only) and tells which styles became classes, then every range of
+        // objects is written from the state SkipObjects reaches at its beginning.
+        std::vector<bool> RenderStyles(std::string &out, const RenderOptions &options, FormatState &state) const;
+
+        void RenderObjects(std::string &out, const RenderOptions &options, FormatState &state,
+                           const std::vector<bool> &class_styles, size_t begin, size_t end) const;
+
+        // moves `state` over objects [begin, end) as writing them would
+        void SkipObjects(const RenderOptions &options, FormatState &state, size_t begin, size_t end) const;
+
+        size_t GetObjectCount() const {
+            return objects_.size();
+        }
+
+        // appends the objects of `other`, so documents built apart can be joined
+        Document &Append(const Document &other);
+
+        static void RenderFooter(std::string &out) {
+            out += kFooter;
+        }
+
+        static constexpr std::string_view kFooter = "</svg>";
+
+        void Clear();
+
+    private:
+        // draws the stored records directly, without going through the markup
+        friend class Raster::Canvas;
+
+        using Id = uint32_t;
+        static constexpr Id kNoId = static_cast<Id>(-1);
+
+        struct Style {
+            Id fill_color;
+            Id stroke_color;
+            double stroke_width;
+            Id stroke_line_cap;
+            Id stroke_line_join;
+
+            bool operator==(const Style &other) const {
+                return fill_color == other.fill_color && stroke_color == other.stroke_color
+                       && stroke_width == other.stroke_width && stroke_line_cap == other.stroke_line_cap
+                       && stroke_line_join == other.stroke_line_join;
+            }
+        };
+
+        struct StyleHash {
+            size_t operator()(const Style &style) const;
+        };
+
+        struct CircleEntry {
+            Point center;
+            double radius;
+            Id style;
+        };
+
+        struct PolylineEntry {
+            Id first_point;
+            Id point_count;
+            Id style;
+        };
+
+        struct TextEntry {
+            Point position;
+            Point offset;
+            uint32_t font_size;
+            Id font_family;
+            Id font_weight;
+            Id data_begin;
+            Id data_size;
+            Id style;
+        };
+
+        struct RectangleEntry {
+            Point edge;
+            double width;
+            double height;
+            Id style;
+        };
+
+        using Entry = std::variant<CircleEntry, PolylineEntry, TextEntry, RectangleEntry>;
+
+        template<class Derived>
+        Id InternStyle(const ObjectProps<Derived> &props);
+
+        Id InternStyle(const Style &style);
+
+        Id InternColor(const Color &color);
+
+        Id InternString(const std::optional<std::string> &str);
+
+        void RenderStyleBlock(Writer &out, std::vector<bool> &class_styles) const;
+
+        void RenderStyle(Writer &out, Id style_id) const;
+
+        void RenderEntry(Writer &out, const CircleEntry &circle) const;
+
+        void RenderEntry(Writer &out, const PolylineEntry &polyline) const;
+
+        void RenderPath(Writer &out, const PolylineEntry &polyline) const;
+
+        void RenderEntry(Writer &out, const TextEntry &text) const;
+
+        void RenderEntry(Writer &out, const RectangleEntry &rectangle) const;
+
     private:
-        std::vector<std::shared_ptr<ObjectBase>> objects_;
+        std::vector<Entry> objects_;
+        std::vector<Point> points_;
+        std::string text_arena_;
+
+        std::vector<std::string> strings_;
+        std::unordered_map<std::string, Id> string_ids_;
+        // palettes are short, so colors are interned with a linear scan
+        std::vector<Color> colors_;
+        std::vector<Style> styles_;
+        std::unordered_map<Style, Id, StyleHash> style_ids_;
     };
 
     using DocumentPtr = std::shared_ptr<Document>;
@@ -0,0 +1,147 @@
+#include "trace.h"
+
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <vector>
+
+#include <unistd.h>
+
+namespace Trace {
+
+    namespace {
+
+        struct Event {
+            std::string_view name;
+            uint64_t start;
+            uint64_t finish;
+        };
+
+        // The events of the threads that held it, one at a time: a thread leaves its buffer to the
+        // next one to start recording when it exits, so threads coming and going reuse the buffers
+        // of those gone instead of adding ones.
+        struct ThreadBuffer {
+            uint64_t thread_id = 0;
+            std::vector<Event> events;
+            // cleared with release by the thread leaving it
+            std::atomic<bool> in_use = true;
+            ThreadBuffer *next = nullptr;
+        };
+
+        // every buffer, most recent first; pushed without a lock and never freed, as the trace is
+        // written after the threads that recorded it are gone
+        std::atomic<ThreadBuffer *> buffers = nullptr;
+        std::atomic<uint64_t> thread_count = 0;
+        std::atomic<uint64_t> epoch = 0;
+
+        // the buffer of the current thread, handed back when the thread exits
+        struct BufferLease {
+            ThreadBuffer *buffer = nullptr;
+
+            ~BufferLease() {
+                if (buffer) {
+                    buffer->in_use.store(false, std::memory_order_release);
+                }
+            }
+        };
+
+        thread_local BufferLease thread_lease;
+
+        ThreadBuffer *TakeFreeBuffer() {
+            for (auto *buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+                bool in_use = false;
+                if (!buffer->in_use.load(std::memory_order_relaxed)
+                    && buffer->in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire)) {
+                    return buffer;
+                }
+            }
+            return nullptr;
+        }
+
+        ThreadBuffer &GetThreadBuffer() {
+            auto &buffer = thread_lease.buffer;
+            if (!buffer) {
+                buffer = TakeFreeBuffer();
+            }
+            if (!buffer) {
+                buffer = new ThreadBuffer;
+                buffer->thread_id = ++thread_count;
+                buffer->next = buffers.load(std::memory_order_relaxed);
+                while (!buffers.compare_exchange_weak(buffer->next, buffer,
+                                                      std::memory_order_release, std::memory_order_relaxed)) {
+                }
+            }
+            return *buffer;
+        }
+
+    }
+
+    namespace Detail {
+
+        uint64_t Now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void Record(std::string_view name, uint64_t start, uint64_t finish) {
+            GetThreadBuffer().events.push_back({name, start, finish});
+        }
+
+    }
+
+    void Enable() {
+        uint64_t unset = 0;
+        epoch.compare_exchange_strong(unset, Detail::Now());
+        Detail::enabled.store(true, std::memory_order_relaxed);
+    }
+
+    void Disable() {
+        Detail::enabled.store(false, std::memory_order_relaxed);
+    }
+
+    void Write(std::ostream &out) {
+        const uint64_t origin = epoch.load();
+        const auto process_id = getpid();
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::fixed << std::setprecision(3);
+        bool first = true;
+        for (const auto *buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+            for (const auto &event: buffer->events) {
+                out << (first ? "\n" : ",\n");
+                first = false;
+                // microseconds, as the format has them
+                out << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": " << process_id
+                    << ", \"tid\": " << buffer->thread_id
+                    << ", \"ts\": " << static_cast<double>(event.start - origin) / 1000
+                    << ", \"dur\": " << static_cast<double>(event.finish - event.start) / 1000 << "}";
+            }
+        }
+        out << "\n]}\n";
+    }
+
+    std::map<std::string, Total> Summarize() {
+        std::map<std::string, Total> totals;
+        for (const auto *buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+            for (const auto &event: buffer->events) {
+                auto &total = totals[std::string(event.name)];
+                ++total.count;
+                total.nanoseconds += event.finish - event.start;
+            }
+        }
+        return totals;
+    }
+
+    void Clear() {
+        for (auto *buffer = buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next) {
+            buffer->events.clear();
+        }
+    }
+
+    void WriteFile(const std::string &path) {
+        std::ofstream out(path);
+        Write(out);
+        if (!out.flush()) {
+            throw std::runtime_error("Cannot write trace to " + path);
+        }
+    }
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Opt-in span tracing, written as Chrome trace JSON (chrome://tracing, ui.perfetto.dev). Each thread
+// appends the spans it closes to a buffer of its own, so recording takes no lock; while tracing is
+// off a span costs one relaxed load. Buffers of exited threads are taken over by new ones, so a
+// thread of the trace may be several short-lived threads one after another.
+namespace Trace {
+
+    namespace Detail {
+
+        inline std::atomic<bool> enabled = false;
+
+        uint64_t Now();
+
+        void Record(std::string_view name, uint64_t start, uint64_t finish);
+
+    }
+
+    inline bool IsEnabled() {
+        return Detail::enabled.load(std::memory_order_relaxed);
+    }
+
+    // spans opened from now on are recorded; timestamps count from the first call
+    void Enable();
+
+    // spans opened from now on are not recorded, e.g. around code timed without tracing
+    void Disable();
+
+    // Writes the spans recorded so far as {"traceEvents": [...]}. No span may be closing meanwhile:
+    // call it once the threads that record have joined.
+    void Write(std::ostream &out);
+
+    // throws std::runtime_error if the file cannot be written
+    void WriteFile(const std::string &path);
+
+    struct Total {
+        uint64_t count = 0;
+        uint64_t nanoseconds = 0;
+    };
+
+    // the spans recorded so far, summed by name; called like Write
+    std::map<std::string, Total> Summarize();
+
+    // drops the spans recorded so far; called like Write
+    void Clear();
+
+    // times the scope as a complete event on the current thread
+    class Span {
+    public:
+        // `name` must outlive the trace, e.g. a string literal
+        explicit Span(std::string_view name) : name_(name), start_(IsEnabled() ? Detail::Now() : 0) {}
+
+        Span(const Span &) = delete;
+
+        Span &operator=(const Span &) = delete;
+
+        ~Span() {
+            if (start_ != 0) {
+                Detail::Record(name_, start_, Detail::Now());
+            }
+        }
+
+    private:
+        std::string_view name_;
+        // 0 while tracing is off
+        uint64_t start_;
+    };
+
+}
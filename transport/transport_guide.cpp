@@ -1,8 +1,14 @@
 #include "transport_guide.h"
+#include "metrics.h"
+#include "trace.h"
 #include "utils.h"
 
+#include <algorithm>
+#include <map>
+#include <set>
+
 double TransportGuide::CalculateDirectLength(const Descriptions::DictStop &stop_descriptions,
-                                             const std::vector<std::string> &route_stops) {
+                                             const std::vector<std::string> &route_stops) const {
     if (route_stops.empty()) {
         throw std::runtime_error("Empty route");
     }
@@ -48,92 +54,560 @@ int64_t TransportGuide::CalculateRouteLength(const std::vector<std::string> &rou
     return route_length;
 }
 
-// todo: split this function
 TransportGuide::TransportGuide(Descriptions::Data data, Transport::RoutingSettings routing_settings,
-                               Render::SettingsPtr render_settings) {
+                               Render::SettingsPtr render_settings, const Render::Profiles &render_profiles)
+        : render_settings_(std::move(render_settings)), render_profiles_(render_profiles) {
+    Trace::Span span("TransportGuide");
     database_ = std::make_shared<Data::Database>();
 
-    for (auto &description: data) {
-        if (std::holds_alternative<Descriptions::Stop>(description)) {
-            auto &stop = std::get<Descriptions::Stop>(description);
-            database_->stop_descriptions.emplace(stop.name, std::move(stop));
-        } else if (std::holds_alternative<Descriptions::Bus>(description)) {
-            auto &bus = std::get<Descriptions::Bus>(description);
-            database_->bus_descriptions.emplace(bus.name, std::move(bus));
-        } else {
-            throw std::runtime_error("Unknown description variant");
+    {
+        Trace::Span stage_span("TransportGuide: database");
+        for (auto &description: data) {
+            if (std::holds_alternative<Descriptions::Stop>(description)) {
+                auto &stop = std::get<Descriptions::Stop>(description);
+                database_->stop_descriptions.emplace(stop.name, std::move(stop));
+            } else if (std::holds_alternative<Descriptions::Bus>(description)) {
+                auto &bus = std::get<Descriptions::Bus>(description);
+                database_->bus_descriptions.emplace(bus.name, std::move(bus));
+            } else {
+                throw std::runtime_error("Unknown description variant");
+            }
         }
     }
 
     router_ = std::make_unique<Transport::TransportRouter>(database_);
 
-    for (const auto &[name, stop]: database_->stop_descriptions) {
-        stop_responses_.emplace(name, Response::Stop{});
-        for (const auto &[name_to, distance]: stop.distance_to_stops) {
-            router_->UpdateDistance(name, name_to, distance);
+    {
+        Trace::Span stage_span("TransportGuide: distances");
+        for (const auto &[name, stop]: database_->stop_descriptions) {
+            stop_responses_.emplace(name, Response::Stop{});
+            for (const auto &[name_to, distance]: stop.distance_to_stops) {
+                router_->UpdateDistance(name, name_to, distance);
+            }
+        }
+    }
+
+    {
+        Trace::Span stage_span("TransportGuide: responses");
+        for (const auto &[bus_name, bus]: database_->bus_descriptions) {
+            for (const auto &stop_name: bus.stops) {
+                // buses are visited in sorted order, so checking the tail keeps the list unique and sorted
+                auto &stop_busses = stop_responses_[stop_name].busses;
+                if (stop_busses.empty() || stop_busses.back() != bus_name) {
+                    stop_busses.push_back(bus_name);
+                }
+            }
+            bus_responses_.emplace(bus_name, MakeBusResponse(bus));
         }
     }
+    {
+        Trace::Span stage_span("TransportGuide: adjacent stops");
+        FillAdjacentStops();
+    }
+
+    router_->BuildMap(database_, routing_settings);
+    {
+        Trace::Span stage_span("TransportGuide: stop index");
+        BuildStopIndex();
+    }
+    BuildRenderers();
+}
+
+Descriptions::Data TransportGuide::GetDescriptions() const {
+    Descriptions::Data data;
+    data.reserve(database_->stop_descriptions.size() + database_->bus_descriptions.size());
+    for (const auto &[name, stop]: database_->stop_descriptions) {
+        data.emplace_back(stop);
+    }
+    for (const auto &[name, bus]: database_->bus_descriptions) {
+        data.emplace_back(bus);
+    }
+    return data;
+}
+
+std::unique_ptr<TransportGuide> TransportGuide::Rebuild() const {
+    // the snapshot holds the table of the loaded network, not of this one
+    auto routing_settings = router_->GetSettings();
+    routing_settings.snapshot_file.clear();
+    return std::make_unique<TransportGuide>(GetDescriptions(), std::move(routing_settings),
+                                            render_settings_, render_profiles_);
+}
+
+size_t TransportGuide::EstimateMemory() const {
+    size_t memory = router_->EstimateMemory() + renderer_->EstimateMemory();
+    for (const auto &[name, renderer]: profile_renderers_) {
+        memory += renderer->EstimateMemory();
+    }
+    for (const auto &[name, stop]: database_->stop_descriptions) {
+        memory += sizeof(stop) + name.capacity()
+                  + stop.distance_to_stops.size() * sizeof(stop.distance_to_stops[0]);
+    }
+    for (const auto &[name, bus]: database_->bus_descriptions) {
+        memory += sizeof(bus) + name.capacity() + bus.stops.size() * sizeof(bus.stops[0]);
+    }
+    for (const auto &[name, response]: stop_responses_) {
+        memory += sizeof(response) + name.capacity() + response.busses.size() * sizeof(response.busses[0]);
+    }
+    memory += bus_responses_.size() * sizeof(Response::Bus);
+    return memory;
+}
+
+Response::Bus TransportGuide::MakeBusResponse(const Descriptions::Bus &bus) const {
+    const std::unordered_set<std::string_view> unique_stops(bus.stops.begin(), bus.stops.end());
+    int64_t route_length = CalculateRouteLength(bus.stops);
+    double direct_length = CalculateDirectLength(database_->stop_descriptions, bus.stops);
+    return Response::Bus{
+            .stops_on_route = bus.stops.size(),
+            .unique_stops = unique_stops.size(),
+            .route_length = route_length,
+            .curvature = static_cast<double>(route_length) / direct_length
+    };
+}
 
+void TransportGuide::FillAdjacentStops() {
+    database_->adjacent_stops.clear();
     for (const auto &[bus_name, bus]: database_->bus_descriptions) {
-        std::unordered_set<std::string> unique_stops;
         bool first = true;
         std::string_view prev_stop_name, cur_stop_name;
         for (const auto &stop_name: bus.stops) {
-            unique_stops.insert(stop_name);
-            stop_responses_[stop_name].busses.insert(bus_name);
             // fill database`s . adjacent stops
             if (first) {
                 first = false;
-                prev_stop_name = database_->stop_descriptions.find(stop_name)->second.name;
+                prev_stop_name = database_->stop_descriptions.find(stop_name)->first;
                 continue;
             }
-            cur_stop_name = database_->stop_descriptions.find(stop_name)->second.name;
+            cur_stop_name = database_->stop_descriptions.find(stop_name)->first;
             database_->adjacent_stops[cur_stop_name].push_back(
                     Descriptions::VectorEntry{prev_stop_name, bus_name, true});
             database_->adjacent_stops[prev_stop_name].push_back(
                     Descriptions::VectorEntry{cur_stop_name, bus_name, false});
             prev_stop_name = cur_stop_name;
         }
-        int64_t route_length = CalculateRouteLength(bus.stops);
-        double direct_length = CalculateDirectLength(database_->stop_descriptions, bus.stops);
-        bus_responses_.emplace(
-                bus_name,
-                Response::Bus{
-                        .stops_on_route = bus.stops.size(),
-                        .unique_stops = unique_stops.size(),
-                        .route_length = route_length,
-                        .curvature = static_cast<double>(route_length) / direct_length
+    }
+}
+
+void TransportGuide::BuildStopIndex() {
+    stop_names_.clear();
+    stop_ids_.clear();
+    bus_names_.clear();
+
+    std::vector<Coordinates::Point> stop_points;
+    stop_points.reserve(database_->stop_descriptions.size());
+    for (const auto &[name, stop]: database_->stop_descriptions) {
+        stop_names_.push_back(name);
+        stop_points.push_back(stop.coordinates);
+    }
+    stop_locator_ = Coordinates::NearestIndex(stop_points);
+
+    for (size_t stop_id = 0; stop_id < stop_names_.size(); ++stop_id) {
+        stop_ids_.emplace(stop_names_[stop_id], stop_id);
+    }
+    stop_bus_sets_ = Transport::StopBusSets(stop_names_.size(), database_->bus_descriptions.size());
+    for (const auto &[bus_name, bus]: database_->bus_descriptions) {
+        for (const auto &stop_name: bus.stops) {
+            stop_bus_sets_.Add(stop_ids_.at(stop_name), bus_names_.size());
+        }
+        bus_names_.push_back(bus_name);
+    }
+}
+
+void TransportGuide::BuildRenderers() {
+    Trace::Span span("TransportGuide::BuildRenderers");
+    profile_renderers_.clear();
+    renderer_ = std::make_unique<Render::Renderer>(Render::RenderData{database_, render_settings_});
+    std::vector<const Render::Renderer *> layout_owners = {renderer_.get()};
+    for (const auto &[name, settings]: render_profiles_) {
+        auto owner = std::find_if(layout_owners.begin(), layout_owners.end(), [&](const auto *renderer) {
+            return Render::HaveSameLayout(*renderer->GetSettings(), *settings);
+        });
+        auto &renderer = profile_renderers_[name];
+        if (owner != layout_owners.end()) {
+            renderer = std::make_unique<Render::Renderer>(
+                    Render::RenderData{database_, settings}, (*owner)->GetLayout());
+        } else {
+            renderer = std::make_unique<Render::Renderer>(Render::RenderData{database_, settings});
+            layout_owners.push_back(renderer.get());
+        }
+    }
+}
+
+namespace {
+
+    std::optional<int> FindDistance(const Descriptions::Stop &from, const std::string &to) {
+        for (const auto &[name, distance]: from.distance_to_stops) {
+            if (name == to) {
+                return distance;
+            }
+        }
+        return std::nullopt;
+    }
+
+    bool operator==(const Descriptions::Stop &lhs, const Descriptions::Stop &rhs) {
+        return lhs.coordinates.latitude == rhs.coordinates.latitude
+               && lhs.coordinates.longitude == rhs.coordinates.longitude
+               && lhs.distance_to_stops == rhs.distance_to_stops;
+    }
+
+    bool operator==(const Descriptions::Bus &lhs, const Descriptions::Bus &rhs) {
+        return lhs.stops == rhs.stops && lhs.is_roundtrip == rhs.is_roundtrip;
+    }
+
+}
+
+void TransportGuide::ApplyChanges(const Descriptions::Changes &changes) {
+    // changed entries as they end up, nullopt for removed ones
+    std::map<std::string, std::optional<Descriptions::Stop>> stops;
+    std::map<std::string, std::optional<Descriptions::Bus>> buses;
+    auto find_stop = [&](const std::string &name) -> const Descriptions::Stop * {
+        if (auto it = stops.find(name); it != stops.end()) {
+            return it->second ? &*it->second : nullptr;
+        }
+        auto it = database_->stop_descriptions.find(name);
+        return it != database_->stop_descriptions.end() ? &it->second : nullptr;
+    };
+    auto find_bus = [&](const std::string &name) -> const Descriptions::Bus * {
+        if (auto it = buses.find(name); it != buses.end()) {
+            return it->second ? &*it->second : nullptr;
+        }
+        auto it = database_->bus_descriptions.find(name);
+        return it != database_->bus_descriptions.end() ? &it->second : nullptr;
+    };
+
+    bool removes_stops = false;
+    for (const auto &change: changes) {
+        if (std::holds_alternative<Descriptions::Stop>(change)) {
+            const auto &stop = std::get<Descriptions::Stop>(change);
+            stops[stop.name] = stop;
+        } else if (std::holds_alternative<Descriptions::Bus>(change)) {
+            const auto &bus = std::get<Descriptions::Bus>(change);
+            buses[bus.name] = bus;
+        } else if (std::holds_alternative<Descriptions::RemoveStop>(change)) {
+            const auto &name = std::get<Descriptions::RemoveStop>(change).name;
+            if (!find_stop(name)) {
+                throw std::invalid_argument("no stop " + name + " to remove");
+            }
+            stops[name] = std::nullopt;
+            removes_stops = true;
+        } else if (std::holds_alternative<Descriptions::RemoveBus>(change)) {
+            const auto &name = std::get<Descriptions::RemoveBus>(change).name;
+            if (!find_bus(name)) {
+                throw std::invalid_argument("no bus " + name + " to remove");
+            }
+            buses[name] = std::nullopt;
+        } else {
+            const auto &[from, to, distance] = std::get<Descriptions::Distance>(change);
+            const auto *from_stop = find_stop(from);
+            if (!from_stop || !find_stop(to)) {
+                throw std::invalid_argument("no stops " + from + " and " + to + " to set the distance between");
+            }
+            auto stop = *from_stop;
+            auto it = std::find_if(stop.distance_to_stops.begin(), stop.distance_to_stops.end(),
+                                   [&](const auto &item) { return item.first == to; });
+            if (it != stop.distance_to_stops.end()) {
+                it->second = distance;
+            } else {
+                stop.distance_to_stops.emplace_back(to, distance);
+            }
+            stops[from] = std::move(stop);
+        }
+    }
+    if (removes_stops) {
+        // distances to removed stops go with them
+        auto drop_removed = [&](const Descriptions::Stop &stop) {
+            auto kept = stop;
+            kept.distance_to_stops.erase(std::remove_if(
+                    kept.distance_to_stops.begin(), kept.distance_to_stops.end(),
+                    [&](const auto &item) { return !find_stop(item.first); }), kept.distance_to_stops.end());
+            if (kept.distance_to_stops.size() != stop.distance_to_stops.size()) {
+                stops[stop.name] = std::move(kept);
+            }
+        };
+        for (const auto &[name, stop]: database_->stop_descriptions) {
+            if (!stops.count(name)) {
+                drop_removed(stop);
+            }
+        }
+        for (const auto &[name, stop]: stops) {
+            if (stop) {
+                drop_removed(*stop);
+            }
+        }
+    }
+
+    // changes leaving an entry as it was are dropped
+    for (auto it = stops.begin(); it != stops.end();) {
+        auto old = database_->stop_descriptions.find(it->first);
+        const bool same = old != database_->stop_descriptions.end()
+                          ? it->second && *it->second == old->second
+                          : !it->second;
+        it = same ? stops.erase(it) : std::next(it);
+    }
+    for (auto it = buses.begin(); it != buses.end();) {
+        auto old = database_->bus_descriptions.find(it->first);
+        const bool same = old != database_->bus_descriptions.end()
+                          ? it->second && *it->second == old->second
+                          : !it->second;
+        it = same ? buses.erase(it) : std::next(it);
+    }
+    if (stops.empty() && buses.empty()) {
+        return;
+    }
+
+    // every route touching a changed stop must still run over known stops with known distances
+    std::set<std::string_view> checked_buses;
+    for (const auto &[name, bus]: buses) {
+        checked_buses.insert(name);
+    }
+    for (const auto &[name, stop]: stops) {
+        if (stop) {
+            for (const auto &[name_to, distance]: stop->distance_to_stops) {
+                if (!find_stop(name_to)) {
+                    throw std::invalid_argument("stop " + name + " has a distance to unknown stop " + name_to);
                 }
-        );
+            }
+        }
+        if (auto it = stop_responses_.find(name); it != stop_responses_.end()) {
+            checked_buses.insert(it->second.busses.begin(), it->second.busses.end());
+        }
+    }
+    for (const auto bus_name: checked_buses) {
+        const auto *bus = find_bus(std::string(bus_name));
+        if (!bus) {
+            continue;
+        }
+        for (size_t i = 0; i < bus->stops.size(); ++i) {
+            const auto *stop = find_stop(bus->stops[i]);
+            if (!stop) {
+                throw std::invalid_argument("bus " + bus->name + " stops at unknown stop " + bus->stops[i]);
+            }
+            if (i > 0 && !FindDistance(*find_stop(bus->stops[i - 1]), bus->stops[i])
+                && !FindDistance(*stop, bus->stops[i - 1])) {
+                throw std::invalid_argument("no road distance from " + bus->stops[i - 1] + " to " + bus->stops[i]);
+            }
+        }
     }
 
-    router_->BuildMap(database_, routing_settings);
+    const bool stops_moved = std::any_of(stops.begin(), stops.end(), [&](const auto &item) {
+        auto old = database_->stop_descriptions.find(item.first);
+        return !item.second || old == database_->stop_descriptions.end()
+               || item.second->coordinates.latitude != old->second.coordinates.latitude
+               || item.second->coordinates.longitude != old->second.coordinates.longitude;
+    });
+
+    // stops whose bus lists change: the old and the new ones of every changed bus
+    std::set<std::string> affected_stops;
+    for (const auto &[name, bus]: buses) {
+        if (auto old = database_->bus_descriptions.find(name); old != database_->bus_descriptions.end()) {
+            affected_stops.insert(old->second.stops.begin(), old->second.stops.end());
+        }
+        if (bus) {
+            affected_stops.insert(bus->stops.begin(), bus->stops.end());
+        }
+    }
+
+    // bus lists view the names of the buses, so they let go of the changed ones before those are freed
+    for (const auto &name: affected_stops) {
+        if (auto it = stop_responses_.find(name); it != stop_responses_.end()) {
+            auto &stop_busses = it->second.busses;
+            stop_busses.erase(std::remove_if(stop_busses.begin(), stop_busses.end(), [&](std::string_view bus_name) {
+                return buses.count(std::string(bus_name));
+            }), stop_busses.end());
+        }
+    }
+
+    for (auto &[name, stop]: stops) {
+        if (stop) {
+            database_->stop_descriptions.insert_or_assign(name, std::move(*stop));
+        } else {
+            database_->stop_descriptions.erase(name);
+            stop_responses_.erase(name);
+            affected_stops.erase(name);
+        }
+    }
+    for (auto &[name, bus]: buses) {
+        if (bus) {
+            database_->bus_descriptions.insert_or_assign(name, std::move(*bus));
+        } else {
+            database_->bus_descriptions.erase(name);
+            bus_responses_.erase(name);
+        }
+    }
+
+    std::vector<std::string> stop_names, bus_names;
+    for (const auto &[name, stop]: stops) {
+        stop_names.push_back(name);
+    }
+    for (const auto &[name, bus]: buses) {
+        bus_names.push_back(name);
+    }
+    router_->ApplyChanges(*database_, stop_names, bus_names);
+
+    for (const auto &name: affected_stops) {
+        auto &stop_busses = stop_responses_[name].busses;
+        for (const auto &[bus_name, bus]: buses) {
+            if (auto it = database_->bus_descriptions.find(bus_name); it != database_->bus_descriptions.end()) {
+                const auto &route_stops = it->second.stops;
+                if (std::find(route_stops.begin(), route_stops.end(), name) != route_stops.end()) {
+                    stop_busses.push_back(it->first);
+                }
+            }
+        }
+        std::sort(stop_busses.begin(), stop_busses.end());
+    }
+    for (const auto &[name, stop]: stops) {
+        if (stop) {
+            stop_responses_.emplace(database_->stop_descriptions.find(name)->first, Response::Stop{});
+        }
+    }
+
+    // route lengths and curvatures change with the buses and the stops they pass
+    std::set<std::string_view> affected_buses;
+    for (const auto &[name, bus]: buses) {
+        if (bus) {
+            affected_buses.insert(name);
+        }
+    }
+    for (const auto &[name, stop]: stops) {
+        if (stop) {
+            const auto &stop_busses = stop_responses_.at(name).busses;
+            affected_buses.insert(stop_busses.begin(), stop_busses.end());
+        }
+    }
+    for (const auto bus_name: affected_buses) {
+        const auto &bus = database_->bus_descriptions.at(std::string(bus_name));
+        bus_responses_.insert_or_assign(bus.name, MakeBusResponse(bus));
+    }
 
-    renderer_ = std::make_unique<Render::Renderer>(Render::RenderData{database_, render_settings});
+    if (!buses.empty()) {
+        FillAdjacentStops();
+    }
+    if (stops_moved || !buses.empty()) {
+        BuildStopIndex();
+        BuildRenderers();
+    }
+}
+
+const Render::Renderer *TransportGuide::FindRenderer(const std::string &profile) const {
+    if (profile.empty()) {
+        return renderer_.get();
+    }
+    if (auto it = profile_renderers_.find(profile); it != profile_renderers_.end()) {
+        return it->second.get();
+    }
+    return nullptr;
 }
 
-std::optional<Response::Stop> TransportGuide::GetStop(const std::string &name) const {
+const Response::Stop *TransportGuide::GetStop(const std::string &name) const {
     if (auto response = stop_responses_.find(name); response != stop_responses_.end()) {
-        return response->second;
+        return &response->second;
     }
-    return std::nullopt;
+    return nullptr;
 }
 
-std::optional<Response::Bus> TransportGuide::GetBus(const std::string &name) const {
+const Response::Bus *TransportGuide::GetBus(const std::string &name) const {
     if (auto response = bus_responses_.find(name); response != bus_responses_.end()) {
-        return response->second;
+        return &response->second;
     }
-    return std::nullopt;
+    return nullptr;
+}
+
+std::optional<Response::CommonBuses> TransportGuide::GetCommonBuses(const std::string &from,
+                                                                   const std::string &to) const {
+    auto from_it = stop_ids_.find(from), to_it = stop_ids_.find(to);
+    if (from_it == stop_ids_.end() || to_it == stop_ids_.end()) {
+        return std::nullopt;
+    }
+    Response::CommonBuses response;
+    for (const size_t bus_id: stop_bus_sets_.FindCommon(from_it->second, to_it->second)) {
+        response.buses.push_back(bus_names_[bus_id]);
+    }
+    return response;
 }
 
-std::optional<Response::Route> TransportGuide::GetRoute(const std::string &from, const std::string &to) const {
+std::optional<Response::ReachableStops> TransportGuide::GetReachableStops(const std::string &from,
+                                                                         double max_time) const {
+    return router_->GetReachableStops(from, max_time);
+}
+
+std::optional<Response::Matrix> TransportGuide::GetMatrix(const std::vector<std::string> &from,
+                                                         const std::vector<std::string> &to) const {
+    return router_->GetMatrix(from, to);
+}
+
+std::optional<Response::Route> TransportGuide::GetRoute(const std::string &from, const std::string &to,
+                                                       const Render::MapFormat &format,
+                                                       const std::string &profile,
+                                                       Render::RouteMap route_map) const {
+    const auto *renderer = FindRenderer(profile);
+    if (!renderer) {
+        return std::nullopt;
+    }
     if (auto response = router_->GetRoute(from, to)) {
-        response->map = renderer_->RenderRoute(response->items);
+        RenderRouteMap(*renderer, format, route_map, *response);
         return response;
     }
     return std::nullopt;
 }
 
-Response::Map TransportGuide::GetMap() const {
-    return renderer_->RenderMap();
+std::vector<std::optional<Response::Route>> TransportGuide::GetRoutes(const std::string &from,
+                                                                      const std::vector<RouteQuery> &queries) const {
+    std::vector<std::string> to;
+    to.reserve(queries.size());
+    for (const auto &query: queries) {
+        to.push_back(query.to);
+    }
+    auto responses = router_->GetRoutes(from, to);
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const auto *renderer = FindRenderer(queries[i].profile);
+        if (!renderer) {
+            responses[i].reset();
+        } else if (responses[i]) {
+            RenderRouteMap(*renderer, queries[i].format, queries[i].route_map, *responses[i]);
+        }
+    }
+    return responses;
+}
+
+void TransportGuide::RenderRouteMap(const Render::Renderer &renderer, const Render::MapFormat &format,
+                                    Render::RouteMap route_map, Response::Route &route) {
+    Metrics::PhaseTimer timer(Metrics::Phase::Rendering);
+    switch (route_map) {
+        case Render::RouteMap::None:
+            break;
+        case Render::RouteMap::Overlay:
+            route.map = renderer.RenderRouteOverlay(route.items, format);
+            route.base_map_hash = renderer.GetMapHash();
+            break;
+        case Render::RouteMap::Full:
+            route.map = renderer.RenderRoute(route.items, format);
+            break;
+    }
+}
+
+std::optional<Response::Map> TransportGuide::GetMap(const Render::MapFormat &format, uint32_t lod,
+                                                   const std::string &profile) const {
+    if (const auto *renderer = FindRenderer(profile)) {
+        Metrics::PhaseTimer timer(Metrics::Phase::Rendering);
+        return renderer->RenderMap(format, lod);
+    }
+    return std::nullopt;
+}
+
+Response::NearbyStops TransportGuide::GetNearbyStops(Coordinates::Point center, std::optional<size_t> count,
+                                                     std::optional<double> radius) const {
+    Response::NearbyStops response;
+    for (const auto &[id, distance]: stop_locator_.Find(center, count, radius)) {
+        response.items.push_back({stop_names_[id], distance});
+    }
+    return response;
+}
+
+Response::Map TransportGuide::GetViewport(const Render::Box &box) const {
+    Metrics::PhaseTimer timer(Metrics::Phase::Rendering);
+    return renderer_->RenderViewport(box);
+}
+
+Response::Map TransportGuide::GetTile(uint32_t zoom, uint32_t x, uint32_t y) const {
+    Metrics::PhaseTimer timer(Metrics::Phase::Rendering);
+    return renderer_->RenderTile(zoom, x, y);
 }
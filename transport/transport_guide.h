@@ -2,6 +2,8 @@
 
 #include "transport_render.h"
 #include "transport_router.h"
+#include "nearest_index.h"
+#include "bus_sets.h"
 
 #include <utility>
 #include <memory>
@@ -10,27 +12,108 @@
 
 class TransportGuide {
 public:
+    // a Route query, less its origin
+    struct RouteQuery {
+        std::string to;
+        Render::MapFormat format;
+        std::string profile;
+        Render::RouteMap route_map = Render::RouteMap::Full;
+    };
+
     explicit TransportGuide(Descriptions::Data data, Transport::RoutingSettings routing_settings,
-                            Render::SettingsPtr render_settings);
+                            Render::SettingsPtr render_settings, const Render::Profiles &render_profiles = {});
+
+    // Applies the changes as one update. Only what they affect is recomputed: the responses of
+    // the changed stops and buses and of the buses passing changed stops, and the route table,
+    // in place if no route gets slower. Maps are redrawn only if stops move or buses change.
+    // Throws std::invalid_argument, leaving the guide as it was, if the result is inconsistent.
+    void ApplyChanges(const Descriptions::Changes &changes);
+
+    // a guide built anew from the current network and settings, sharing no state with this one
+    std::unique_ptr<TransportGuide> Rebuild() const;
+
+    // the stops and buses of the network as it is now
+    Descriptions::Data GetDescriptions() const;
+
+    // approximate bytes held by the guide, counting the structures that grow with the network:
+    // the route table, the distances, the responses and the maps
+    size_t EstimateMemory() const;
+
+    // nullptr if there is no such stop; points into the guide, no copy is made
+    const Response::Stop *GetStop(const std::string &name) const;
+
+    // nullptr if there is no such bus; points into the guide, no copy is made
+    const Response::Bus *GetBus(const std::string &name) const;
+
+    // buses stopping at both stops, for direct trips; nullopt if either stop is unknown
+    std::optional<Response::CommonBuses> GetCommonBuses(const std::string &from, const std::string &to) const;
+
+    // stops reachable from `from` within `max_time` minutes, with arrival times; no map is drawn
+    std::optional<Response::ReachableStops> GetReachableStops(const std::string &from, double max_time) const;
 
-    std::optional<Response::Stop> GetStop(const std::string &name) const;
+    // travel times from every stop of `from` to every stop of `to`; nullopt if any stop is unknown
+    std::optional<Response::Matrix> GetMatrix(const std::vector<std::string> &from,
+                                              const std::vector<std::string> &to) const;
 
-    std::optional<Response::Bus> GetBus(const std::string &name) const;
+    // maps are drawn with the named render profile, or with render_settings if `profile` is empty;
+    // nullopt if there is no route or no such profile
+    std::optional<Response::Route> GetRoute(const std::string &from, const std::string &to,
+                                            const Render::MapFormat &format = {},
+                                            const std::string &profile = {},
+                                            Render::RouteMap route_map = Render::RouteMap::Full) const;
 
-    std::optional<Response::Route> GetRoute(const std::string &from, const std::string &to) const;
+    // answers of GetRoute for queries sharing the origin, in their order, from a single search
+    std::vector<std::optional<Response::Route>> GetRoutes(const std::string &from,
+                                                          const std::vector<RouteQuery> &queries) const;
 
-    Response::Map GetMap() const;
+    // `lod` above 0 asks for a simplified overview map; nullopt if there is no such profile
+    std::optional<Response::Map> GetMap(const Render::MapFormat &format = {}, uint32_t lod = 0,
+                                        const std::string &profile = {}) const;
+
+    // up to `count` stops closest to the point, no farther than `radius` metres
+    Response::NearbyStops GetNearbyStops(Coordinates::Point center, std::optional<size_t> count,
+                                         std::optional<double> radius) const;
+
+    Response::Map GetViewport(const Render::Box &box) const;
+
+    Response::Map GetTile(uint32_t zoom, uint32_t x, uint32_t y) const;
 
 private:
     double CalculateDirectLength(const Descriptions::DictStop &stop_descriptions,
-                                 const std::vector<std::string> &route_stops);
+                                 const std::vector<std::string> &route_stops) const;
 
     int64_t CalculateRouteLength(const std::vector<std::string> &route_stops) const;
 
+    Response::Bus MakeBusResponse(const Descriptions::Bus &bus) const;
+
+    void FillAdjacentStops();
+
+    // stop_names_, stop_locator_, stop_ids_, bus_names_ and stop_bus_sets_
+    void BuildStopIndex();
+
+    void BuildRenderers();
+
+    // nullptr if there is no such profile
+    const Render::Renderer *FindRenderer(const std::string &profile) const;
+
+    static void RenderRouteMap(const Render::Renderer &renderer, const Render::MapFormat &format,
+                               Render::RouteMap route_map, Response::Route &route);
+
 private:
+    Render::SettingsPtr render_settings_;
+    Render::Profiles render_profiles_;
     Data::DataPtr database_;
     std::unordered_map<std::string, Response::Stop> stop_responses_;
     std::unordered_map<std::string, Response::Bus> bus_responses_;
+    // stop names in dictionary order, ids of stop_locator_
+    std::vector<std::string_view> stop_names_;
+    Coordinates::NearestIndex stop_locator_;
+    std::unordered_map<std::string_view, size_t> stop_ids_;
+    // bus names in dictionary order, ids of stop_bus_sets_
+    std::vector<std::string_view> bus_names_;
+    Transport::StopBusSets stop_bus_sets_;
     std::unique_ptr<Transport::TransportRouter> router_;
     std::unique_ptr<Render::Renderer> renderer_;
+    // profiles share the database and the router, and layouts where the sizes match
+    std::unordered_map<std::string, std::unique_ptr<Render::Renderer>> profile_renderers_;
 };
@@ -1,173 +1,212 @@
 #include "transport_render.h"
+#include "metrics.h"
 #include "utils.h"
+#include "parallel.h"
+#include "raster.h"
+#include "png.h"
+#include "trace.h"
 
 #include <algorithm>
+#include <cmath>
 #include <stack>
+#include <stdexcept>
 #include <utility>
 
 namespace Render {
 
-    RenderData RenderDataOptimizer::Optimize() {
-        UniformStops();
-        CompressCoordinates();
-        return render_data_;
+    Layout RenderDataOptimizer::Optimize() const {
+        Trace::Span span("RenderDataOptimizer::Optimize");
+        const auto &database = *render_data_.database;
+        Layout layout;
+        std::vector<Coordinates::Point> coordinates;
+        layout.stop_names.reserve(database.stop_descriptions.size());
+        coordinates.reserve(database.stop_descriptions.size());
+        for (const auto &[stop_name, stop]: database.stop_descriptions) {
+            layout.stop_ids.emplace(stop_name, layout.stop_names.size());
+            layout.stop_names.push_back(stop_name);
+            coordinates.push_back(stop.coordinates);
+        }
+        layout.bus_names.reserve(database.bus_descriptions.size());
+        layout.bus_stops.reserve(database.bus_descriptions.size());
+        for (const auto &[bus_name, bus]: database.bus_descriptions) {
+            layout.bus_ids.emplace(bus_name, layout.bus_names.size());
+            layout.bus_names.push_back(bus_name);
+            auto &stop_ids = layout.bus_stops.emplace_back();
+            stop_ids.reserve(bus.stops.size());
+            for (const auto &stop_name: bus.stops) {
+                stop_ids.push_back(layout.stop_ids.at(stop_name));
+            }
+        }
+
+        UniformStops(layout, coordinates);
+        CompressCoordinates(layout, coordinates);
+
+        layout.positions.reserve(coordinates.size());
+        for (const auto &point: coordinates) {
+            layout.positions.emplace_back(point.longitude, point.latitude);
+        }
+        return layout;
     }
 
-    bool RenderDataOptimizer::IsMainStop(std::string_view stop_name, std::string_view bus_name) {
-        if (IsFinishStop(render_data_.database, stop_name, bus_name)) {
-            return true;
+    std::vector<std::vector<bool>> RenderDataOptimizer::FindMainStops(const Layout &layout) const {
+        Trace::Span span("RenderDataOptimizer::FindMainStops");
+        // a stop is main for a bus if it is the bus' terminal, if another bus arrives at it,
+        // or if the bus itself arrives at it at least three times
+        std::vector<int> arrivals(layout.stop_names.size());
+        for (const auto &route: layout.bus_stops) {
+            for (size_t i = 1; i < route.size(); ++i) {
+                ++arrivals[route[i]];
+            }
         }
-        int cur_bus_cnt = 0;
-        int unique_bus_cnt = 1;
-        for (auto &[adj_stop_name, adj_bus_name, is_cur_next_on_route]
-                : render_data_.database->adjacent_stops[stop_name]) {
-            if (!is_cur_next_on_route) {
-                continue;
+        std::vector<std::vector<bool>> is_main(layout.bus_stops.size());
+        std::vector<int> bus_arrivals(layout.stop_names.size());
+        for (size_t bus_id = 0; bus_id < layout.bus_stops.size(); ++bus_id) {
+            const auto &route = layout.bus_stops[bus_id];
+            const auto &bus = render_data_.database->bus_descriptions.at(std::string(layout.bus_names[bus_id]));
+            for (size_t i = 1; i < route.size(); ++i) {
+                ++bus_arrivals[route[i]];
             }
-            cur_bus_cnt += (bus_name == adj_bus_name);
-            unique_bus_cnt += (bus_name != adj_bus_name);
-            if (cur_bus_cnt == 3 || unique_bus_cnt == 2) {
-                return true;
+            is_main[bus_id].resize(route.size());
+            for (size_t i = 0; i < route.size(); ++i) {
+                const size_t stop = route[i];
+                const bool is_finish = stop == route.front()
+                                       || (!bus.is_roundtrip && stop == route[route.size() / 2]);
+                is_main[bus_id][i] = is_finish
+                                     || arrivals[stop] > bus_arrivals[stop]
+                                     || bus_arrivals[stop] >= 3;
+            }
+            for (size_t i = 1; i < route.size(); ++i) {
+                bus_arrivals[route[i]] = 0;
             }
         }
-        return false;
+        return is_main;
     }
 
-    void RenderDataOptimizer::UniformStops() {
-        for (auto &[bus_name, bus]: render_data_.database->bus_descriptions) {
-            std::string prev_main_stop;
-            std::stack<std::string> secondary_stops;
-            bool first = true;
-            for (auto &stop_name: bus.stops) {
-                if (first) {
-                    first = false;
-                    prev_main_stop = stop_name;
+    void RenderDataOptimizer::UniformStops(const Layout &layout,
+                                           std::vector<Coordinates::Point> &coordinates) const {
+        Trace::Span span("RenderDataOptimizer::UniformStops");
+        const auto is_main = FindMainStops(layout);
+        std::vector<size_t> secondary_stops;
+        for (size_t bus_id = 0; bus_id < layout.bus_stops.size(); ++bus_id) {
+            const auto &route = layout.bus_stops[bus_id];
+            if (route.empty()) {
+                continue;
+            }
+            size_t prev_main_stop = route.front();
+            secondary_stops.clear();
+            for (size_t i = 1; i < route.size(); ++i) {
+                const size_t stop = route[i];
+                if (!is_main[bus_id][i]) {
+                    secondary_stops.push_back(stop);
                     continue;
                 }
-                if (IsMainStop(stop_name, bus_name)) {
-                    const int cnt = static_cast<int>(secondary_stops.size());
-                    const auto from = render_data_.database->stop_descriptions[stop_name].coordinates;
-                    const auto to = render_data_.database->stop_descriptions[prev_main_stop].coordinates;
-                    const double lon_step = (to.longitude - from.longitude) / (cnt + 1);
-                    const double lat_step = (to.latitude - from.latitude) / (cnt + 1);
-                    int id = 0;
-                    while (!secondary_stops.empty()) {
-                        auto *secondary_stop =
-                                &render_data_.database->stop_descriptions[secondary_stops.top()];
-                        secondary_stops.pop();
-                        secondary_stop->coordinates.longitude = from.longitude + lon_step * (id + 1);
-                        secondary_stop->coordinates.latitude = from.latitude + lat_step * (id + 1);
-                        ++id;
-                    }
-                    prev_main_stop = stop_name;
-                } else {
-                    secondary_stops.push(stop_name);
+                const int cnt = static_cast<int>(secondary_stops.size());
+                const auto from = coordinates[stop];
+                const auto to = coordinates[prev_main_stop];
+                const double lon_step = (to.longitude - from.longitude) / (cnt + 1);
+                const double lat_step = (to.latitude - from.latitude) / (cnt + 1);
+                // walk back from the current main stop
+                int id = 0;
+                while (!secondary_stops.empty()) {
+                    auto &secondary_stop = coordinates[secondary_stops.back()];
+                    secondary_stops.pop_back();
+                    secondary_stop.longitude = from.longitude + lon_step * (id + 1);
+                    secondary_stop.latitude = from.latitude + lat_step * (id + 1);
+                    ++id;
                 }
+                prev_main_stop = stop;
             }
         }
     }
 
-    void RenderDataOptimizer::CompressCoordinates() {
-        std::vector<Descriptions::Stop *> stops;
-        for (auto &[stop_name, stop]: render_data_.database->stop_descriptions) {
-            stops.push_back(&stop);
+    void RenderDataOptimizer::CompressCoordinates(const Layout &layout,
+                                                  std::vector<Coordinates::Point> &coordinates) const {
+        Trace::Span span("RenderDataOptimizer::CompressCoordinates");
+        if (coordinates.empty()) {
+            return;
         }
+        std::vector<std::vector<size_t>> neighbours(coordinates.size());
+        for (const auto &route: layout.bus_stops) {
+            for (size_t i = 1; i < route.size(); ++i) {
+                neighbours[route[i]].push_back(route[i - 1]);
+                neighbours[route[i - 1]].push_back(route[i]);
+            }
+        }
+        const auto &settings = *render_data_.render_settings;
+
+        std::vector<size_t> order(coordinates.size());
+        for (size_t id = 0; id < order.size(); ++id) {
+            order[id] = id;
+        }
+        std::vector<size_t> grouped_until;
         {
-            std::sort(stops.begin(), stops.end(),
-                      [](Descriptions::Stop *lhs, Descriptions::Stop *rhs) {
-                          return lhs->coordinates.longitude < rhs->coordinates.longitude;
-                      });
-            std::vector<std::vector<Descriptions::Stop *>> grouped;
-            grouped.emplace_back();
-            int top = 0;
-            std::optional<double> prev_lon;
-            for (auto &stop_ptr: stops) {
-                if (prev_lon && stop_ptr->coordinates.longitude != *prev_lon) {
-                    grouped.emplace_back();
-                    ++top;
+            std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+                return coordinates[lhs].longitude < coordinates[rhs].longitude;
+            });
+            for (size_t pos = 1; pos < order.size(); ++pos) {
+                if (coordinates[order[pos]].longitude != coordinates[order[pos - 1]].longitude) {
+                    grouped_until.push_back(pos);
                 }
-                grouped[top].push_back(stop_ptr);
-                prev_lon = stop_ptr->coordinates.longitude;
             }
-            auto ids = EnumerateStops(grouped, stops.size());
+            grouped_until.push_back(order.size());
+            auto ids = EnumerateStops(neighbours, order, grouped_until);
             int unique_id_cnt = *std::max_element(ids.begin(), ids.end());
             double x_step = (unique_id_cnt > 0
-                             ? (render_data_.render_settings->width
-                                - 2 * render_data_.render_settings->padding) / unique_id_cnt
+                             ? (settings.width - 2 * settings.padding) / unique_id_cnt
                              : 0
             );
-            int id = 0;
-            for (auto &stop: stops) {
-                stop->coordinates.longitude = render_data_.render_settings->padding + x_step * ids[id];
-                ++id;
+            for (size_t pos = 0; pos < order.size(); ++pos) {
+                coordinates[order[pos]].longitude = settings.padding + x_step * ids[pos];
             }
         }
+        grouped_until.clear();
         {
-            std::sort(stops.begin(), stops.end(),
-                      [](Descriptions::Stop *lhs, Descriptions::Stop *rhs) {
-                          return lhs->coordinates.latitude < rhs->coordinates.latitude;
-                      });
-            std::vector<std::vector<Descriptions::Stop *>> grouped;
-            grouped.emplace_back();
-            int top = 0;
-            std::optional<double> prev_lat;
-            for (auto &stop_ptr: stops) {
-                if (prev_lat && stop_ptr->coordinates.latitude != *prev_lat) {
-                    grouped.emplace_back();
-                    ++top;
+            std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+                return coordinates[lhs].latitude < coordinates[rhs].latitude;
+            });
+            // groups are split against the previous stop's projected x, as the layout always did
+            for (size_t pos = 1; pos < order.size(); ++pos) {
+                if (coordinates[order[pos]].latitude != coordinates[order[pos - 1]].longitude) {
+                    grouped_until.push_back(pos);
                 }
-                grouped[top].push_back(stop_ptr);
-                prev_lat = stop_ptr->coordinates.longitude;
             }
-            auto ids = EnumerateStops(grouped, stops.size());
+            grouped_until.push_back(order.size());
+            auto ids = EnumerateStops(neighbours, order, grouped_until);
             int unique_id_cnt = *std::max_element(ids.begin(), ids.end());
             double y_step = (unique_id_cnt > 0
-                             ? (render_data_.render_settings->height
-                                - 2 * render_data_.render_settings->padding) / unique_id_cnt
+                             ? (settings.height - 2 * settings.padding) / unique_id_cnt
                              : 0
             );
-            int id = 0;
-            for (auto &stop: stops) {
-                stop->coordinates.latitude = render_data_.render_settings->height
-                                             - render_data_.render_settings->padding - y_step * ids[id];
-                ++id;
+            for (size_t pos = 0; pos < order.size(); ++pos) {
+                coordinates[order[pos]].latitude = settings.height - settings.padding - y_step * ids[pos];
             }
         }
     }
 
     std::vector<int>
     RenderDataOptimizer::EnumerateStops(
-            const std::vector<std::vector<Descriptions::Stop *>> &grouped, size_t size) const {
-        std::vector<int> ids(size, -1);
-        std::unordered_map<std::string_view, int> name_to_pos;
-        int top = 0;
-        for (auto &group: grouped) {
-            for (auto &stop_ptr: group) {
-                name_to_pos[stop_ptr->name] = top;
-                ++top;
-            }
-        }
-        top = 0;
-        for (int i = 0; i < static_cast<int>(grouped[0].size()); ++i) {
+            const std::vector<std::vector<size_t>> &neighbours,
+            const std::vector<size_t> &order, const std::vector<size_t> &grouped_until) const {
+        Trace::Span span("RenderDataOptimizer::EnumerateStops");
+        std::vector<size_t> stop_pos(order.size());
+        for (size_t pos = 0; pos < order.size(); ++pos) {
+            stop_pos[order[pos]] = pos;
+        }
+        std::vector<int> ids(order.size(), -1);
+        size_t top = 0;
+        for (; top < grouped_until.front(); ++top) {
             ids[top] = 0;
-            ++top;
         }
-        auto find_group_id = [&](const std::vector<Descriptions::Stop *> &group) {
+        for (size_t group = 1; group < grouped_until.size(); ++group) {
+            const size_t group_begin = top;
             int max_id = -1;
-            for (auto &stop_ptr: group) {
-                for (auto &[adj_stop_name, adj_bus_name, is_cur_next_on_route]
-                        : render_data_.database->adjacent_stops[stop_ptr->name]) {
-                    max_id = std::max(max_id, ids[name_to_pos[adj_stop_name]]);
+            for (size_t pos = group_begin; pos < grouped_until[group]; ++pos) {
+                for (size_t neighbour: neighbours[order[pos]]) {
+                    max_id = std::max(max_id, ids[stop_pos[neighbour]]);
                 }
             }
-            return max_id + 1;
-        };
-        for (int i = 1; i < static_cast<int>(grouped.size()); ++i) {
-            auto &group = grouped[i];
-            int group_id = find_group_id(group);
-            for (int j = 0; j < static_cast<int>(group.size()); ++j) {
-                ids[top] = group_id;
-                ++top;
+            for (; top < grouped_until[group]; ++top) {
+                ids[top] = max_id + 1;
             }
         }
         return ids;
@@ -217,6 +256,23 @@ namespace Render {
         return result_layers;
     }
 
+    Svg::RenderOptions ReadSvgOptions(const std::map<std::string, Json::Node> &base_map) {
+        Svg::RenderOptions options;
+        if (auto it = base_map.find("svg_precision"); it != base_map.end()) {
+            if (it->second.AsDouble() < 0) {
+                throw std::invalid_argument("svg_precision must not be negative");
+            }
+            options.precision = static_cast<int>(it->second.AsDouble());
+        }
+        if (auto it = base_map.find("svg_style_classes"); it != base_map.end()) {
+            options.style_classes = it->second.AsBool();
+        }
+        if (auto it = base_map.find("svg_path_encoding"); it != base_map.end()) {
+            options.polyline_paths = it->second.AsBool();
+        }
+        return options;
+    }
+
     SettingsPtr ReadJson(const Json::Node &base_node) {
         const auto &base_map = base_node.AsMap();
         return std::make_shared<Settings>(Settings{
@@ -235,39 +291,55 @@ namespace Render {
                         base_map.at("bus_label_font_size").AsDouble()),
                 .bus_label_offset = ReadPoint(base_map.at("bus_label_offset")),
                 .layers = ReadLayers(base_map.at("layers")),
-                .outer_margin = base_map.at("outer_margin").AsDouble()
+                .outer_margin = base_map.at("outer_margin").AsDouble(),
+                .svg_options = ReadSvgOptions(base_map)
         });
     }
 
-    Svg::Point Renderer::GetPosition(Coordinates::Point point) {
-        return {
-                point.longitude,
-                point.latitude
-        };
+    Profiles ReadProfiles(const Json::Node &base_settings, const Json::Node &profiles) {
+        Profiles result;
+        for (const auto &[name, overrides]: profiles.AsMap()) {
+            auto settings = base_settings.AsMap();
+            for (const auto &[key, value]: overrides.AsMap()) {
+                settings[key] = value;
+            }
+            result.emplace(name, ReadJson(Json::Node(std::move(settings))));
+        }
+        return result;
     }
 
-    void Renderer::RenderBusLines() {
-        size_t bus_order_id = 0;
-        for (const auto &[bus_name, bus]: render_data_.database->bus_descriptions) {
+    std::vector<size_t> Renderer::GetBusLabelStops(size_t bus_id) const {
+        const auto &route = layout_->bus_stops[bus_id];
+        std::vector<size_t> label_stops;
+        if (route.empty()) {
+            return label_stops;
+        }
+        label_stops.push_back(0);
+        const auto &bus = render_data_.database->bus_descriptions.at(std::string(layout_->bus_names[bus_id]));
+        if (!bus.is_roundtrip && route.front() != route[route.size() / 2]) {
+            label_stops.push_back(route.size() / 2);
+        }
+        return label_stops;
+    }
+
+    void Renderer::RenderBusLines(Svg::Document *svg, size_t begin, size_t end) const {
+        for (size_t bus_id = begin; bus_id < end; ++bus_id) {
             Svg::Polyline polyline;
-            render_data_.database->bus_colors[bus_name] = render_data_.render_settings->color_palette[bus_order_id];
-            polyline.SetStrokeColor(render_data_.database->bus_colors[bus_name])
+            polyline.SetStrokeColor(bus_colors_[bus_id])
                     .SetStrokeWidth(render_data_.render_settings->line_width)
                     .SetStrokeLineCap("round")
                     .SetStrokeLineJoin("round");
-            for (const auto &stop_name: bus.stops) {
-                polyline.AddPoint(
-                        GetPosition(render_data_.database->stop_descriptions.at(stop_name).coordinates));
+            for (size_t stop_id: layout_->bus_stops[bus_id]) {
+                polyline.AddPoint(GetPosition(stop_id));
             }
-            (++bus_order_id) %= render_data_.render_settings->color_palette.size();
-            svg_.Add(std::move(polyline));
+            svg->Add(polyline);
         }
     }
 
-    void Renderer::RenderStopPoints() {
-        for (const auto &[stop_name, stop]: render_data_.database->stop_descriptions) {
-            svg_.Add(Svg::Circle{}
-                             .SetCenter(GetPosition(stop.coordinates))
+    void Renderer::RenderStopPoints(Svg::Document *svg, size_t begin, size_t end) const {
+        for (size_t stop_id = begin; stop_id < end; ++stop_id) {
+            svg->Add(Svg::Circle{}
+                             .SetCenter(GetPosition(stop_id))
                              .SetRadius(render_data_.render_settings->stop_radius)
                              .SetFillColor("white"));
         }
@@ -275,7 +347,7 @@ namespace Render {
 
     void Renderer::RenderSingleStopLabel(
             Svg::Document *svg, SettingsPtr render_settings,
-            const std::string &stop_name, Svg::Point position) {
+            std::string_view stop_name, Svg::Point position) {
         svg->Add(Svg::Text{}
                          .SetPoint(position)
                          .SetOffset(render_settings->stop_label_offset)
@@ -296,16 +368,16 @@ namespace Render {
                          .SetFillColor("black"));
     }
 
-    void Renderer::RenderStopLabels() {
-        for (const auto &[stop_name, stop]: render_data_.database->stop_descriptions) {
+    void Renderer::RenderStopLabels(Svg::Document *svg, size_t begin, size_t end) const {
+        for (size_t stop_id = begin; stop_id < end; ++stop_id) {
             RenderSingleStopLabel(
-                    &svg_, render_data_.render_settings, stop_name, GetPosition(stop.coordinates));
+                    svg, render_data_.render_settings, layout_->stop_names[stop_id], GetPosition(stop_id));
         }
     }
 
     void Renderer::RenderSingleBusLabel(
             Svg::Document *svg, SettingsPtr render_settings,
-            const std::string &bus_name, Svg::Point position, Svg::Color color) {
+            std::string_view bus_name, Svg::Point position, Svg::Color color) {
         svg->Add(Svg::Text{}
                          .SetPoint(position)
                          .SetOffset(render_settings->bus_label_offset)
@@ -328,42 +400,150 @@ namespace Render {
                          .SetFillColor(color));
     }
 
-    void Renderer::RenderBusLabels() {
-        size_t bus_order_id = 0;
-        for (const auto &[bus_name, bus]: render_data_.database->bus_descriptions) {
-            auto color = render_data_.render_settings->color_palette[bus_order_id];
-            auto position = GetPosition(
-                    render_data_.database->stop_descriptions.at(bus.stops.front()).coordinates);
-            RenderSingleBusLabel(
-                    &svg_, render_data_.render_settings, bus_name, position, color);
-            if (!bus.is_roundtrip && bus.stops.front() != bus.stops[bus.stops.size() / 2]) {
-                position = GetPosition(
-                        render_data_.database->stop_descriptions.at(bus.stops[bus.stops.size() / 2]).coordinates);
+    void Renderer::RenderBusLabels(Svg::Document *svg, size_t begin, size_t end) const {
+        const auto &palette = render_data_.render_settings->color_palette;
+        for (size_t bus_id = begin; bus_id < end; ++bus_id) {
+            for (size_t stop_index: GetBusLabelStops(bus_id)) {
                 RenderSingleBusLabel(
-                        &svg_, render_data_.render_settings, bus_name, position, color);
+                        svg, render_data_.render_settings, layout_->bus_names[bus_id],
+                        GetPosition(layout_->bus_stops[bus_id][stop_index]), palette[bus_id % palette.size()]);
             }
-            (++bus_order_id) %= render_data_.render_settings->color_palette.size();
         }
     }
 
-    const std::unordered_map<std::string, void (Renderer::*)()> Renderer::kCallLayer = {
-            {"bus_lines",   &Renderer::RenderBusLines},
-            {"bus_labels",  &Renderer::RenderBusLabels},
-            {"stop_points", &Renderer::RenderStopPoints},
-            {"stop_labels", &Renderer::RenderStopLabels}
+    const std::unordered_map<std::string, Renderer::Layer> Renderer::kCallLayer = {
+            {"bus_lines",   {&Renderer::RenderBusLines,   true}},
+            {"bus_labels",  {&Renderer::RenderBusLabels,  true}},
+            {"stop_points", {&Renderer::RenderStopPoints, false}},
+            {"stop_labels", {&Renderer::RenderStopLabels, false}}
     };
 
-    Renderer::Renderer(RenderData render_data)
-            : render_data_(RenderDataOptimizer(std::move(render_data)).Optimize()) {
+    // shards are large enough for a thread to be worth starting
+    constexpr size_t kShardItems = 256;
+    constexpr size_t kChunkObjects = 1024;
+
+    void Renderer::RenderLayers() {
+        Trace::Span span("Renderer::RenderLayers");
+        struct Shard {
+            // the key in kCallLayer, which outlives the trace
+            std::string_view name;
+            const Layer *layer;
+            size_t begin;
+            size_t end;
+        };
+        std::vector<Shard> shards;
         for (const auto &layer_name: render_data_.render_settings->layers) {
-            (this->*kCallLayer.at(layer_name))();
+            const auto it = kCallLayer.find(layer_name);
+            if (it == kCallLayer.end()) {
+                throw std::out_of_range("unknown layer " + layer_name);
+            }
+            const auto &layer = it->second;
+            const size_t count = layer.by_buses ? layout_->bus_names.size() : layout_->stop_names.size();
+            for (size_t begin = 0; begin < count; begin += kShardItems) {
+                shards.push_back({it->first, &layer, begin, std::min(count, begin + kShardItems)});
+            }
+        }
+        std::vector<Svg::Document> documents(shards.size());
+        ParallelFor(shards.size(), [&](size_t i) {
+            const auto &shard = shards[i];
+            Trace::Span shard_span(shard.name);
+            (this->*shard.layer->render)(&documents[i], shard.begin, shard.end);
+        });
+        for (const auto &document: documents) {
+            svg_.Append(document);
+        }
+    }
+
+    void Renderer::SerializeMap() {
+        Trace::Span span("Renderer::SerializeMap");
+        const auto &options = render_data_.render_settings->svg_options;
+        Svg::Document::RenderHeader(map_);
+        const auto class_styles = svg_.RenderStyles(map_, options, map_state_);
+
+        const size_t object_count = svg_.GetObjectCount();
+        const size_t chunk_count = (object_count + kChunkObjects - 1) / kChunkObjects;
+        std::vector<Svg::FormatState> states;
+        states.reserve(chunk_count);
+        for (size_t begin = 0; begin < object_count; begin += kChunkObjects) {
+            states.push_back(map_state_);
+            svg_.SkipObjects(options, map_state_, begin, std::min(object_count, begin + kChunkObjects));
+        }
+        std::vector<std::string> chunks(chunk_count);
+        ParallelFor(chunk_count, [&](size_t i) {
+            Trace::Span chunk_span("svg chunk");
+            const size_t begin = i * kChunkObjects;
+            svg_.RenderObjects(chunks[i], options, states[i], class_styles,
+                               begin, std::min(object_count, begin + kChunkObjects));
+        });
+
+        size_t size = map_.size() + Svg::Document::kFooter.size();
+        for (const auto &chunk: chunks) {
+            size += chunk.size();
+        }
+        map_.reserve(size);
+        for (const auto &chunk: chunks) {
+            map_ += chunk;
+        }
+        Svg::Document::RenderFooter(map_);
+        map_hash_ = HashFnv1a(map_);
+    }
+
+    Renderer::Renderer(RenderData render_data)
+            : Renderer(render_data, std::make_shared<Layout>(RenderDataOptimizer(render_data).Optimize())) {}
+
+    Renderer::Renderer(RenderData render_data, LayoutPtr layout)
+            : render_data_(std::move(render_data)),
+              layout_(std::move(layout)),
+              bus_colors_(layout_->bus_names.size()) {
+        const auto &settings = *render_data_.render_settings;
+        if (std::find(settings.layers.begin(), settings.layers.end(), "bus_lines") != settings.layers.end()) {
+            for (size_t bus_id = 0; bus_id < bus_colors_.size(); ++bus_id) {
+                bus_colors_[bus_id] = settings.color_palette[bus_id % settings.color_palette.size()];
+            }
         }
+        RenderLayers();
+        SerializeMap();
+        BuildSpatialIndex();
     }
 
-    Response::Map Renderer::RenderMap() {
-        std::ostringstream os;
-        svg_.Render(os);
-        return {os.str()};
+    Response::Map Renderer::RenderMap(const MapFormat &format, uint32_t lod) const {
+        if (lod > 0) {
+            const auto &lod_map = GetLodMap(lod);
+            if (format.type == MapFormat::Type::Png) {
+                return RasterizeMap(format, lod_map.svg, nullptr);
+            }
+            return {lod_map.map};
+        }
+        if (format.type == MapFormat::Type::Png) {
+            return RasterizeMap(format, svg_, nullptr);
+        }
+        return {map_};
+    }
+
+    const Renderer::LodMap &Renderer::GetLodMap(uint32_t lod) const {
+        auto &lod_map = lod_maps_.at(std::min(lod, kMaxLod));
+        bool built = false;
+        std::call_once(lod_map.built, [&] {
+            lod_map.svg = LodHelper(*this, std::min(lod, kMaxLod)).GetSvg();
+            Svg::FormatState state;
+            Svg::Document::RenderHeader(lod_map.map);
+            lod_map.svg.RenderObjects(lod_map.map, render_data_.render_settings->svg_options, state);
+            Svg::Document::RenderFooter(lod_map.map);
+            built = true;
+        });
+        Metrics::Add(built ? Metrics::Counter::LodMapBuilds : Metrics::Counter::LodMapHits);
+        return lod_map;
+    }
+
+    Response::Map Renderer::RasterizeMap(const MapFormat &format, const Svg::Document &base,
+                                         const Svg::Document *overlay) const {
+        const auto &settings = *render_data_.render_settings;
+        Raster::Canvas canvas(settings.width, settings.height, format.scale);
+        canvas.Draw(base);
+        if (overlay) {
+            canvas.Draw(*overlay);
+        }
+        return {EncodeBase64(Png::Encode(canvas.GetWidth(), canvas.GetHeight(), canvas.GetPixels()))};
     }
 
     std::vector<RouteByStops> TraverseRoute(const Response::Route::RouteItems &items) {
@@ -388,25 +568,51 @@ namespace Render {
             {"stop_labels", &Renderer::RouteHelper::RenderRouteStopLabels}
     };
 
-    Response::Map Renderer::RenderRoute(const Response::Route::RouteItems &items) const {
+    std::string Renderer::SerializeOverlay(const Svg::Document &overlay) const {
+        auto overlay_options = render_data_.render_settings->svg_options;
+        overlay_options.class_prefix = "r";
+        auto state = map_state_;
+        std::string result;
+        overlay.RenderObjects(result, overlay_options, state);
+        return result;
+    }
+
+    Response::Map Renderer::RenderRoute(const Response::Route::RouteItems &items, const MapFormat &format) const {
         auto route_scheme = TraverseRoute(items);
-        RouteHelper render_helper(render_data_, svg_, route_scheme);
-        const auto &route_svg = render_helper.GetSvg();
-        std::ostringstream os;
-        route_svg.Render(os);
-        return {os.str()};
+        RouteHelper render_helper(*this, route_scheme);
+        if (format.type == MapFormat::Type::Png) {
+            return RasterizeMap(format, svg_, &render_helper.GetSvg());
+        }
+        const std::string overlay = SerializeOverlay(render_helper.GetSvg());
+
+        const std::string_view base_objects =
+                std::string_view(map_).substr(0, map_.size() - Svg::Document::kFooter.size());
+        std::string route_map;
+        route_map.reserve(base_objects.size() + overlay.size() + Svg::Document::kFooter.size());
+        route_map.append(base_objects).append(overlay).append(Svg::Document::kFooter);
+        return {std::move(route_map)};
     }
 
-    Renderer::RouteHelper::RouteHelper(RenderData render_data,
-                                       const Svg::Document &base_svg,
+    Response::Map Renderer::RenderRouteOverlay(const Response::Route::RouteItems &items,
+                                               const MapFormat &format) const {
+        auto route_scheme = TraverseRoute(items);
+        RouteHelper render_helper(*this, route_scheme);
+        if (format.type == MapFormat::Type::Png) {
+            return RasterizeMap(format, render_helper.GetSvg(), nullptr);
+        }
+        return {SerializeOverlay(render_helper.GetSvg())};
+    }
+
+    Renderer::RouteHelper::RouteHelper(const Renderer &renderer,
                                        const std::vector<RouteByStops> &route_scheme)
-            : render_data_(std::move(render_data)), route_svg_(base_svg), route_scheme_(route_scheme) {
-        const double outer_margin = render_data_.render_settings->outer_margin;
+            : renderer_(renderer), route_scheme_(route_scheme) {
+        const auto &render_settings = renderer_.render_data_.render_settings;
+        const double outer_margin = render_settings->outer_margin;
         route_svg_.Add(Svg::Rectangle(-outer_margin, -outer_margin,
-                                      render_data_.render_settings->width + 2 * outer_margin,
-                                      render_data_.render_settings->height + 2 * outer_margin)
-                               .SetFillColor(render_data_.render_settings->underlayer_color));
-        for (const auto &layer_name: render_data_.render_settings->layers) {
+                                      render_settings->width + 2 * outer_margin,
+                                      render_settings->height + 2 * outer_margin)
+                               .SetFillColor(render_settings->underlayer_color));
+        for (const auto &layer_name: render_settings->layers) {
             (this->*kCallRouteLayer.at(layer_name))();
         }
     }
@@ -414,9 +620,8 @@ namespace Render {
     void Renderer::RouteHelper::RenderRouteStopPoints() {
         for (const auto &[stop_name, _, is_interchange]: route_scheme_) {
             route_svg_.Add(Svg::Circle{}
-                                   .SetCenter(GetPosition(
-                                           render_data_.database->stop_descriptions[stop_name].coordinates))
-                                   .SetRadius(render_data_.render_settings->stop_radius)
+                                   .SetCenter(renderer_.GetPosition(stop_name))
+                                   .SetRadius(renderer_.render_data_.render_settings->stop_radius)
                                    .SetFillColor("white"));
         }
     }
@@ -428,10 +633,9 @@ namespace Render {
                 first = false;
                 RenderSingleStopLabel(
                         &route_svg_,
-                        render_data_.render_settings,
+                        renderer_.render_data_.render_settings,
                         stop_name,
-                        GetPosition(
-                                render_data_.database->stop_descriptions[stop_name].coordinates));
+                        renderer_.GetPosition(stop_name));
             }
         }
     }
@@ -439,31 +643,376 @@ namespace Render {
     void Renderer::RouteHelper::RenderRouteBusLines() {
         for (auto it = route_scheme_.begin(); it != route_scheme_.end(); ++it) {
             Svg::Polyline polyline;
-            polyline.SetStrokeColor(render_data_.database->bus_colors[it->bus_name])
-                    .SetStrokeWidth(render_data_.render_settings->line_width)
+            polyline.SetStrokeColor(renderer_.bus_colors_[renderer_.layout_->bus_ids.at(it->bus_name)])
+                    .SetStrokeWidth(renderer_.render_data_.render_settings->line_width)
                     .SetStrokeLineCap("round")
                     .SetStrokeLineJoin("round");
             for (; it != route_scheme_.end(); ++it) {
-                polyline.AddPoint(GetPosition(
-                        render_data_.database->stop_descriptions.at(it->stop_name).coordinates));
+                polyline.AddPoint(renderer_.GetPosition(it->stop_name));
                 if (it->is_interchange) {
                     break;
                 }
             }
-            route_svg_.Add(std::move(polyline));
+            route_svg_.Add(polyline);
         }
     }
 
     void Renderer::RouteHelper::RenderRouteBusLabels() {
         for (const auto &[stop_name, bus_name, _]: route_scheme_) {
-            if (IsFinishStop(render_data_.database, stop_name, bus_name)) {
+            if (IsFinishStop(renderer_.render_data_.database, stop_name, bus_name)) {
                 RenderSingleBusLabel(
                         &route_svg_,
-                        render_data_.render_settings,
+                        renderer_.render_data_.render_settings,
                         bus_name,
-                        GetPosition(
-                                render_data_.database->stop_descriptions[stop_name].coordinates),
-                        render_data_.database->bus_colors[bus_name]);
+                        renderer_.GetPosition(stop_name),
+                        renderer_.bus_colors_[renderer_.layout_->bus_ids.at(bus_name)]);
+            }
+        }
+    }
+
+    size_t CountCodePoints(std::string_view str) {
+        return std::count_if(str.begin(), str.end(), [](char c) {
+            return (static_cast<unsigned char>(c) & 0xC0) != 0x80;
+        });
+    }
+
+    void Renderer::BuildSpatialIndex() {
+        Trace::Span span("Renderer::BuildSpatialIndex");
+        const auto &settings = *render_data_.render_settings;
+
+        size_t longest_stop_name = 0;
+        for (const auto stop_name: layout_->stop_names) {
+            longest_stop_name = std::max(longest_stop_name, CountCodePoints(stop_name));
+        }
+        size_t longest_bus_name = 0;
+        for (size_t bus_id = 0; bus_id < layout_->bus_names.size(); ++bus_id) {
+            longest_bus_name = std::max(longest_bus_name, CountCodePoints(layout_->bus_names[bus_id]));
+            for (size_t index = 0; index + 1 < layout_->bus_stops[bus_id].size(); ++index) {
+                segments_.push_back({bus_id, index});
+            }
+            for (size_t stop_index: GetBusLabelStops(bus_id)) {
+                bus_label_anchors_.push_back({bus_id, stop_index});
+            }
+        }
+
+        // a generous estimate of the text extent: wide glyphs of 0.7 em
+        auto reach = [&](Svg::Point offset, uint32_t font_size, size_t length) {
+            return std::max(std::abs(offset.x), std::abs(offset.y))
+                   + font_size * std::max(0.7 * length, 1.) + settings.underlayer_width;
+        };
+        label_reach_ = std::max(reach(settings.stop_label_offset, settings.stop_label_font_size, longest_stop_name),
+                                reach(settings.bus_label_offset, settings.bus_label_font_size, longest_bus_name));
+
+        const Box bounds{0, 0, settings.width, settings.height};
+        stop_index_ = GridIndex(bounds, layout_->stop_names.size());
+        for (size_t stop = 0; stop < layout_->stop_names.size(); ++stop) {
+            stop_index_.Insert(stop, Box::Around(GetPosition(stop)));
+        }
+        auto position = [&](size_t bus, size_t stop_index) {
+            return GetPosition(layout_->bus_stops[bus][stop_index]);
+        };
+        segment_index_ = GridIndex(bounds, segments_.size());
+        for (size_t segment = 0; segment < segments_.size(); ++segment) {
+            const auto [bus, index] = segments_[segment];
+            segment_index_.InsertSegment(segment, position(bus, index), position(bus, index + 1));
+        }
+        bus_label_index_ = GridIndex(bounds, bus_label_anchors_.size());
+        for (size_t label = 0; label < bus_label_anchors_.size(); ++label) {
+            const auto [bus, stop_index] = bus_label_anchors_[label];
+            bus_label_index_.Insert(label, Box::Around(position(bus, stop_index)));
+        }
+    }
+
+    size_t Renderer::EstimateMemory() const {
+        // the document holds about as much as its markup; overview maps are left out, they are
+        // built while the renderer is read
+        return 2 * map_.capacity() + stop_index_.EstimateMemory() + segment_index_.EstimateMemory()
+               + bus_label_index_.EstimateMemory();
+    }
+
+    Response::Map Renderer::RenderViewport(const Box &box) const {
+        ViewportHelper render_helper(*this, box);
+        std::string viewport_map;
+        Svg::FormatState state;
+        Svg::Document::RenderHeader(viewport_map, Svg::ViewBox{
+                box.min_x, box.min_y, box.max_x - box.min_x, box.max_y - box.min_y});
+        render_helper.GetSvg().RenderObjects(viewport_map, render_data_.render_settings->svg_options, state);
+        Svg::Document::RenderFooter(viewport_map);
+        return {std::move(viewport_map)};
+    }
+
+    Response::Map Renderer::RenderTile(uint32_t zoom, uint32_t x, uint32_t y) const {
+        const double side = std::max(render_data_.render_settings->width, render_data_.render_settings->height)
+                            / std::pow(2., zoom);
+        return RenderViewport(Box{x * side, y * side, (x + 1) * side, (y + 1) * side});
+    }
+
+    double DistanceToSegment(Svg::Point point, Svg::Point from, Svg::Point to) {
+        const double dx = to.x - from.x, dy = to.y - from.y;
+        const double length_squared = dx * dx + dy * dy;
+        double t = 0;
+        if (length_squared > 0) {
+            t = std::clamp(((point.x - from.x) * dx + (point.y - from.y) * dy) / length_squared, 0., 1.);
+        }
+        return std::hypot(point.x - (from.x + dx * t), point.y - (from.y + dy * t));
+    }
+
+    // Douglas–Peucker between two kept points: marks the points needed to stay within `tolerance`
+    void SimplifyPolyline(const std::vector<Svg::Point> &points, size_t first, size_t last,
+                          double tolerance, std::vector<bool> &keep) {
+        std::stack<std::pair<size_t, size_t>> pieces;
+        pieces.emplace(first, last);
+        while (!pieces.empty()) {
+            const auto [from, to] = pieces.top();
+            pieces.pop();
+            double farthest = tolerance;
+            size_t split = from;
+            for (size_t i = from + 1; i < to; ++i) {
+                if (const double distance = DistanceToSegment(points[i], points[from], points[to]);
+                        distance > farthest) {
+                    farthest = distance;
+                    split = i;
+                }
+            }
+            if (split != from) {
+                keep[split] = true;
+                pieces.emplace(from, split);
+                pieces.emplace(split, to);
+            }
+        }
+    }
+
+    const std::unordered_map<std::string,
+            void (Renderer::LodHelper::*)()> Renderer::LodHelper::kCallLodLayer = {
+            {"bus_lines",   &Renderer::LodHelper::RenderLodBusLines},
+            {"bus_labels",  &Renderer::LodHelper::RenderLodBusLabels},
+            {"stop_points", &Renderer::LodHelper::RenderLodStopPoints},
+            {"stop_labels", &Renderer::LodHelper::RenderLodStopLabels}
+    };
+
+    Renderer::LodHelper::LodHelper(const Renderer &renderer, uint32_t level)
+            : renderer_(renderer),
+              tolerance_(std::pow(2., level) / 2),
+              spacing_(std::pow(2., static_cast<int>(level) - 1) * std::max<double>(
+                      renderer.render_data_.render_settings->stop_label_font_size,
+                      2 * renderer.render_data_.render_settings->stop_radius)) {
+        SelectStops();
+        for (const auto &layer_name: renderer_.render_data_.render_settings->layers) {
+            (this->*kCallLodLayer.at(layer_name))();
+        }
+    }
+
+    void Renderer::LodHelper::SelectStops() {
+        const auto &layout = *renderer_.layout_;
+        const size_t stop_count = layout.stop_names.size();
+        // prominence is the number of visits; distinct buses tell interchanges
+        std::vector<size_t> visits(stop_count), buses(stop_count), last_bus(stop_count, SIZE_MAX);
+        kept_stops_.assign(stop_count, false);
+        for (size_t bus_id = 0; bus_id < layout.bus_stops.size(); ++bus_id) {
+            const auto &route = layout.bus_stops[bus_id];
+            for (size_t stop: route) {
+                ++visits[stop];
+                if (last_bus[stop] != bus_id) {
+                    last_bus[stop] = bus_id;
+                    ++buses[stop];
+                }
+            }
+            for (size_t stop_index: renderer_.GetBusLabelStops(bus_id)) {
+                kept_stops_[route[stop_index]] = true;
+            }
+        }
+        if (stop_count == 0) {
+            return;
+        }
+
+        std::vector<size_t> order(stop_count);
+        for (size_t stop = 0; stop < stop_count; ++stop) {
+            order[stop] = stop;
+            kept_stops_[stop] = kept_stops_[stop] || buses[stop] > 1;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+            return std::make_pair(!kept_stops_[lhs], visits[rhs]) < std::make_pair(!kept_stops_[rhs], visits[lhs]);
+        });
+
+        Box bounds = Box::Around(layout.positions.front());
+        for (const auto &position: layout.positions) {
+            bounds.min_x = std::min(bounds.min_x, position.x);
+            bounds.min_y = std::min(bounds.min_y, position.y);
+            bounds.max_x = std::max(bounds.max_x, position.x);
+            bounds.max_y = std::max(bounds.max_y, position.y);
+        }
+        GridIndex placed(bounds, stop_count);
+        for (size_t stop: order) {
+            const auto position = renderer_.GetPosition(stop);
+            const Box area = Box::Around(position).Expanded(spacing_);
+            if (!kept_stops_[stop]) {
+                const auto nearby = placed.Query(area);
+                kept_stops_[stop] = std::none_of(nearby.begin(), nearby.end(), [&](size_t other) {
+                    const auto other_position = renderer_.GetPosition(other);
+                    return std::hypot(other_position.x - position.x, other_position.y - position.y) < spacing_;
+                });
+            }
+            if (kept_stops_[stop]) {
+                placed.Insert(stop, Box::Around(position));
+            }
+        }
+    }
+
+    void Renderer::LodHelper::RenderLodStopPoints() {
+        for (size_t stop = 0; stop < kept_stops_.size(); ++stop) {
+            if (kept_stops_[stop]) {
+                lod_svg_.Add(Svg::Circle{}
+                                     .SetCenter(renderer_.GetPosition(stop))
+                                     .SetRadius(renderer_.render_data_.render_settings->stop_radius)
+                                     .SetFillColor("white"));
+            }
+        }
+    }
+
+    void Renderer::LodHelper::RenderLodStopLabels() {
+        for (size_t stop = 0; stop < kept_stops_.size(); ++stop) {
+            if (kept_stops_[stop]) {
+                RenderSingleStopLabel(
+                        &lod_svg_, renderer_.render_data_.render_settings,
+                        renderer_.layout_->stop_names[stop], renderer_.GetPosition(stop));
+            }
+        }
+    }
+
+    void Renderer::LodHelper::RenderLodBusLines() {
+        const auto &layout = *renderer_.layout_;
+        std::vector<Svg::Point> points;
+        std::vector<bool> keep;
+        for (size_t bus_id = 0; bus_id < layout.bus_stops.size(); ++bus_id) {
+            const auto &route = layout.bus_stops[bus_id];
+            points.clear();
+            keep.assign(route.size(), false);
+            for (size_t stop: route) {
+                points.push_back(renderer_.GetPosition(stop));
+            }
+            // the line may pass a stop by up to the tolerance, but not its terminals
+            if (!route.empty()) {
+                keep.back() = true;
+            }
+            for (size_t stop_index: renderer_.GetBusLabelStops(bus_id)) {
+                keep[stop_index] = true;
+            }
+            for (size_t from = 0, to = 1; to < route.size(); ++to) {
+                if (keep[to]) {
+                    SimplifyPolyline(points, from, to, tolerance_, keep);
+                    from = to;
+                }
+            }
+            Svg::Polyline polyline;
+            polyline.SetStrokeColor(renderer_.bus_colors_[bus_id])
+                    .SetStrokeWidth(renderer_.render_data_.render_settings->line_width)
+                    .SetStrokeLineCap("round")
+                    .SetStrokeLineJoin("round");
+            for (size_t i = 0; i < route.size(); ++i) {
+                if (keep[i]) {
+                    polyline.AddPoint(points[i]);
+                }
+            }
+            lod_svg_.Add(polyline);
+        }
+    }
+
+    void Renderer::LodHelper::RenderLodBusLabels() {
+        renderer_.RenderBusLabels(&lod_svg_, 0, renderer_.layout_->bus_names.size());
+    }
+
+    const std::unordered_map<std::string,
+            void (Renderer::ViewportHelper::*)()> Renderer::ViewportHelper::kCallViewportLayer = {
+            {"bus_lines",   &Renderer::ViewportHelper::RenderViewportBusLines},
+            {"bus_labels",  &Renderer::ViewportHelper::RenderViewportBusLabels},
+            {"stop_points", &Renderer::ViewportHelper::RenderViewportStopPoints},
+            {"stop_labels", &Renderer::ViewportHelper::RenderViewportStopLabels}
+    };
+
+    Renderer::ViewportHelper::ViewportHelper(const Renderer &renderer, const Box &box)
+            : renderer_(renderer), box_(box) {
+        for (const auto &layer_name: renderer_.render_data_.render_settings->layers) {
+            (this->*kCallViewportLayer.at(layer_name))();
+        }
+    }
+
+    Svg::Point Renderer::ViewportHelper::GetBusStopPosition(size_t bus, size_t stop_index) const {
+        return renderer_.GetPosition(renderer_.layout_->bus_stops[bus][stop_index]);
+    }
+
+    void Renderer::ViewportHelper::RenderViewportStopPoints() {
+        const auto &settings = *renderer_.render_data_.render_settings;
+        const Box area = box_.Expanded(settings.stop_radius);
+        for (size_t stop: renderer_.stop_index_.Query(area)) {
+            if (const auto position = renderer_.GetPosition(stop); area.Contains(position)) {
+                viewport_svg_.Add(Svg::Circle{}
+                                          .SetCenter(position)
+                                          .SetRadius(settings.stop_radius)
+                                          .SetFillColor("white"));
+            }
+        }
+    }
+
+    void Renderer::ViewportHelper::RenderViewportStopLabels() {
+        const Box area = box_.Expanded(renderer_.label_reach_);
+        for (size_t stop: renderer_.stop_index_.Query(area)) {
+            if (const auto position = renderer_.GetPosition(stop); area.Contains(position)) {
+                RenderSingleStopLabel(
+                        &viewport_svg_, renderer_.render_data_.render_settings,
+                        renderer_.layout_->stop_names[stop], position);
+            }
+        }
+    }
+
+    void Renderer::ViewportHelper::RenderViewportBusLines() {
+        const auto &settings = *renderer_.render_data_.render_settings;
+        const Box area = box_.Expanded(settings.line_width / 2);
+        // segments come sorted by bus and by position on the route, so consecutive visible
+        // segments are stitched into one polyline until the route leaves the area
+        std::optional<Svg::Polyline> polyline;
+        std::optional<BusSegment> last_segment;
+        bool last_clipped = true;
+        for (size_t segment_id: renderer_.segment_index_.Query(area)) {
+            const auto segment = renderer_.segments_[segment_id];
+            const auto from = GetBusStopPosition(segment.bus, segment.index);
+            const auto to = GetBusStopPosition(segment.bus, segment.index + 1);
+            const auto clipped = ClipSegment(from, to, area);
+            if (!clipped) {
+                continue;
+            }
+            const bool continues = polyline && !last_clipped
+                                   && last_segment->bus == segment.bus
+                                   && last_segment->index + 1 == segment.index
+                                   && clipped->first.x == from.x && clipped->first.y == from.y;
+            if (!continues) {
+                if (polyline) {
+                    viewport_svg_.Add(*polyline);
+                }
+                polyline.emplace();
+                polyline->SetStrokeColor(settings.color_palette[segment.bus % settings.color_palette.size()])
+                        .SetStrokeWidth(settings.line_width)
+                        .SetStrokeLineCap("round")
+                        .SetStrokeLineJoin("round")
+                        .AddPoint(clipped->first);
+            }
+            polyline->AddPoint(clipped->second);
+            last_segment = segment;
+            last_clipped = clipped->second.x != to.x || clipped->second.y != to.y;
+        }
+        if (polyline) {
+            viewport_svg_.Add(*polyline);
+        }
+    }
+
+    void Renderer::ViewportHelper::RenderViewportBusLabels() {
+        const auto &settings = *renderer_.render_data_.render_settings;
+        const Box area = box_.Expanded(renderer_.label_reach_);
+        for (size_t label: renderer_.bus_label_index_.Query(area)) {
+            const auto [bus, stop_index] = renderer_.bus_label_anchors_[label];
+            if (const auto position = GetBusStopPosition(bus, stop_index); area.Contains(position)) {
+                RenderSingleBusLabel(
+                        &viewport_svg_, renderer_.render_data_.render_settings, renderer_.layout_->bus_names[bus],
+                        position, settings.color_palette[bus % settings.color_palette.size()]);
             }
         }
     }
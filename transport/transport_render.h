@@ -5,7 +5,10 @@
 #include "response.h"
 #include "json.h"
 #include "svg.h"
+#include "grid_index.h"
 
+#include <array>
+#include <mutex>
 #include <utility>
 #include <unordered_map>
 
@@ -26,6 +29,7 @@ namespace Render {
         Svg::Point bus_label_offset;
         std::vector<std::string> layers;
         double outer_margin;
+        Svg::RenderOptions svg_options;
     };
 
     using SettingsPtr = std::shared_ptr<Settings>;
@@ -42,32 +46,78 @@ namespace Render {
                 && stop_name == bus.stops[bus.stops.size() / 2]);
     }
 
+    // Stops and buses numbered in dictionary order, with the projected position of every stop.
+    // Views point into the database the layout was built from.
+    struct Layout {
+        std::vector<std::string_view> stop_names;
+        std::unordered_map<std::string_view, size_t> stop_ids;
+        std::vector<std::string_view> bus_names;
+        std::unordered_map<std::string_view, size_t> bus_ids;
+        // stop ids along each bus route
+        std::vector<std::vector<size_t>> bus_stops;
+        std::vector<Svg::Point> positions;
+    };
+
+    using LayoutPtr = std::shared_ptr<const Layout>;
+
+    // Projects stops onto the map plane: secondary stops are spread evenly between main ones,
+    // then both axes are compressed to ranks. Works on ids and never touches the database.
     class RenderDataOptimizer {
     public:
         explicit RenderDataOptimizer(RenderData render_data)
-                : render_data_(RenderData{
-                .database = std::make_shared<Data::Database>(*render_data.database),
-                .render_settings = render_data.render_settings
-        }) {}
+                : render_data_(std::move(render_data)) {}
 
-        RenderData Optimize();
+        Layout Optimize() const;
 
     private:
         RenderData render_data_;
 
-        bool IsMainStop(std::string_view stop_name, std::string_view bus_name);
+        // per bus: whether each of its stops is main (a terminal, a transfer or a loop point)
+        std::vector<std::vector<bool>> FindMainStops(const Layout &layout) const;
 
-        void UniformStops();
+        void UniformStops(const Layout &layout, std::vector<Coordinates::Point> &coordinates) const;
 
-        void CompressCoordinates();
+        void CompressCoordinates(const Layout &layout, std::vector<Coordinates::Point> &coordinates) const;
 
+        // `order` lists stop ids sorted along the axis, `grouped_until` the end of each group
         std::vector<int> EnumerateStops(
-                const std::vector<std::vector<Descriptions::Stop *>> &grouped, size_t size) const;
+                const std::vector<std::vector<size_t>> &neighbours,
+                const std::vector<size_t> &order, const std::vector<size_t> &grouped_until) const;
 
     };
 
     SettingsPtr ReadJson(const Json::Node &);
 
+    // named variants of render_settings, each given by the keys it overrides
+    using Profiles = std::unordered_map<std::string, SettingsPtr>;
+
+    Profiles ReadProfiles(const Json::Node &base_settings, const Json::Node &profiles);
+
+    // the optimized layout depends on nothing else of the settings
+    inline bool HaveSameLayout(const Settings &lhs, const Settings &rhs) {
+        return lhs.width == rhs.width && lhs.height == rhs.height && lhs.padding == rhs.padding;
+    }
+
+    // how a map response is encoded: SVG markup, or a base64 PNG drawn by the built-in rasterizer
+    struct MapFormat {
+        enum class Type {
+            Svg,
+            Png
+        };
+
+        Type type = Type::Svg;
+        // raster pixels per map unit
+        double scale = 1;
+    };
+
+    // what a route response carries as its map
+    enum class RouteMap {
+        None,
+        // the route layers alone, to be drawn over a base map the client already has
+        Overlay,
+        Full
+    };
+
     struct RouteByStops {
         std::string stop_name;
         std::string bus_name;
@@ -83,41 +133,140 @@ namespace Render {
 
         explicit Renderer(RenderData render_data);
 
-        Response::Map RenderMap();
+        // takes a layout computed for the same database and settings with the same layout
+        Renderer(RenderData render_data, LayoutPtr layout);
+
+        const LayoutPtr &GetLayout() const {
+            return layout_;
+        }
+
+        const SettingsPtr &GetSettings() const {
+            return render_data_.render_settings;
+        }
+
+        // `lod` above 0 gives a simplified overview map, see LodHelper
+        Response::Map RenderMap(const MapFormat &format = {}, uint32_t lod = 0) const;
+
+        static constexpr uint32_t kMaxLod = 8;
 
-        Response::Map RenderRoute(const Response::Route::RouteItems &items) const;
+        Response::Map RenderRoute(const Response::Route::RouteItems &items, const MapFormat &format = {}) const;
+
+        // SVG: the markup that goes right before the closing tag of the base map;
+        // PNG: the route layers on a transparent canvas
+        Response::Map RenderRouteOverlay(const Response::Route::RouteItems &items,
+                                         const MapFormat &format = {}) const;
+
+        // FNV-1a of the base map as served by RenderMap in SVG
+        uint64_t GetMapHash() const {
+            return map_hash_;
+        }
+
+        // approximate bytes of the serialized maps and the document they were serialized from
+        size_t EstimateMemory() const;
+
+        // the part of the map inside the box (in map coordinates), clipped, with a matching viewBox
+        Response::Map RenderViewport(const Box &box) const;
+
+        // square tiles of side max(width, height) / 2^zoom, numbered from the top left corner
+        Response::Map RenderTile(uint32_t zoom, uint32_t x, uint32_t y) const;
 
     private:
         RenderData render_data_;
+        LayoutPtr layout_;
+        // palette colors of the buses; they stay colorless without the bus_lines layer
+        std::vector<Svg::Color> bus_colors_;
         Svg::Document svg_;
 
+        // base map serialized once at construction; route maps reuse it as a prefix
+        std::string map_;
+        // number format left after serializing the base map, the overlay continues with it
+        Svg::FormatState map_state_;
+        uint64_t map_hash_ = 0;
+
+        // map objects in layer order, indexed by position for viewport requests
+        struct BusSegment {
+            size_t bus;
+            size_t index;
+        };
+        struct BusLabelAnchor {
+            size_t bus;
+            size_t stop_index;
+        };
+        std::vector<BusSegment> segments_;
+        std::vector<BusLabelAnchor> bus_label_anchors_;
+        GridIndex stop_index_;
+        GridIndex segment_index_;
+        GridIndex bus_label_index_;
+        // how far a label may reach from its anchor, with offset and underlayer
+        double label_reach_ = 0;
+
+        void BuildSpatialIndex();
+
+        // simplified maps, built on the first request of each level
+        struct LodMap {
+            std::once_flag built;
+            Svg::Document svg;
+            std::string map;
+        };
+        mutable std::array<LodMap, kMaxLod + 1> lod_maps_;
+
+        const LodMap &GetLodMap(uint32_t lod) const;
+
+        // draws the base map and then the overlay, if any, and encodes the image
+        Response::Map RasterizeMap(const MapFormat &format, const Svg::Document &base,
+                                   const Svg::Document *overlay) const;
+
     private:
 
-        static Svg::Point GetPosition(Coordinates::Point);
+        Svg::Point GetPosition(size_t stop_id) const {
+            return layout_->positions[stop_id];
+        }
+
+        Svg::Point GetPosition(std::string_view stop_name) const {
+            return layout_->positions[layout_->stop_ids.at(stop_name)];
+        }
 
-        void RenderStopPoints();
+        // terminals where the bus label is drawn, as indices into the route
+        std::vector<size_t> GetBusLabelStops(size_t bus_id) const;
+
+        // Layers are drawn in shards over ranges of stop or bus ids: shards are built concurrently
+        // and joined in order, so the document is the same as if drawn in one pass.
+        void RenderStopPoints(Svg::Document *svg, size_t begin, size_t end) const;
 
         static void RenderSingleStopLabel(
                 Svg::Document *svg, SettingsPtr render_settings,
-                const std::string &stop_name, Svg::Point position);
+                std::string_view stop_name, Svg::Point position);
 
-        void RenderStopLabels();
+        void RenderStopLabels(Svg::Document *svg, size_t begin, size_t end) const;
 
-        void RenderBusLines();
+        void RenderBusLines(Svg::Document *svg, size_t begin, size_t end) const;
 
         static void RenderSingleBusLabel(
                 Svg::Document *svg, SettingsPtr render_settings,
-                const std::string &bus_name, Svg::Point position, Svg::Color color);
+                std::string_view bus_name, Svg::Point position, Svg::Color color);
+
+        void RenderBusLabels(Svg::Document *svg, size_t begin, size_t end) const;
+
+        struct Layer {
+            void (Renderer::*render)(Svg::Document *, size_t, size_t) const;
+            bool by_buses;
+        };
 
-        void RenderBusLabels();
+        static const std::unordered_map<std::string, Layer> kCallLayer;
 
-        static const std::unordered_map<std::string, void (Renderer::*)()> kCallLayer;
+        void RenderLayers();
+
+        // writes svg_ into map_ in chunks of objects, each started from the number format
+        // the previous chunks leave behind
+        void SerializeMap();
+
+        // route layers serialized to continue the base map
+        std::string SerializeOverlay(const Svg::Document &overlay) const;
 
     private:
         class RouteHelper {
         public:
-            RouteHelper(RenderData render_data,
-                        const Svg::Document &base_svg,
+            RouteHelper(const Renderer &renderer,
                         const std::vector<RouteByStops> &route_scheme);
 
             const Svg::Document &GetSvg() const {
@@ -125,7 +274,7 @@ namespace Render {
             }
 
         private:
-            RenderData render_data_;
+            const Renderer &renderer_;
             Svg::Document route_svg_;
             const std::vector<RouteByStops> &route_scheme_;
 
@@ -142,7 +291,68 @@ namespace Render {
 
         };
 
+        // Overview map for zooming out by 2^level: bus lines are simplified with Douglas–Peucker
+        // to half a zoomed pixel, and stops closer than the level's spacing to a more prominent
+        // stop are left out. Terminals and interchanges always stay.
+        class LodHelper {
+        public:
+            LodHelper(const Renderer &renderer, uint32_t level);
+
+            const Svg::Document &GetSvg() const {
+                return lod_svg_;
+            }
+
+        private:
+            const Renderer &renderer_;
+            const double tolerance_;
+            const double spacing_;
+            std::vector<bool> kept_stops_;
+            Svg::Document lod_svg_;
+
+            void SelectStops();
+
+            void RenderLodStopPoints();
+
+            void RenderLodStopLabels();
+
+            void RenderLodBusLines();
+
+            void RenderLodBusLabels();
+
+            static const std::unordered_map<std::string,
+                    void (Renderer::LodHelper::*)()> kCallLodLayer;
+
+        };
+
+        class ViewportHelper {
+        public:
+            ViewportHelper(const Renderer &renderer, const Box &box);
+
+            const Svg::Document &GetSvg() const {
+                return viewport_svg_;
+            }
+
+        private:
+            const Renderer &renderer_;
+            const Box box_;
+            Svg::Document viewport_svg_;
+
+            Svg::Point GetBusStopPosition(size_t bus, size_t stop_index) const;
+
+            void RenderViewportStopPoints();
+
+            void RenderViewportStopLabels();
+
+            void RenderViewportBusLines();
+
+            void RenderViewportBusLabels();
+
+            static const std::unordered_map<std::string,
+                    void (Renderer::ViewportHelper::*)()> kCallViewportLayer;
+
+        };
+
 
     };
 
-}
\ No newline at end of file
+}
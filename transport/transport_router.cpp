@@ -1,50 +1,144 @@
 #include "transport_router.h"
+#include "metrics.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
 
 namespace Transport {
 
-    void TransportRouter::ResizeToFit(size_t column, size_t row) {
-        if (column >= distance_table_.size()) {
-            distance_table_.resize(column + 1);
-        }
-        if (row >= distance_table_[column].size()) {
-            distance_table_[column].resize(row + 1);
+    void TransportRouter::ResizeToFit(size_t stop_id) {
+        if (stop_id >= distance_table_.size()) {
+            distance_table_.resize(stop_id + 1);
         }
     }
 
     void TransportRouter::UpdateDistance(const std::string &from, const std::string &to, int distance) {
         size_t from_id = stops_.GetId(from);
         size_t to_id = stops_.GetId(to);
-        ResizeToFit(from_id, to_id);
+        ResizeToFit(std::max(from_id, to_id));
         distance_table_[from_id][to_id] = distance;
-        ResizeToFit(to_id, from_id);
-        if (!distance_table_[to_id][from_id]) {
-            distance_table_[to_id][from_id] = distance;
-        }
+        distance_table_[to_id].emplace(from_id, distance);
     }
 
     int TransportRouter::GetDistance(const std::string &from, const std::string &to) const {
         size_t from_id = stops_.GetId(from);
         size_t to_id = stops_.GetId(to);
-        return distance_table_[from_id][to_id].value();
+        return distance_table_.at(from_id).at(to_id);
     }
 
     RoutingSettings ReadFrom(const Json::Node &base_node) {
-        return RoutingSettings{
+        RoutingSettings settings{
                 .bus_wait_time = static_cast<int64_t>(
                         base_node.AsMap().at("bus_wait_time").AsDouble()),
-                .bus_velocity = base_node.AsMap().at("bus_velocity").AsDouble()
+                .bus_velocity = base_node.AsMap().at("bus_velocity").AsDouble(),
+                .mode = RoutingMode::AllPairs,
+                .snapshot_file = {}
         };
+        if (auto it = base_node.AsMap().find("routing_mode"); it != base_node.AsMap().end()) {
+            if (const auto &mode = it->second.AsString(); mode == "on_demand") {
+                settings.mode = RoutingMode::OnDemand;
+            } else if (mode != "all_pairs") {
+                throw std::runtime_error("Unknown routing mode: " + mode);
+            }
+        }
+        if (auto it = base_node.AsMap().find("snapshot_file"); it != base_node.AsMap().end()) {
+            settings.snapshot_file = it->second.AsString();
+        }
+        return settings;
     }
 
     void TransportRouter::BuildMap(Data::DataPtr database,
                                    RoutingSettings settings) {
+        Trace::Span span("TransportRouter::BuildMap");
         settings_ = settings;
-        graph_ = Graph::DirectedWeightedGraph<double>(database->stop_descriptions.size());
-        double bus_velocity_mpm = settings.bus_velocity * 100 / 6;
-        for (const auto &[bus_name, bus]: database->bus_descriptions) {
+        BuildGraph(*database);
+        if (settings.mode != RoutingMode::AllPairs || settings.snapshot_file.empty()) {
+            Trace::Span router_span("Graph::Router");
+            graph_router_ = std::make_unique<Graph::Router<double>>(graph_, settings.mode);
+            return;
+        }
+
+        using RouteEntry = Graph::Router<double>::RouteEntry;
+        const uint64_t graph_hash = HashGraph();
+        const size_t vertex_count = graph_.GetVertexCount();
+        std::optional<Snapshot::Table> table;
+        try {
+            Trace::Span load_span("snapshot load");
+            table = Snapshot::LoadTable(settings.snapshot_file, graph_hash, vertex_count, sizeof(RouteEntry));
+        } catch (const std::runtime_error &error) {
+            // an unreadable file is no worse than a missing one, the table is computed below
+            std::cerr << "Route table snapshot not loaded: " << error.what() << std::endl;
+        }
+        if (table) {
+            graph_router_ = std::make_unique<Graph::Router<double>>(graph_, Graph::Router<double>::TableView{
+                    .owner = std::move(table->file),
+                    .routes = static_cast<const RouteEntry *>(table->entries)
+            });
+            Metrics::Add(Metrics::Counter::SnapshotLoads);
+            return;
+        }
+        {
+            Trace::Span router_span("Graph::Router");
+            graph_router_ = std::make_unique<Graph::Router<double>>(graph_, settings.mode);
+        }
+        Trace::Span write_span("snapshot write");
+        try {
+            Snapshot::WriteTable(settings.snapshot_file, graph_hash, vertex_count, sizeof(RouteEntry),
+                                 graph_router_->GetTable());
+            Metrics::Add(Metrics::Counter::SnapshotWrites);
+        } catch (const std::runtime_error &error) {
+            // the table in memory serves all the same, the next start computes it again
+            std::cerr << "Route table snapshot not written: " << error.what() << std::endl;
+        }
+    }
+
+    size_t TransportRouter::EstimateMemory() const {
+        size_t memory = graph_router_ ? graph_router_->GetTableMemory() : 0;
+        memory += distance_table_.capacity() * sizeof(distance_table_[0]);
+        for (const auto &row: distance_table_) {
+            // a node of key, value and link, and a bucket
+            memory += row.size() * (sizeof(std::pair<const size_t, int>) + sizeof(void *))
+                      + row.bucket_count() * sizeof(void *);
+        }
+        memory += graph_.GetEdgeCount() * (sizeof(Graph::Edge<double>) + sizeof(Graph::EdgeId));
+        memory += edge_info_.capacity() * sizeof(EdgeInfo);
+        return memory;
+    }
+
+    uint64_t TransportRouter::HashGraph() const {
+        std::string bytes;
+        auto append = [&bytes](const auto &value) {
+            char buffer[sizeof(value)];
+            std::memcpy(buffer, &value, sizeof(value));
+            bytes.append(buffer, sizeof(value));
+        };
+        append(static_cast<uint64_t>(graph_.GetVertexCount()));
+        for (Graph::EdgeId edge_id = 0; edge_id < graph_.GetEdgeCount(); ++edge_id) {
+            const auto &edge = graph_.GetEdge(edge_id);
+            append(static_cast<uint64_t>(edge.from));
+            append(static_cast<uint64_t>(edge.to));
+            append(edge.weight);
+        }
+        return HashFnv1a(bytes);
+    }
+
+    void TransportRouter::BuildGraph(const Data::Database &database) {
+        Trace::Span span("TransportRouter::BuildGraph");
+        graph_ = Graph::DirectedWeightedGraph<double>(database.stop_descriptions.size());
+        edge_info_.clear();
+        bus_edges_.assign(database.bus_descriptions.size(), {});
+        double bus_velocity_mpm = settings_.bus_velocity * 100 / 6;
+        for (const auto &[bus_name, bus]: database.bus_descriptions) {
             size_t bus_id = buses_.GetId(bus_name);
+            bus_edges_[bus_id].first = graph_.GetEdgeCount();
             for (auto from = bus.stops.begin(); from != bus.stops.end(); ++from) {
-                double wait_time = settings.bus_wait_time;
+                double wait_time = settings_.bus_wait_time;
                 size_t span_count = 1;
                 for (auto to = next(from), prev = from; to != bus.stops.end(); ++to, ++prev, ++span_count) {
                     wait_time += GetDistance(*prev, *to) / bus_velocity_mpm;
@@ -61,12 +155,174 @@ namespace Transport {
                     });
                 }
             }
+            bus_edges_[bus_id].second = graph_.GetEdgeCount();
+        }
+    }
+
+    void TransportRouter::FillDistances(const Data::Database &database) {
+        for (const auto &[name, stop]: database.stop_descriptions) {
+            for (const auto &[name_to, distance]: stop.distance_to_stops) {
+                UpdateDistance(name, name_to, distance);
+            }
+        }
+    }
+
+    void TransportRouter::RefreshDistances(const Data::Database &database, const std::string &stop) {
+        auto explicit_distance = [&](const std::string &from, const std::string &to) -> std::optional<int> {
+            const auto &distances = database.stop_descriptions.at(from).distance_to_stops;
+            auto it = std::find_if(distances.begin(), distances.end(), [&](const auto &item) {
+                return item.first == to;
+            });
+            return it != distances.end() ? std::optional(it->second) : std::nullopt;
+        };
+
+        auto assign = [](std::unordered_map<size_t, int> &row, size_t id, std::optional<int> distance) {
+            if (distance) {
+                row[id] = *distance;
+            } else {
+                row.erase(id);
+            }
+        };
+
+        const size_t stop_id = stops_.GetId(stop);
+        ResizeToFit(stop_id);
+        // distances are kept both ways, so the row of the stop lists every stop it had one with
+        std::vector<size_t> neighbours;
+        for (const auto &[other_id, distance]: distance_table_[stop_id]) {
+            neighbours.push_back(other_id);
+        }
+        for (const auto &[name_to, distance]: database.stop_descriptions.at(stop).distance_to_stops) {
+            neighbours.push_back(stops_.GetId(name_to));
+        }
+        for (const size_t other_id: neighbours) {
+            const auto &other = stops_.GetName(other_id);
+            const auto forward = explicit_distance(stop, other), backward = explicit_distance(other, stop);
+            ResizeToFit(other_id);
+            assign(distance_table_[stop_id], other_id, forward ? forward : backward);
+            assign(distance_table_[other_id], stop_id, backward ? backward : forward);
+        }
+    }
+
+    void TransportRouter::ApplyChanges(const Data::Database &database, const std::vector<std::string> &stops,
+                                       const std::vector<std::string> &buses) {
+        const bool removed = std::any_of(stops.begin(), stops.end(), [&](const auto &name) {
+            return !database.stop_descriptions.count(name);
+        }) || std::any_of(buses.begin(), buses.end(), [&](const auto &name) {
+            return !database.bus_descriptions.count(name);
+        });
+        if (removed) {
+            stops_ = {};
+            buses_ = {};
+            for (const auto &[stop_name, stop]: database.stop_descriptions) {
+                stops_.SetId(stop_name);
+            }
+            for (const auto &[bus_name, bus]: database.bus_descriptions) {
+                buses_.SetId(bus_name);
+            }
+            distance_table_.clear();
+            FillDistances(database);
+            BuildGraph(database);
+            graph_router_ = std::make_unique<Graph::Router<double>>(graph_, settings_.mode);
+            return;
+        }
+
+        // new stops and buses take the next ids
+        const size_t old_bus_count = bus_edges_.size();
+        for (const auto &name: stops) {
+            stops_.SetId(name);
+        }
+        for (const auto &name: buses) {
+            buses_.SetId(name);
+        }
+        for (const auto &name: stops) {
+            RefreshDistances(database, name);
+        }
+
+        std::vector<double> old_weights(graph_.GetEdgeCount());
+        for (Graph::EdgeId edge_id = 0; edge_id < old_weights.size(); ++edge_id) {
+            old_weights[edge_id] = graph_.GetEdge(edge_id).weight;
+        }
+        const auto old_bus_edges = bus_edges_;
+        BuildGraph(database);
+
+        std::vector<bool> replaced_buses(old_bus_count);
+        for (const auto &name: buses) {
+            if (const size_t bus_id = buses_.GetId(name); bus_id < old_bus_count) {
+                replaced_buses[bus_id] = true;
+            }
+        }
+        std::vector<Graph::EdgeId> edge_ids(old_weights.size());
+        std::vector<Graph::EdgeId> lighter_edges;
+        bool incremental = true;
+        for (size_t bus_id = 0; bus_id < bus_edges_.size() && incremental; ++bus_id) {
+            const auto [begin, end] = bus_edges_[bus_id];
+            if (bus_id >= old_bus_count) {
+                for (Graph::EdgeId edge_id = begin; edge_id < end; ++edge_id) {
+                    lighter_edges.push_back(edge_id);
+                }
+                continue;
+            }
+            const auto [old_begin, old_end] = old_bus_edges[bus_id];
+            if (replaced_buses[bus_id] || end - begin != old_end - old_begin) {
+                incremental = false;
+                break;
+            }
+            for (Graph::EdgeId edge_id = begin; edge_id < end; ++edge_id) {
+                const Graph::EdgeId old_edge_id = old_begin + (edge_id - begin);
+                edge_ids[old_edge_id] = edge_id;
+                const double weight = graph_.GetEdge(edge_id).weight;
+                if (weight > old_weights[old_edge_id]) {
+                    incremental = false;
+                    break;
+                }
+                if (weight < old_weights[old_edge_id]) {
+                    lighter_edges.push_back(edge_id);
+                }
+            }
+        }
+        // every relaxation costs O(V^2), as much as a V-th of the full computation
+        if (incremental && lighter_edges.size() < graph_.GetVertexCount()) {
+            graph_router_->Update(edge_ids, lighter_edges);
+        } else {
+            graph_router_ = std::make_unique<Graph::Router<double>>(graph_, settings_.mode);
         }
-        graph_router_ = std::make_unique<Graph::Router<double>>(graph_);
     }
 
     std::optional<Response::Route> TransportRouter::GetRoute(const std::string &from, const std::string &to) const {
-        if (auto route_info = graph_router_->BuildRoute(stops_.GetId(from), stops_.GetId(to))) {
+        const auto route_info = [&] {
+            Metrics::PhaseTimer timer(Metrics::Phase::RouteSearch);
+            return graph_router_->BuildRoute(stops_.GetId(from), stops_.GetId(to));
+        }();
+        return MakeRoute(route_info);
+    }
+
+    std::vector<std::optional<Response::Route>> TransportRouter::GetRoutes(const std::string &from,
+                                                                           const std::vector<std::string> &to) const {
+        std::vector<Graph::VertexId> targets;
+        targets.reserve(to.size());
+        for (const auto &name: to) {
+            targets.push_back(stops_.GetId(name));
+        }
+        const auto source_routes = [&] {
+            Metrics::PhaseTimer timer(Metrics::Phase::RouteSearch);
+            return graph_router_->BuildSourceRoutes(stops_.GetId(from), targets);
+        }();
+        std::vector<std::optional<Response::Route>> routes;
+        routes.reserve(targets.size());
+        for (const auto target: targets) {
+            const auto route_info = [&] {
+                Metrics::PhaseTimer timer(Metrics::Phase::RouteSearch);
+                return graph_router_->BuildRoute(source_routes, target);
+            }();
+            routes.push_back(MakeRoute(route_info));
+        }
+        return routes;
+    }
+
+    std::optional<Response::Route> TransportRouter::MakeRoute(
+            const std::optional<Graph::Router<double>::RouteInfo> &route_info) const {
+        if (route_info) {
+            Metrics::PhaseTimer timer(Metrics::Phase::ItemAssembly);
             std::vector<std::variant<Response::Route::Wait, Response::Route::Bus>> route_items;
 
             for (size_t route_edge_idx = 0; route_edge_idx < route_info->edge_count; ++route_edge_idx) {
@@ -86,15 +342,64 @@ namespace Transport {
                 });
             }
 
+            graph_router_->ReleaseRoute(route_info->id);
             return Response::Route{
                     .items = std::move(route_items),
                     .total_time = route_info->weight,
-                    .map = Response::Map{}
+                    .map = std::nullopt,
+                    .base_map_hash = std::nullopt
             };
         }
         return std::nullopt;
     }
 
+    std::optional<Response::ReachableStops> TransportRouter::GetReachableStops(const std::string &from,
+                                                                               double max_time) const {
+        const auto from_id = stops_.FindId(from);
+        if (!from_id) {
+            return std::nullopt;
+        }
+        Response::ReachableStops response;
+        for (const auto &[stop_id, time]: graph_router_->FindReachable(*from_id, max_time)) {
+            response.items.push_back({stops_.GetName(stop_id), time});
+        }
+        return response;
+    }
+
+    std::optional<Response::Matrix> TransportRouter::GetMatrix(const std::vector<std::string> &from,
+                                                               const std::vector<std::string> &to) const {
+        std::vector<Graph::VertexId> sources, targets;
+        for (auto [names, ids]: {std::pair{&from, &sources}, std::pair{&to, &targets}}) {
+            ids->reserve(names->size());
+            for (const auto &name: *names) {
+                const auto id = stops_.FindId(name);
+                if (!id) {
+                    return std::nullopt;
+                }
+                ids->push_back(*id);
+            }
+        }
+        Response::Matrix response;
+        if (sources.empty() || targets.empty()) {
+            return response;
+        }
+        response.cells.reserve(sources.size() * targets.size());
+        // BuildGraph adds an edge for every ride on one bus, from a stop to a later one of its
+        // route, so the rides of a route are its edges
+        assert(edge_info_.size() == graph_.GetEdgeCount());
+        for (const auto &route: graph_router_->BuildMatrix(sources, targets)) {
+            if (route) {
+                response.cells.push_back(Response::Matrix::Cell{
+                        .time = route->weight,
+                        .transfers = route->edge_count > 0 ? static_cast<int64_t>(route->edge_count) - 1 : 0
+                });
+            } else {
+                response.cells.emplace_back();
+            }
+        }
+        return response;
+    }
+
     TransportRouter::TransportRouter(Data::DataPtr database) {
         for (const auto &[stop_name, stop]: database->stop_descriptions) {
             stops_.SetId(stop_name);
@@ -5,6 +5,7 @@
 #include <set>
 #include <optional>
 #include <memory>
+#include <unordered_map>
 
 namespace Transport {
 
@@ -24,7 +25,14 @@ namespace Transport {
             return ids_.at(name);
         }
 
-        std::string GetName(size_t id) const {
+        std::optional<size_t> FindId(const std::string &name) const {
+            if (auto it = ids_.find(name); it != ids_.end()) {
+                return it->second;
+            }
+            return std::nullopt;
+        }
+
+        const std::string &GetName(size_t id) const {
             return names_.at(id);
         }
 
@@ -33,9 +41,14 @@ namespace Transport {
         std::vector<std::string> names_;
     };
 
+    using RoutingMode = Graph::Router<double>::Mode;
+
     struct RoutingSettings {
         int64_t bus_wait_time;
         double bus_velocity;
+        RoutingMode mode = RoutingMode::AllPairs;
+        // route table file of the network, mapped if it matches and written otherwise; all-pairs mode only
+        std::string snapshot_file;
     };
 
     class TransportRouter {
@@ -49,10 +62,48 @@ namespace Transport {
         void BuildMap(Data::DataPtr,
                       RoutingSettings settings);
 
+        const RoutingSettings &GetSettings() const {
+            return settings_;
+        }
+
+        // approximate bytes of the route table, the distances and the graph
+        size_t EstimateMemory() const;
+
+        // Catches up with the database, where the named stops and buses were added, replaced or
+        // removed. When edges only appear or get lighter the route table is updated in place,
+        // otherwise it is computed anew; removals renumber everything.
+        void ApplyChanges(const Data::Database &database, const std::vector<std::string> &stops,
+                          const std::vector<std::string> &buses);
+
         std::optional<Response::Route> GetRoute(const std::string &from, const std::string &to) const;
 
+        // routes from one stop to each of `to`, found with a single search
+        std::vector<std::optional<Response::Route>> GetRoutes(const std::string &from,
+                                                              const std::vector<std::string> &to) const;
+
+        // travel times between every origin and destination; nullopt if any stop is unknown
+        std::optional<Response::Matrix> GetMatrix(const std::vector<std::string> &from,
+                                                  const std::vector<std::string> &to) const;
+
+        // stops reachable from `from` within `max_time` minutes; nullopt if there is no such stop
+        std::optional<Response::ReachableStops> GetReachableStops(const std::string &from, double max_time) const;
+
     private:
-        void ResizeToFit(size_t column, size_t row);
+        void ResizeToFit(size_t stop_id);
+
+        void FillDistances(const Data::Database &database);
+
+        // recomputes the distances from and to the stop, an explicit one winning over the reverse
+        void RefreshDistances(const Data::Database &database, const std::string &stop);
+
+        // fills graph_, edge_info_ and bus_edges_ from the bus routes
+        void BuildGraph(const Data::Database &database);
+
+        // of the vertex count and the edges, which is all the route table depends on
+        uint64_t HashGraph() const;
+
+        std::optional<Response::Route> MakeRoute(
+                const std::optional<Graph::Router<double>::RouteInfo> &route_info) const;
 
         struct EdgeInfo {
             size_t bus_id;
@@ -64,10 +115,14 @@ namespace Transport {
         NameId stops_;
         NameId buses_;
         RoutingSettings settings_;
-        std::vector<std::vector<std::optional<int>>> distance_table_;
+        // per stop id, road distances by the id of the other stop; one given one way only holds both ways
+        std::vector<std::unordered_map<size_t, int>> distance_table_;
         Graph::DirectedWeightedGraph<double> graph_;
         std::unique_ptr<Graph::Router<double>> graph_router_;
+        // per graph edge, the bus ride it stands for
         std::vector<EdgeInfo> edge_info_;
+        // [begin, end) of the graph edges of each bus
+        std::vector<std::pair<Graph::EdgeId, Graph::EdgeId>> bus_edges_;
     };
 
     RoutingSettings ReadFrom(const Json::Node &);
@@ -2,7 +2,10 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <optional>
 #include <sstream>
 
@@ -65,4 +68,43 @@ inline void ReplaceAll(std::string& str, std::string_view from, std::string_view
     }
     buffer.append(str, prev_pos, pos - prev_pos);
     str.swap(buffer);
-}
\ No newline at end of file
+}
+
+// standard base64 (RFC 4648 alphabet with + and /), padded with = to a multiple of 4 chars
+inline std::string EncodeBase64(std::string_view data) {
+    static constexpr std::string_view kAlphabet =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string result;
+    result.reserve((data.size() + 2) / 3 * 4);
+    for (size_t pos = 0; pos < data.size(); pos += 3) {
+        const size_t count = std::min<size_t>(3, data.size() - pos);
+        uint32_t chunk = 0;
+        for (size_t i = 0; i < 3; ++i) {
+            chunk = (chunk << 8) | (i < count ? static_cast<uint8_t>(data[pos + i]) : 0);
+        }
+        for (size_t i = 0; i < 4; ++i) {
+            result += i <= count ? kAlphabet[(chunk >> (18 - 6 * i)) & 0x3F] : '=';
+        }
+    }
+    return result;
+}
+
+// 64-bit FNV-1a, stable across runs and builds
+inline uint64_t HashFnv1a(std::string_view data) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char c: data) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// lowercase, zero-padded to 16 digits
+inline std::string FormatHex(uint64_t value) {
+    static constexpr std::string_view kDigits = "0123456789abcdef";
+    std::string result(16, '0');
+    for (auto it = result.rbegin(); it != result.rend(); ++it, value >>= 4) {
+        *it = kDigits[value & 0xF];
+    }
+    return result;
+}
@@ -0,0 +1,88 @@
+#include "versioned_guide.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+VersionedGuide::VersionedGuide(std::unique_ptr<TransportGuide> guide, uint64_t first_version)
+        : current_slot_(std::make_unique<Slot>()) {
+    current_slot_->guide = std::move(guide);
+    Publish(first_version, *current_slot_);
+}
+
+void VersionedGuide::Publish(uint64_t id, Slot &slot) {
+    slot.version = Version{.id = id, .guide = slot.guide.get()};
+    current_.store(&slot);
+}
+
+VersionedGuide::VersionPtr VersionedGuide::Pin() const {
+    entering_.fetch_add(1);
+    Slot *slot = current_.load();
+    slot->readers.fetch_add(1);
+    entering_.fetch_sub(1);
+    // the version does not own the slot, dropping the last reference only unpins it
+    return VersionPtr(&slot->version, [slot](const Version *) {
+        slot->readers.fetch_sub(1, std::memory_order_release);
+    });
+}
+
+bool VersionedGuide::IsPinned(const Slot &slot) const {
+    // A reader that loaded the slot before it stopped being current_ is entering until it has
+    // counted itself in, so it shows in one of the two; one entering later loads the new slot.
+    return entering_.load() != 0 || slot.readers.load() != 0;
+}
+
+VersionedGuide::Slot &VersionedGuide::TakeStandby() {
+    if (standby_ && !IsPinned(*standby_)) {
+        try {
+            for (const auto &changes: pending_) {
+                standby_->guide->ApplyChanges(changes);
+            }
+        } catch (...) {
+            // caught up halfway, it is built again below
+            standby_.reset();
+        }
+    } else if (standby_) {
+        retired_.push_back(std::move(standby_));
+    }
+    if (!standby_) {
+        auto slot = std::make_unique<Slot>();
+        slot->guide = current_slot_->guide->Rebuild();
+        standby_ = std::move(slot);
+    }
+    pending_.clear();
+    return *standby_;
+}
+
+uint64_t VersionedGuide::ApplyChanges(const Descriptions::Changes &changes) {
+    std::lock_guard lock(update_mutex_);
+    try {
+        TakeStandby().guide->ApplyChanges(changes);
+    } catch (const std::invalid_argument &) {
+        // rejected before anything changed, the standby is still up to date with current_
+        throw;
+    } catch (...) {
+        // the standby may be changed halfway, so the next update builds it again
+        standby_.reset();
+        throw;
+    }
+
+    const uint64_t id = current_slot_->version.id + 1;
+    Publish(id, *standby_);
+    std::swap(current_slot_, standby_);
+    pending_.push_back(changes);
+
+    ReclaimUnpinned();
+    return id;
+}
+
+void VersionedGuide::Reclaim() {
+    std::lock_guard lock(update_mutex_);
+    ReclaimUnpinned();
+}
+
+void VersionedGuide::ReclaimUnpinned() {
+    retired_.erase(std::remove_if(retired_.begin(), retired_.end(), [this](const SlotPtr &slot) {
+        return !IsPinned(*slot);
+    }), retired_.end());
+}
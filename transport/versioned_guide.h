@@ -0,0 +1,75 @@
+#pragma once
+
+#include "transport_guide.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Serves a TransportGuide that is never changed while it is read. Readers pin the current version
+// and keep answering from it however long they take; updates are applied to a second guide, which
+// is then published in one atomic swap. The guide replaced by it catches up with the update once
+// its last reader is gone and becomes the next one to update, so changes stay incremental.
+// Pinning takes no lock: a reader counts itself in the slot of the guide it loaded from a plain
+// atomic pointer, announcing beforehand that it is doing so. Must outlive the versions pinned
+// from it.
+class VersionedGuide {
+public:
+    struct Version {
+        uint64_t id;
+        const TransportGuide *guide;
+    };
+
+    using VersionPtr = std::shared_ptr<const Version>;
+
+    // the guide is published as version `first_version`, e.g. to go on numbering after a reload
+    explicit VersionedGuide(std::unique_ptr<TransportGuide> guide, uint64_t first_version = 1);
+
+    // the current version; it stays valid, and unchanged, for as long as the pointer is held
+    VersionPtr Pin() const;
+
+    // Applies the changes as a new version and publishes it; returns its id. Throws like
+    // TransportGuide::ApplyChanges, and then nothing is published. Updates are serialized.
+    // An update failing otherwise than by rejecting the changes drops the guide it was applied to,
+    // and the next update builds it again.
+    uint64_t ApplyChanges(const Descriptions::Changes &changes);
+
+    // frees retired guides nobody reads any more; updates do it too
+    void Reclaim();
+
+private:
+    struct Slot {
+        std::unique_ptr<TransportGuide> guide;
+        // the version the guide was last published as
+        Version version = {};
+        // versions of the guide alive, dropped with release by their readers
+        std::atomic<size_t> readers = 0;
+    };
+
+    using SlotPtr = std::unique_ptr<Slot>;
+
+    void Publish(uint64_t id, Slot &slot);
+
+    // whether a slot other than current_ may still be read
+    bool IsPinned(const Slot &slot) const;
+
+    // the slot to apply the next update to, caught up with current_
+    Slot &TakeStandby();
+
+    void ReclaimUnpinned();
+
+    std::mutex update_mutex_;
+    // the guide of current_, writable
+    SlotPtr current_slot_;
+    // the previous guide, behind current_ by `pending_`
+    SlotPtr standby_;
+    std::vector<Descriptions::Changes> pending_;
+    // guides dropped while still pinned; freed here rather than by their last reader
+    std::vector<SlotPtr> retired_;
+    // current_slot_, as readers load it
+    std::atomic<Slot *> current_;
+    // readers between loading current_ and counting themselves in its slot
+    mutable std::atomic<size_t> entering_ = 0;
+};